@@ -0,0 +1,326 @@
+/*
+ * Redistribution and use in source and binary forms, with
+ * or without modification, are permitted provided that the
+ * following conditions are met:
+ *
+ * 1. Redistributions of source code must retain this list
+ *    of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce this
+ *    list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+#include <config.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "corpus.h"
+
+const unsigned int corpus_versions[] = {
+    1, 2, 3, 4, 5, 6, 7, 8, 9, 95, 10, 103, 105, 11, 12, 123, 125, 128, 13,
+    14, 143, 15, 16, 0
+};
+
+const char* const corpus_profile_names[] = {
+    "text", "image", "random", "mixed", NULL
+};
+
+const char* const corpus_distribution_names[] = {
+    "fixed", "uniform", "pareto", NULL
+};
+
+void
+corpus_default_options(
+    corpus_options_t* options)
+{
+    options->entries = 64;
+    options->size = 16384;
+    options->distribution = CORPUS_PARETO;
+    options->profile = CORPUS_MIXED;
+    options->seed = 1;
+}
+
+int
+corpus_parse_profile(
+    const char* name,
+    corpus_profile_t* profile)
+{
+    for (unsigned int i = 0; corpus_profile_names[i]; ++i) {
+        if (!strcmp(name, corpus_profile_names[i])) {
+            *profile = (corpus_profile_t)i;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int
+corpus_parse_distribution(
+    const char* name,
+    corpus_distribution_t* distribution)
+{
+    for (unsigned int i = 0; corpus_distribution_names[i]; ++i) {
+        if (!strcmp(name, corpus_distribution_names[i])) {
+            *distribution = (corpus_distribution_t)i;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+uint64_t
+corpus_random(
+    uint64_t* state)
+{
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * UINT64_C(0x2545f4914f6cdd1d);
+}
+
+static void
+corpus_fill_text(
+    unsigned char* buf,
+    size_t size,
+    uint64_t* state)
+{
+    static const char* words[] = {
+        "the", "a", "of", "and", "to", "in", "is", "shrine", "maiden",
+        "youkai", "spell", "card", "danmaku", "border", "moon", "night",
+        "bullet", "stage", "boss", "player", "score", "graze", "bomb", "life",
+        "power", "point", "item", "sakura", "cherry", "blossom", "festival",
+        "mansion", "scarlet", "lake", "bamboo", "forest", "mountain", "wind",
+        "faith", "temple", "dream", "reality", "ghost", "garden", "netherworld",
+        "sun", "flower", "tea"
+    };
+    const unsigned int word_count = sizeof(words) / sizeof(words[0]);
+    size_t pos = 0;
+    unsigned int line_words = 0;
+
+    while (pos < size) {
+        uint64_t r = corpus_random(state);
+        const char* word = words[r % word_count];
+        size_t len = strlen(word);
+
+        if (len > size - pos)
+            len = size - pos;
+        memcpy(buf + pos, word, len);
+        pos += len;
+
+        if (pos < size) {
+            /* Lines of 6 to 13 words. */
+            if (++line_words >= 6 + ((r >> 32) & 7)) {
+                buf[pos++] = '\n';
+                line_words = 0;
+            } else {
+                buf[pos++] = ' ';
+            }
+        }
+    }
+}
+
+static void
+corpus_fill_image(
+    unsigned char* buf,
+    size_t size,
+    uint64_t* state)
+{
+    /* 256 pixels to the row. */
+    const size_t row_size = 1024;
+    uint64_t noise = 0;
+
+    for (size_t pos = 0; pos < size; ++pos) {
+        const unsigned int x = (pos % row_size) / 4;
+        const unsigned int y = pos / row_size;
+        unsigned int value;
+
+        if (pos % 16 == 0)
+            noise = corpus_random(state);
+
+        switch (pos % 4) {
+        case 0:
+            value = x + y;
+            break;
+        case 1:
+            value = x * 2 + y / 2;
+            break;
+        case 2:
+            value = y * 3;
+            break;
+        default:
+            buf[pos] = 0xff;
+            continue;
+        }
+
+        buf[pos] = value + (noise & 3);
+        noise >>= 2;
+    }
+}
+
+static void
+corpus_fill_random(
+    unsigned char* buf,
+    size_t size,
+    uint64_t* state)
+{
+    size_t pos;
+
+    for (pos = 0; pos + 8 <= size; pos += 8) {
+        const uint64_t r = corpus_random(state);
+        memcpy(buf + pos, &r, 8);
+    }
+
+    if (pos < size) {
+        const uint64_t r = corpus_random(state);
+        memcpy(buf + pos, &r, size - pos);
+    }
+}
+
+void
+corpus_fill(
+    unsigned char* buf,
+    size_t size,
+    corpus_profile_t profile,
+    uint64_t* state)
+{
+    switch (profile) {
+    case CORPUS_TEXT:
+        corpus_fill_text(buf, size, state);
+        break;
+    case CORPUS_IMAGE:
+        corpus_fill_image(buf, size, state);
+        break;
+    default:
+        corpus_fill_random(buf, size, state);
+        break;
+    }
+}
+
+static size_t
+corpus_entry_size(
+    const corpus_options_t* options,
+    uint64_t* state)
+{
+    const uint64_t r = corpus_random(state);
+
+    switch (options->distribution) {
+    case CORPUS_UNIFORM:
+        return r % (options->size * 2 + 1);
+    case CORPUS_PARETO: {
+        /* With a shape of 1.5 the mean is three times the minimum.  The
+         * largest entries are capped at 64 times the average. */
+        const double u = ((r >> 11) + 1) * (1.0 / 9007199254740992.0);
+        const double size = options->size / 3.0 / pow(u, 1 / 1.5);
+        return size < options->size * 64.0 ? (size_t)size : options->size * 64;
+    }
+    default:
+        return options->size;
+    }
+}
+
+corpus_entry_t*
+corpus_generate(
+    unsigned int version,
+    const corpus_options_t* options)
+{
+    static const char* extensions[] = { "txt", "bmp", "bin" };
+    corpus_entry_t* entries = malloc(options->entries * sizeof(*entries));
+    uint64_t state = options->seed ^ UINT64_C(0x9e3779b97f4a7c15);
+
+    if (!state)
+        state = 1;
+
+    for (unsigned int i = 0; i < options->entries; ++i) {
+        const corpus_profile_t profile = options->profile == CORPUS_MIXED ?
+            (corpus_profile_t)(i % 3) : options->profile;
+        const size_t size = corpus_entry_size(options, &state);
+        corpus_entry_t* entry = &entries[i];
+
+        /* One byte more, so that empty entries still have a buffer. */
+        entry->data = malloc(size + 1);
+        corpus_fill(entry->data, size, profile, &state);
+        entry->size = size;
+        if (version >= 3 && version <= 5 && entry->size > 0xffff)
+            entry->size = 0xffff;
+
+        snprintf(entry->name, sizeof(entry->name), "e%05u.%s", i,
+            extensions[profile]);
+    }
+
+    return entries;
+}
+
+void
+corpus_free(
+    corpus_entry_t* entries,
+    unsigned int count)
+{
+    for (unsigned int i = 0; i < count; ++i)
+        free(entries[i].data);
+    free(entries);
+}
+
+int
+corpus_write_archive(
+    unsigned int version,
+    const corpus_options_t* options,
+    thtk_io_t* output,
+    thtk_error_t** error)
+{
+    corpus_entry_t* entries;
+    thdat_builder_t* builder;
+    int ret = 0;
+
+    if (!(builder = thdat_builder_new(version, output, error)))
+        return 0;
+
+    entries = corpus_generate(version, options);
+
+    for (unsigned int i = 0; i < options->entries; ++i) {
+        thtk_io_t* input;
+
+        /* The stream takes the data over. */
+        input = thtk_io_open_memory(entries[i].data, entries[i].size, error);
+        entries[i].data = NULL;
+        if (!input)
+            goto out;
+
+        if (thdat_builder_add(builder, entries[i].name, input,
+                entries[i].size, error) == -1) {
+            thtk_io_close(input);
+            goto out;
+        }
+
+        thtk_io_close(input);
+    }
+
+    ret = thdat_builder_finish(builder, error);
+    builder = NULL;
+
+out:
+    if (builder)
+        thdat_builder_free(builder);
+    corpus_free(entries, options->entries);
+    return ret;
+}
@@ -0,0 +1,128 @@
+/*
+ * Redistribution and use in source and binary forms, with
+ * or without modification, are permitted provided that the
+ * following conditions are met:
+ *
+ * 1. Redistributions of source code must retain this list
+ *    of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce this
+ *    list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+#ifndef CORPUS_H_
+#define CORPUS_H_
+
+#include <config.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <thtk/thtk.h>
+
+/* What the data of generated entries looks like. */
+typedef enum {
+    /* Lines of words from a small vocabulary, like scripts and text files. */
+    CORPUS_TEXT,
+    /* Rows of 32-bit pixels with smooth gradients and a little noise. */
+    CORPUS_IMAGE,
+    /* Incompressible bytes, like already compressed audio. */
+    CORPUS_RANDOM,
+    /* Each of the above in turn. */
+    CORPUS_MIXED
+} corpus_profile_t;
+
+/* How the sizes of generated entries are spread around the average size. */
+typedef enum {
+    /* Every entry has the average size. */
+    CORPUS_FIXED,
+    /* Between zero and twice the average size. */
+    CORPUS_UNIFORM,
+    /* Mostly small entries with a few large ones, as in game archives. */
+    CORPUS_PARETO
+} corpus_distribution_t;
+
+typedef struct {
+    unsigned int entries;
+    size_t size;
+    corpus_distribution_t distribution;
+    corpus_profile_t profile;
+    uint64_t seed;
+} corpus_options_t;
+
+/* Every version thdat can create, terminated by 0. */
+extern const unsigned int corpus_versions[];
+
+/* Names of the profiles and distributions, as used on the command line,
+ * indexed by their values and terminated by NULL. */
+extern const char* const corpus_profile_names[];
+extern const char* const corpus_distribution_names[];
+
+/* Fills options with the defaults: 64 entries of about 16 KiB each. */
+void corpus_default_options(
+    corpus_options_t* options);
+
+/* Parse the names used on the command line.  0 indicates an unknown name. */
+int corpus_parse_profile(
+    const char* name,
+    corpus_profile_t* profile);
+
+int corpus_parse_distribution(
+    const char* name,
+    corpus_distribution_t* distribution);
+
+/* Returns the next number from a xorshift64* generator.  The state must not
+ * be zero. */
+uint64_t corpus_random(
+    uint64_t* state);
+
+/* Fills buf with size bytes of data of the given profile, which must not be
+ * CORPUS_MIXED. */
+void corpus_fill(
+    unsigned char* buf,
+    size_t size,
+    corpus_profile_t profile,
+    uint64_t* state);
+
+typedef struct {
+    char name[32];
+    unsigned char* data;
+    size_t size;
+} corpus_entry_t;
+
+/* Generates options->entries entries for an archive of the given version.
+ * The same options give the same entries for every version, except that
+ * TH03 to TH05 entries are cut off at 64 KiB, which is as large as those
+ * formats can store. */
+corpus_entry_t* corpus_generate(
+    unsigned int version,
+    const corpus_options_t* options);
+
+void corpus_free(
+    corpus_entry_t* entries,
+    unsigned int count);
+
+/* Creates an archive of the given version in output with the entries
+ * corpus_generate returns.  output must be readable as well as writable.  0
+ * indicates an error. */
+int corpus_write_archive(
+    unsigned int version,
+    const corpus_options_t* options,
+    thtk_io_t* output,
+    thtk_error_t** error);
+
+#endif
@@ -0,0 +1,698 @@
+/*
+ * Redistribution and use in source and binary forms, with
+ * or without modification, are permitted provided that the
+ * following conditions are met:
+ *
+ * 1. Redistributions of source code must retain this list
+ *    of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce this
+ *    list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+#include <config.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thtk/thtk.h>
+#include <thtk/bits.h>
+#include <thtk/thcrypt.h>
+#include <thtk/thcrypt105.h>
+#include <thtk/thlzss.h>
+#include <thtk/thrle.h>
+#include <thtk/util.h>
+#include "corpus.h"
+#include "program.h"
+#include "mygetopt.h"
+
+static void
+print_usage(
+    void)
+{
+    printf("Usage: %s [-V] [-b NAME] [-c SIZE] [-m MILLISECONDS] [-t THREADS] [-n COUNT] [-s SIZE] [-d DISTRIBUTION] [-p PROFILE] [-r SEED] [-v VERSION]\n"
+           "Measures the codecs and archive operations of thtk and prints the results\n"
+           "as JSON.  Archives are generated in memory as by thtk_corpus.\n"
+           "Options:\n"
+           "  -b  only run the benchmarks whose name contains NAME\n"
+           "  -c  size of the buffers the codecs are run on (default 1048576)\n"
+           "  -m  run each benchmark for at least this long (default 200)\n"
+           "  -t  comma-separated thread counts for the parallel benchmarks\n"
+           "      (default powers of two up to the number of processors)\n"
+           "  -n  number of entries in each archive (default 64)\n"
+           "  -s  average entry size in bytes (default 16384)\n"
+           "  -d  entry sizes: fixed, uniform or pareto (default pareto)\n"
+           "  -p  entry data: text, image, random or mixed (default mixed)\n"
+           "  -r  seed for the generated data (default 1)\n"
+           "  -v  only benchmark archives of VERSION\n"
+           "  -V  display version information and exit\n"
+           "Report bugs to <" PACKAGE_BUGREPORT ">.\n", argv0);
+}
+
+/* Takes the error by address, as it's only set once ok has been
+ * evaluated. */
+static void
+bench_check(
+    int ok,
+    thtk_error_t** error)
+{
+    if (!ok) {
+        fprintf(stderr, "%s:%s\n", argv0,
+            *error ? thtk_error_message(*error) : "benchmark failed");
+        exit(1);
+    }
+}
+
+typedef struct {
+    const char* filter;
+    uint64_t min_ns;
+    unsigned int* threads;
+    unsigned int thread_count;
+    /* Nothing printed yet, so the next result needs no comma. */
+    int first;
+} bench_t;
+
+typedef void (*bench_func_t)(void* arg);
+
+static int
+bench_wanted(
+    const bench_t* bench,
+    const char* name)
+{
+    return !bench->filter || strstr(name, bench->filter);
+}
+
+/* Calls func until at least min_ns have passed, after a first call that
+ * isn't timed, and prints the result.  bytes and entries are the amount of
+ * work done by each call, and left out of the result if zero. */
+static void
+bench_run(
+    bench_t* bench,
+    const char* name,
+    const char* profile,
+    unsigned int version,
+    bench_func_t func,
+    void* arg,
+    uint64_t bytes,
+    uint64_t entries)
+{
+    uint64_t iterations = 0;
+    uint64_t elapsed;
+    uint64_t start;
+    double seconds;
+
+    func(arg);
+
+    start = thtk_clock_ns();
+    do {
+        func(arg);
+        ++iterations;
+        elapsed = thtk_clock_ns() - start;
+    } while (elapsed < bench->min_ns);
+
+    seconds = elapsed / 1e9;
+
+    printf("%s\n    {\"name\": \"%s\"", bench->first ? "" : ",", name);
+    if (profile)
+        printf(", \"profile\": \"%s\"", profile);
+    if (version)
+        printf(", \"version\": %u", version);
+    printf(", \"threads\": %u, \"iterations\": %" PRIu64
+        ", \"ns_per_iteration\": %" PRIu64,
+        thtk_get_threads(), iterations, elapsed / iterations);
+    if (bytes)
+        printf(", \"bytes\": %" PRIu64 ", \"mb_per_s\": %.2f",
+            bytes, bytes * iterations / seconds / 1e6);
+    if (entries)
+        printf(", \"entries\": %" PRIu64 ", \"entries_per_s\": %.1f",
+            entries, entries * iterations / seconds);
+    printf("}");
+    fflush(stdout);
+
+    bench->first = 0;
+}
+
+/* Runs a benchmark once for each thread count. */
+static void
+bench_sweep(
+    bench_t* bench,
+    const char* name,
+    const char* profile,
+    unsigned int version,
+    bench_func_t func,
+    void* arg,
+    uint64_t bytes,
+    uint64_t entries)
+{
+    for (unsigned int i = 0; i < bench->thread_count; ++i) {
+        thtk_set_threads(bench->threads[i]);
+        bench_run(bench, name, profile, version, func, arg, bytes, entries);
+    }
+    thtk_set_threads(1);
+}
+
+/* Codecs. */
+
+typedef struct {
+    unsigned char* data;
+    size_t size;
+    /* data compressed with LZSS and RLE, and scratch space for the output of
+     * each codec. */
+    unsigned char* lzss;
+    size_t lzss_size;
+    unsigned char* rle;
+    size_t rle_size;
+    unsigned char* scratch;
+    /* Stream versions of the above, rewound before each use.  The streams
+     * own copies of the data. */
+    thtk_io_t* data_stream;
+    thtk_io_t* lzss_stream;
+    thtk_io_t* rle_stream;
+    thtk_io_t* output;
+} codec_t;
+
+static thtk_io_t*
+codec_stream(
+    const unsigned char* data,
+    size_t size)
+{
+    unsigned char* copy = malloc(size + 1);
+    memcpy(copy, data, size);
+    return thtk_io_open_memory(copy, size, NULL);
+}
+
+static void
+codec_rewind(
+    thtk_io_t* input,
+    thtk_io_t* output)
+{
+    thtk_error_t* error = NULL;
+    bench_check(thtk_io_seek(input, 0, SEEK_SET, &error) != -1, &error);
+    bench_check(thtk_io_seek(output, 0, SEEK_SET, &error) != -1, &error);
+}
+
+static void
+bench_th_lzss(
+    void* arg)
+{
+    codec_t* codec = arg;
+    thtk_error_t* error = NULL;
+    codec_rewind(codec->data_stream, codec->output);
+    bench_check(th_lzss(codec->data_stream, codec->size, codec->output,
+        &error) != -1, &error);
+}
+
+static void
+bench_th_unlzss(
+    void* arg)
+{
+    codec_t* codec = arg;
+    thtk_error_t* error = NULL;
+    codec_rewind(codec->lzss_stream, codec->output);
+    bench_check(th_unlzss(codec->lzss_stream, codec->output, codec->size,
+        &error) != -1, &error);
+}
+
+static void
+bench_th_lzss_mem_parallel(
+    void* arg)
+{
+    codec_t* codec = arg;
+    th_lzss_mem_parallel(codec->data, codec->size, codec->scratch);
+}
+
+static void
+bench_thtk_rle(
+    void* arg)
+{
+    codec_t* codec = arg;
+    thtk_error_t* error = NULL;
+    codec_rewind(codec->data_stream, codec->output);
+    bench_check(thtk_rle(codec->data_stream, codec->size, codec->output,
+        &error) != -1, &error);
+}
+
+static void
+bench_thtk_unrle(
+    void* arg)
+{
+    codec_t* codec = arg;
+    thtk_error_t* error = NULL;
+    codec_rewind(codec->rle_stream, codec->output);
+    bench_check(thtk_unrle(codec->rle_stream, codec->rle_size, codec->output,
+        &error) != -1, &error);
+}
+
+static void
+bench_th_encrypt(
+    void* arg)
+{
+    codec_t* codec = arg;
+    th_encrypt(codec->scratch, codec->size, 0x1b, 0x37, 0x400, codec->size);
+}
+
+static void
+bench_th_decrypt(
+    void* arg)
+{
+    codec_t* codec = arg;
+    th_decrypt(codec->scratch, codec->size, 0x1b, 0x37, 0x400, codec->size);
+}
+
+static void
+bench_th_crypt105_list(
+    void* arg)
+{
+    codec_t* codec = arg;
+    th_crypt105_list(codec->scratch, codec->size, 0xc5, 0x83, 0x53);
+}
+
+static void
+bench_th_crypt105_file(
+    void* arg)
+{
+    codec_t* codec = arg;
+    th_crypt105_file(codec->scratch, codec->size, 0x1234);
+}
+
+/* The bit operations read and write 9-bit codes, like the LZSS literals. */
+static void
+bench_bitwriter_write(
+    void* arg)
+{
+    codec_t* codec = arg;
+    struct bitwriter b;
+
+    bitwriter_init(&b);
+    for (size_t i = 0; i < codec->size * 8 / 9; ++i)
+        bitwriter_write(&b, 9, 0x100 | codec->data[i]);
+    free(b.data);
+}
+
+static void
+bench_bitreader_read(
+    void* arg)
+{
+    codec_t* codec = arg;
+    struct bitreader b;
+    uint32_t sum = 0;
+
+    bitreader_init(&b, codec->data, codec->size);
+    for (size_t i = 0; i < codec->size * 8 / 9; ++i)
+        sum += bitreader_read(&b, 9);
+    /* Keep the reads from being optimized away. */
+    codec->scratch[0] = sum;
+}
+
+static void
+bench_codecs(
+    bench_t* bench,
+    size_t size,
+    uint64_t seed)
+{
+    static const struct {
+        const char* name;
+        bench_func_t func;
+        int parallel;
+    } benchmarks[] = {
+        { "th_lzss", bench_th_lzss, 0 },
+        { "th_unlzss", bench_th_unlzss, 0 },
+        { "th_lzss_mem_parallel", bench_th_lzss_mem_parallel, 1 },
+        { "thtk_rle", bench_thtk_rle, 0 },
+        { "thtk_unrle", bench_thtk_unrle, 0 },
+        { "th_encrypt", bench_th_encrypt, 0 },
+        { "th_decrypt", bench_th_decrypt, 0 },
+        { "th_crypt105_list", bench_th_crypt105_list, 0 },
+        { "th_crypt105_file", bench_th_crypt105_file, 0 },
+        { "bitwriter_write", bench_bitwriter_write, 0 },
+        { "bitreader_read", bench_bitreader_read, 0 },
+        { NULL, NULL, 0 }
+    };
+    uint64_t state = seed ^ UINT64_C(0x9e3779b97f4a7c15);
+
+    if (!state)
+        state = 1;
+
+    for (int profile = CORPUS_TEXT; profile < CORPUS_MIXED; ++profile) {
+        codec_t codec;
+        thtk_error_t* error = NULL;
+
+        codec.data = malloc(size + 1);
+        codec.size = size;
+        corpus_fill(codec.data, size, (corpus_profile_t)profile, &state);
+
+        codec.scratch = malloc(TH_LZSS_BOUND(size) + size);
+        codec.lzss = malloc(TH_LZSS_BOUND(size));
+        codec.lzss_size = th_lzss_mem(codec.data, size, codec.lzss);
+        codec.rle_size = thtk_rle_mem(codec.data, size, NULL, 0);
+        codec.rle = malloc(codec.rle_size + 1);
+        thtk_rle_mem(codec.data, size, codec.rle, codec.rle_size);
+        memcpy(codec.scratch, codec.data, size);
+
+        codec.data_stream = codec_stream(codec.data, size);
+        codec.lzss_stream = codec_stream(codec.lzss, codec.lzss_size);
+        codec.rle_stream = codec_stream(codec.rle, codec.rle_size);
+        bench_check(!!(codec.output = thtk_io_open_growing_memory(&error)),
+            &error);
+
+        for (unsigned int i = 0; benchmarks[i].name; ++i) {
+            if (!bench_wanted(bench, benchmarks[i].name))
+                continue;
+            if (benchmarks[i].parallel)
+                bench_sweep(bench, benchmarks[i].name,
+                    corpus_profile_names[profile], 0, benchmarks[i].func,
+                    &codec, size, 0);
+            else
+                bench_run(bench, benchmarks[i].name,
+                    corpus_profile_names[profile], 0, benchmarks[i].func,
+                    &codec, size, 0);
+        }
+
+        thtk_io_close(codec.output);
+        thtk_io_close(codec.rle_stream);
+        thtk_io_close(codec.lzss_stream);
+        thtk_io_close(codec.data_stream);
+        free(codec.rle);
+        free(codec.lzss);
+        free(codec.scratch);
+        free(codec.data);
+    }
+}
+
+/* Archives. */
+
+typedef struct {
+    unsigned int version;
+    corpus_entry_t* entries;
+    unsigned int entry_count;
+    /* The archive built from the entries. */
+    thtk_io_t* stream;
+    /* Opened once for extraction. */
+    thdat_t* thdat;
+} archive_t;
+
+static thtk_io_t*
+archive_input(
+    void* arg,
+    thdat_t* thdat,
+    int entry_index,
+    size_t* length,
+    thtk_error_t** error)
+{
+    const archive_t* archive = arg;
+    const corpus_entry_t* entry = &archive->entries[entry_index];
+    (void)thdat;
+
+    /* The stream frees its buffer, so it gets a copy.  Copying costs little
+     * next to compressing. */
+    *length = entry->size;
+    return codec_stream(entry->data, entry->size);
+}
+
+static int
+archive_discard(
+    void* arg,
+    thdat_t* thdat,
+    int entry_index,
+    const unsigned char* data,
+    size_t size,
+    thtk_error_t** error)
+{
+    (void)arg;
+    (void)thdat;
+    (void)entry_index;
+    (void)data;
+    (void)size;
+    (void)error;
+    return 1;
+}
+
+static void
+bench_create(
+    void* arg)
+{
+    archive_t* archive = arg;
+    thtk_error_t* error = NULL;
+    thtk_io_t* output;
+    thdat_t* thdat;
+
+    bench_check(!!(output = thtk_io_open_growing_memory(&error)), &error);
+    bench_check(!!(thdat = thdat_create(archive->version, output,
+        archive->entry_count, &error)), &error);
+    for (unsigned int i = 0; i < archive->entry_count; ++i)
+        bench_check(thdat_entry_set_name(thdat, i, archive->entries[i].name,
+            &error), &error);
+    /* The entry list comes first in these, so it needs the names. */
+    if (archive->version == 105 || archive->version == 123)
+        bench_check(thdat_init(thdat, &error), &error);
+    bench_check(thdat_write_all(thdat, archive_input, NULL, archive,
+        &error) == 0, &error);
+    bench_check(thdat_close(thdat, &error), &error);
+    thdat_free(thdat);
+    thtk_io_close(output);
+}
+
+static void
+bench_open(
+    void* arg)
+{
+    archive_t* archive = arg;
+    thtk_error_t* error = NULL;
+    thdat_t* thdat;
+
+    bench_check(!!(thdat = thdat_open(archive->version, archive->stream,
+        &error)), &error);
+    thdat_free(thdat);
+}
+
+static void
+bench_list(
+    void* arg)
+{
+    archive_t* archive = arg;
+    thtk_error_t* error = NULL;
+    thdat_t* thdat;
+    ssize_t count;
+
+    bench_check(!!(thdat = thdat_open(archive->version, archive->stream,
+        &error)), &error);
+    bench_check((count = thdat_entry_count(thdat, &error)) != -1, &error);
+    for (ssize_t i = 0; i < count; ++i) {
+        bench_check(thdat_entry_get_name(thdat, i, &error) != NULL, &error);
+        bench_check(thdat_entry_get_size(thdat, i, &error) != -1, &error);
+    }
+    thdat_free(thdat);
+}
+
+static void
+bench_extract(
+    void* arg)
+{
+    archive_t* archive = arg;
+    thtk_error_t* error = NULL;
+
+    bench_check(thdat_read_all(archive->thdat, archive_discard, NULL, NULL,
+        &error) == 0, &error);
+}
+
+static void
+bench_detect(
+    void* arg)
+{
+    archive_t* archive = arg;
+    thtk_error_t* error = NULL;
+    uint32_t out[4];
+    unsigned int heur;
+
+    bench_check(thdat_detect(NULL, archive->stream, out, &heur, &error) != -1,
+        &error);
+}
+
+static void
+bench_archives(
+    bench_t* bench,
+    unsigned int only_version,
+    const corpus_options_t* options)
+{
+    for (unsigned int v = 0; corpus_versions[v]; ++v) {
+        archive_t archive;
+        thtk_error_t* error = NULL;
+        uint64_t bytes = 0;
+
+        if (only_version && corpus_versions[v] != only_version)
+            continue;
+
+        archive.version = corpus_versions[v];
+        archive.entry_count = options->entries;
+        archive.entries = corpus_generate(archive.version, options);
+        for (unsigned int i = 0; i < archive.entry_count; ++i)
+            bytes += archive.entries[i].size;
+
+        bench_check(!!(archive.stream = thtk_io_open_growing_memory(&error)),
+            &error);
+        bench_check(corpus_write_archive(archive.version, options,
+            archive.stream, &error), &error);
+        bench_check(!!(archive.thdat = thdat_open(archive.version,
+            archive.stream, &error)), &error);
+
+        if (bench_wanted(bench, "thdat_detect"))
+            bench_run(bench, "thdat_detect", NULL, archive.version,
+                bench_detect, &archive, 0, 0);
+        if (bench_wanted(bench, "open"))
+            bench_run(bench, "open", NULL, archive.version,
+                bench_open, &archive, 0, archive.entry_count);
+        if (bench_wanted(bench, "list"))
+            bench_run(bench, "list", NULL, archive.version,
+                bench_list, &archive, 0, archive.entry_count);
+        if (bench_wanted(bench, "extract"))
+            bench_sweep(bench, "extract", NULL, archive.version,
+                bench_extract, &archive, bytes, archive.entry_count);
+        if (bench_wanted(bench, "create"))
+            bench_sweep(bench, "create", NULL, archive.version,
+                bench_create, &archive, bytes, archive.entry_count);
+
+        thdat_free(archive.thdat);
+        thtk_io_close(archive.stream);
+        corpus_free(archive.entries, archive.entry_count);
+    }
+}
+
+/* Parses a comma-separated list of thread counts. */
+static unsigned int
+parse_threads(
+    const char* str,
+    unsigned int* threads,
+    unsigned int max)
+{
+    unsigned int count = 0;
+
+    while (*str && count < max) {
+        char* end;
+        const unsigned long value = strtoul(str, &end, 10);
+        if (end == str || !value)
+            return 0;
+        threads[count++] = value;
+        str = *end == ',' ? end + 1 : end;
+        if (*end && *end != ',')
+            return 0;
+    }
+
+    return count;
+}
+
+int
+main(
+    int argc,
+    char* argv[])
+{
+    unsigned int threads[32];
+    corpus_options_t options;
+    bench_t bench;
+    size_t codec_size = 1048576;
+    unsigned int version = 0;
+    int ind = 0;
+    int opt;
+
+    argv0 = util_shortname(argv[0]);
+    corpus_default_options(&options);
+    bench.filter = NULL;
+    bench.min_ns = 200 * UINT64_C(1000000);
+    bench.threads = threads;
+    bench.thread_count = 0;
+    bench.first = 1;
+
+    while (argv[util_optind]) {
+        switch (opt = util_getopt(argc, argv, ":b:c:m:t:n:s:d:p:r:v:V")) {
+        case 'b':
+            bench.filter = util_optarg;
+            break;
+        case 'c':
+            codec_size = strtoull(util_optarg, NULL, 10);
+            break;
+        case 'm':
+            bench.min_ns = strtoull(util_optarg, NULL, 10) * UINT64_C(1000000);
+            break;
+        case 't':
+            if (!(bench.thread_count = parse_threads(util_optarg, threads,
+                    sizeof(threads) / sizeof(threads[0])))) {
+                fprintf(stderr, "%s: invalid thread counts: %s\n", argv0, util_optarg);
+                exit(1);
+            }
+            break;
+        case 'n':
+            options.entries = strtoul(util_optarg, NULL, 10);
+            break;
+        case 's':
+            options.size = strtoull(util_optarg, NULL, 10);
+            break;
+        case 'd':
+            if (!corpus_parse_distribution(util_optarg, &options.distribution)) {
+                fprintf(stderr, "%s: unknown distribution: %s\n", argv0, util_optarg);
+                exit(1);
+            }
+            break;
+        case 'p':
+            if (!corpus_parse_profile(util_optarg, &options.profile)) {
+                fprintf(stderr, "%s: unknown profile: %s\n", argv0, util_optarg);
+                exit(1);
+            }
+            break;
+        case 'r':
+            options.seed = strtoull(util_optarg, NULL, 10);
+            break;
+        case 'v':
+            version = parse_version(util_optarg);
+            break;
+        default:
+            util_getopt_default(&ind, argv, opt, print_usage);
+        }
+    }
+
+    if (ind || !options.entries || !codec_size) {
+        print_usage();
+        exit(1);
+    }
+
+    if (!bench.thread_count) {
+        const unsigned int max = thtk_get_threads();
+        for (unsigned int t = 1; t < max && bench.thread_count < 31; t *= 2)
+            threads[bench.thread_count++] = t;
+        threads[bench.thread_count++] = max;
+    }
+
+    printf("{\n  \"thtk_version\": \"%s\",\n", PACKAGE_VERSION);
+    printf("  \"default_threads\": %u,\n", thtk_get_threads());
+    printf("  \"min_ms\": %" PRIu64 ",\n", bench.min_ns / 1000000);
+    printf("  \"codec_size\": %zu,\n", codec_size);
+    printf("  \"corpus\": {\"entries\": %u, \"size\": %zu, \"distribution\": \"%s\", "
+        "\"profile\": \"%s\", \"seed\": %" PRIu64 "},\n",
+        options.entries, options.size,
+        corpus_distribution_names[options.distribution],
+        corpus_profile_names[options.profile], options.seed);
+    printf("  \"results\": [");
+
+    /* Everything not part of a sweep runs on one thread. */
+    thtk_set_threads(1);
+    bench_codecs(&bench, codec_size, options.seed);
+    bench_archives(&bench, version, &options);
+
+    printf("\n  ]\n}\n");
+
+    return 0;
+}
@@ -0,0 +1,163 @@
+/*
+ * Redistribution and use in source and binary forms, with
+ * or without modification, are permitted provided that the
+ * following conditions are met:
+ *
+ * 1. Redistributions of source code must retain this list
+ *    of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce this
+ *    list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thtk/thtk.h>
+#include "corpus.h"
+#include "program.h"
+#include "util.h"
+#include "mygetopt.h"
+
+static void
+print_usage(
+    void)
+{
+    printf("Usage: %s [-V] [-n COUNT] [-s SIZE] [-d DISTRIBUTION] [-p PROFILE] [-r SEED] [-v VERSION] DIRECTORY\n"
+           "Creates an archive of generated entries for every version thdat supports,\n"
+           "named after the version (th06.dat, th95.dat, ...), in DIRECTORY.\n"
+           "Options:\n"
+           "  -n  number of entries in each archive (default 64)\n"
+           "  -s  average entry size in bytes (default 16384)\n"
+           "  -d  entry sizes: fixed, uniform or pareto (default pareto)\n"
+           "  -p  entry data: text, image, random or mixed (default mixed)\n"
+           "  -r  seed for the generated data (default 1)\n"
+           "  -v  only create the archive for VERSION\n"
+           "  -V  display version information and exit\n"
+           "Report bugs to <" PACKAGE_BUGREPORT ">.\n", argv0);
+}
+
+static void
+print_error(
+    thtk_error_t* error)
+{
+    fprintf(stderr, "%s:%s\n", argv0, thtk_error_message(error));
+}
+
+static int
+corpus_create(
+    const char* directory,
+    unsigned int version,
+    const corpus_options_t* options)
+{
+    thtk_error_t* error = NULL;
+    char name[16];
+    char* path;
+    thtk_io_t* output;
+    int ret;
+
+    snprintf(name, sizeof(name), "th%02u.dat", version);
+    util_makepath_in(directory, name);
+    path = malloc(strlen(directory) + 1 + strlen(name) + 1);
+    sprintf(path, "%s/%s", directory, name);
+
+    /* Some formats read back what was written when finishing up. */
+    if (!(output = thtk_io_open_file(path, "w+b", &error))) {
+        print_error(error);
+        thtk_error_free(&error);
+        free(path);
+        return 0;
+    }
+
+    ret = corpus_write_archive(version, options, output, &error);
+    if (!ret) {
+        print_error(error);
+        thtk_error_free(&error);
+    }
+
+    thtk_io_close(output);
+    free(path);
+    return ret;
+}
+
+int
+main(
+    int argc,
+    char* argv[])
+{
+    corpus_options_t options;
+    unsigned int version = 0;
+    int ind = 0;
+    int opt;
+    int ret = 0;
+
+    argv0 = util_shortname(argv[0]);
+    corpus_default_options(&options);
+
+    while (argv[util_optind]) {
+        switch (opt = util_getopt(argc, argv, ":n:s:d:p:r:v:V")) {
+        case 'n':
+            options.entries = strtoul(util_optarg, NULL, 10);
+            break;
+        case 's':
+            options.size = strtoull(util_optarg, NULL, 10);
+            break;
+        case 'd':
+            if (!corpus_parse_distribution(util_optarg, &options.distribution)) {
+                fprintf(stderr, "%s: unknown distribution: %s\n", argv0, util_optarg);
+                exit(1);
+            }
+            break;
+        case 'p':
+            if (!corpus_parse_profile(util_optarg, &options.profile)) {
+                fprintf(stderr, "%s: unknown profile: %s\n", argv0, util_optarg);
+                exit(1);
+            }
+            break;
+        case 'r':
+            options.seed = strtoull(util_optarg, NULL, 10);
+            break;
+        case 'v':
+            version = parse_version(util_optarg);
+            break;
+        default:
+            util_getopt_default(&ind, argv, opt, print_usage);
+        }
+    }
+    argc = ind;
+    argv[argc] = NULL;
+
+    if (argc != 1 || !options.entries) {
+        print_usage();
+        exit(1);
+    }
+
+    if (version) {
+        if (!corpus_create(argv[0], version, &options))
+            ret = 1;
+    } else {
+        for (unsigned int i = 0; corpus_versions[i]; ++i) {
+            if (!corpus_create(argv[0], corpus_versions[i], &options))
+                ret = 1;
+        }
+    }
+
+    return ret;
+}
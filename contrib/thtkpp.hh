@@ -164,6 +164,12 @@ namespace Thtk {
             if(-1 == rv) throw Thtk::Error(err);
             return rv;
         }
+        ssize_t read(void* buf, size_t capacity) {
+            thtk_error_t* err;
+            ssize_t rv = thdat_entry_read_into(dat,idx,buf,capacity,&err);
+            if(-1 == rv) throw Thtk::Error(err);
+            return rv;
+        }
         friend Thtk::Dat;
     };
     class Dat {
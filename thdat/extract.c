@@ -0,0 +1,240 @@
+/*
+ * Redistribution and use in source and binary forms, with
+ * or without modification, are permitted provided that the
+ * following conditions are met:
+ *
+ * 1. Redistributions of source code must retain this list
+ *    of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce this
+ *    list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thtk/thtk.h>
+#include "extract.h"
+#include "program.h"
+#include "util.h"
+
+static void
+print_error(
+    thtk_error_t* error)
+{
+    fprintf(stderr, "%s:%s\n", argv0, thtk_error_message(error));
+}
+
+void
+thdat_print_entry_error(
+    void* arg,
+    thdat_t* thdat,
+    int entry_index,
+    thtk_error_t* error)
+{
+    print_error(error);
+}
+
+int
+thdat_list_archive(
+    thdat_t* thdat,
+    unsigned int version,
+    thtk_error_t** error)
+{
+    ssize_t entry_count;
+    struct {
+        const char* name;
+        ssize_t size;
+        ssize_t zsize;
+    }* entries;
+    ssize_t e;
+    int name_width = 4;
+
+    if ((entry_count = thdat_entry_count(thdat, error)) == -1)
+        return 0;
+
+    entries = malloc(entry_count * sizeof(*entries));
+
+    for (e = 0; e < entry_count; ++e) {
+        thtk_error_t* error = NULL;
+        entries[e].name = thdat_entry_get_name(thdat, e, &error);
+        entries[e].size = thdat_entry_get_size(thdat, e, &error);
+        entries[e].zsize = thdat_entry_get_zsize(thdat, e, &error);
+        if (!entries[e].name || entries[e].size == -1 || entries[e].zsize == -1) {
+            print_error(error);
+            thtk_error_free(&error);
+            continue;
+        }
+        int entry_name_width = strlen(entries[e].name);
+        if (entry_name_width > name_width)
+            name_width = entry_name_width;
+    }
+
+    // th105: Stored = Size
+    if (version == 105 || version == 123)
+        printf("%-*s  %7s\n", name_width, "Name", "Size");
+    else
+        printf("%-*s  %7s  %7s\n", name_width, "Name", "Size", "Stored");
+    for (e = 0; e < entry_count; ++e) {
+        if (version == 105 || version == 123)
+            printf("%-*s  %7zd\n", name_width, entries[e].name, entries[e].size);
+        else
+            printf("%-*s  %7zd  %7zd\n", name_width, entries[e].name, entries[e].size, entries[e].zsize);
+    }
+
+    free(entries);
+
+    return 1;
+}
+
+/* Creates the file for an entry in dir, or in the current directory if dir is
+ * NULL.  The path is returned in path, to be freed by the caller. */
+static thtk_io_t*
+thdat_open_entry_file(
+    const char* dir,
+    thdat_t* thdat,
+    int entry_index,
+    char** path,
+    thtk_error_t** error)
+{
+    const char* entry_name;
+    thtk_io_t* entry_stream;
+
+    if (!(entry_name = thdat_entry_get_name(thdat, entry_index, error)))
+        return NULL;
+
+    if (dir) {
+        *path = malloc(strlen(dir) + 1 + strlen(entry_name) + 1);
+        sprintf(*path, "%s/%s", dir, entry_name);
+    } else {
+        *path = malloc(strlen(entry_name) + 1);
+        strcpy(*path, entry_name);
+    }
+
+    // For th105: Make sure that the directory exists
+    util_makepath_in(dir, entry_name);
+
+    if (!(entry_stream = thtk_io_open_file(*path, "wb", error))) {
+        free(*path);
+        return NULL;
+    }
+
+    return entry_stream;
+}
+
+/* thdat_output_func_t that creates the file for an entry in the directory
+ * passed as arg, or in the current directory if it is NULL. */
+static thtk_io_t*
+thdat_open_entry_output(
+    void* arg,
+    thdat_t* thdat,
+    int entry_index,
+    thtk_error_t** error)
+{
+    char* path;
+    thtk_io_t* entry_stream;
+
+    if (!(entry_stream = thdat_open_entry_file(arg, thdat, entry_index, &path, error)))
+        return NULL;
+
+    printf("%s\n", path);
+    free(path);
+
+    return entry_stream;
+}
+
+/* The entry is decoded straight into its file, which for formats storing
+ * entries uncompressed takes a fixed amount of memory. */
+int
+thdat_extract_file(
+    thdat_t* thdat,
+    size_t entry_index,
+    const char* dir,
+    thtk_error_t** error)
+{
+    char* path;
+    thtk_io_t* entry_stream;
+
+    if (!(entry_stream = thdat_open_entry_file(dir, thdat, entry_index, &path, error)))
+        return 0;
+
+    const ssize_t size = thdat_entry_read_data(thdat, entry_index, entry_stream, error);
+    thtk_io_close(entry_stream);
+    if (size == -1) {
+        remove(path);
+        free(path);
+        return 0;
+    }
+
+    printf("%s\n", path);
+    free(path);
+
+    return 1;
+}
+
+/* As in thdat_extract_file, stored entries aren't held in memory whole. */
+int
+thdat_extract_all(
+    thdat_t* thdat,
+    const char* dir,
+    thtk_error_t** error)
+{
+    return thdat_read_all_data(thdat, thdat_open_entry_output,
+        thdat_print_entry_error, (void*)dir, error) != -1;
+}
+
+typedef struct {
+    thdat_t* thdat;
+    char** names;
+} thdat_extract_named_t;
+
+static void
+thdat_extract_named_task(
+    void* arg,
+    size_t a)
+{
+    thdat_extract_named_t* named = arg;
+    thtk_error_t* error = NULL;
+    int entry_index;
+
+    if ((entry_index = thdat_entry_by_name(named->thdat, named->names[a], &error)) == -1) {
+        if (error)
+            print_error(error);
+        else
+            fprintf(stderr, "%s: entry `%s' not found\n", argv0, named->names[a]);
+        thtk_error_free(&error);
+        return;
+    }
+
+    if (!thdat_extract_file(named->thdat, entry_index, NULL, &error)) {
+        print_error(error);
+        thtk_error_free(&error);
+    }
+}
+
+void
+thdat_extract_named(
+    thdat_t* thdat,
+    int name_count,
+    char** names)
+{
+    thdat_extract_named_t named = { thdat, names };
+    thtk_parallel_for(name_count, thdat_extract_named_task, &named);
+}
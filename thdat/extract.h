@@ -0,0 +1,76 @@
+/*
+ * Redistribution and use in source and binary forms, with
+ * or without modification, are permitted provided that the
+ * following conditions are met:
+ *
+ * 1. Redistributions of source code must retain this list
+ *    of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce this
+ *    list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+#ifndef EXTRACT_H_
+#define EXTRACT_H_
+
+#include <config.h>
+#include <thtk/thtk.h>
+
+/* Listing and extraction for thdat -l and -x, shared with thtkd so that both
+ * behave the same.  Progress is printed to standard output and errors with
+ * single entries to standard error. */
+
+/* thdat_error_func_t that prints the error. */
+void thdat_print_entry_error(
+    void* arg,
+    thdat_t* thdat,
+    int entry_index,
+    thtk_error_t* error);
+
+/* Prints the name and sizes of every entry.  Returns 0 on error. */
+int thdat_list_archive(
+    thdat_t* thdat,
+    unsigned int version,
+    thtk_error_t** error);
+
+/* Extracts an entry into dir, or into the current directory if dir is NULL.
+ * The file is removed again if the entry couldn't be read.  Returns 0 on
+ * error. */
+int thdat_extract_file(
+    thdat_t* thdat,
+    size_t entry_index,
+    const char* dir,
+    thtk_error_t** error);
+
+/* Extracts every entry into dir, or into the current directory if dir is
+ * NULL, reading the archive in the order in which the entries are stored.
+ * Entries that fail are reported and skipped.  Returns 0 on error. */
+int thdat_extract_all(
+    thdat_t* thdat,
+    const char* dir,
+    thtk_error_t** error);
+
+/* Extracts the named entries into the current directory, in parallel.
+ * Entries that fail are reported and skipped. */
+void thdat_extract_named(
+    thdat_t* thdat,
+    int name_count,
+    char** names);
+
+#endif
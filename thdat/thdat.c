@@ -27,11 +27,20 @@
  * DAMAGE.
  */
 #include <config.h>
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
 #include <thtk/thtk.h>
+#include "daemon.h"
+#include "extract.h"
 #include "program.h"
+#include "sha256.h"
 #include "util.h"
 #include "mygetopt.h"
 
@@ -39,16 +48,32 @@ static void
 print_usage(
     void)
 {
-    printf("Usage: %s [-V] [[-c | -l | -x] VERSION] [ARCHIVE [FILE...]]\n"
+    printf("Usage: %s [-SVt] [[-c | -l | -s | -x] VERSION] [ARCHIVE [FILE...]]\n"
+           "       %s -v VERSION ARCHIVE MANIFEST\n"
+           "       %s [-r] -D VERSION ARCHIVE ARCHIVE\n"
+           "       %s -d ARCHIVE...\n"
+           "       %s [-St] -b MANIFEST\n"
            "Options:\n"
+           "  -b  run the operations listed in MANIFEST (also --batch)\n"
            "  -c  create an archive\n"
+           "  -d  detect the format of each ARCHIVE\n"
+           "  -D  list the files added, removed or changed between two archives (also --diff)\n"
            "  -l  list the contents of an archive\n"
+           "  -r  with -D, print the byte ranges that differ (also --ranges)\n"
+           "  -s  print the SHA-256 of each file in an archive (also --hash)\n"
+           "  -S  with -c, store identical files once (TH06 and TH07 only, also --share)\n"
+           "  -t  print the time spent on each file to standard error (also --timings)\n"
+           "  -v  check the files in an archive against the output of -s (also --verify)\n"
            "  -x  extract an archive\n"
            "  -V  display version information and exit\n"
            "VERSION can be:\n"
            "  1, 2, 3, 4, 5, 6, 7, 8, 9, 95, 10, 103 (for Uwabami Breakers), 105, 11, 12, 123, 125, 128, 13, 14, 143, 15, or 16\n"
-	   "Specify 'd' as VERSION to automatically detect archive format. (-l and -x only)\n\n"
-           "Report bugs to <" PACKAGE_BUGREPORT ">.\n", argv0);
+	   "Specify 'd' as VERSION to automatically detect archive format. (-D, -l, -s, -v and -x only)\n"
+           "Each line of a MANIFEST is one of:\n"
+           "  x VERSION ARCHIVE [DIRECTORY]\n"
+           "  l VERSION ARCHIVE\n"
+           "  c VERSION ARCHIVE FILE...\n\n"
+           "Report bugs to <" PACKAGE_BUGREPORT ">.\n", argv0, argv0, argv0, argv0, argv0);
 }
 
 static void
@@ -58,6 +83,31 @@ print_error(
     fprintf(stderr, "%s:%s\n", argv0, thtk_error_message(error));
 }
 
+/* Set by -t. */
+static int print_timings = 0;
+/* Set by -S. */
+static int share_data = 0;
+
+/* thdat_progress_func_t for -t. */
+static void
+thdat_print_progress(
+    void* arg,
+    thdat_t* thdat,
+    const thdat_progress_t* progress)
+{
+    const char* name = progress->entry_index == -1 ? "entry list" :
+        thdat_entry_get_name(thdat, progress->entry_index, NULL);
+    fprintf(stderr, "%s: %s: read %" PRIu64 " us, decrypt %" PRIu64
+        " us, decompress %" PRIu64 " us, write %" PRIu64 " us, %zu/%zu bytes%s\n",
+        argv0, name,
+        progress->ns[THDAT_PHASE_READ] / 1000,
+        progress->ns[THDAT_PHASE_DECRYPT] / 1000,
+        progress->ns[THDAT_PHASE_DECOMPRESS] / 1000,
+        progress->ns[THDAT_PHASE_WRITE] / 1000,
+        progress->stored_size, progress->size,
+        progress->ok ? "" : ", failed");
+}
+
 typedef struct {
     thdat_t* thdat;
     thtk_io_t* stream;
@@ -103,37 +153,19 @@ thdat_open_file(
         return NULL;
     }
 
+    if (print_timings)
+        thdat_set_progress(state->thdat, thdat_print_progress, NULL);
+
     return state;
 }
 
-static int
-thdat_extract_file(
-    thdat_state_t* state,
-    size_t entry_index,
-    thtk_error_t** error)
+static char*
+thdat_strdup(
+    const char* str)
 {
-    const char* entry_name;
-    thtk_io_t* entry_stream;
-
-    if (!(entry_name = thdat_entry_get_name(state->thdat, entry_index, error)))
-        return 0;
-
-    // For th105: Make sure that the directory exists
-    util_makepath(entry_name);
-
-    if (!(entry_stream = thtk_io_open_file(entry_name, "wb", error)))
-        return 0;
-
-    if (thdat_entry_read_data(state->thdat, entry_index, entry_stream, error) == -1) {
-        thtk_io_close(entry_stream);
-        return 0;
-    }
-
-    printf("%s\n", entry_name);
-
-    thtk_io_close(entry_stream);
-
-    return 1;
+    char* ret = malloc(strlen(str) + 1);
+    strcpy(ret, str);
+    return ret;
 }
 
 static int
@@ -146,79 +178,74 @@ thdat_list(
     if(!state) {
         return 0;
     }
-    ssize_t entry_count;
-    struct {
-        const char* name;
-        ssize_t size;
-        ssize_t zsize;
-    }* entries;
-    ssize_t e;
-    int name_width = 4;
-
-    if ((entry_count = thdat_entry_count(state->thdat, error)) == -1) {
-        thdat_state_free(state);
-        return 0;
-    }
+    const int ret = thdat_list_archive(state->thdat, version, error);
+    thdat_state_free(state);
 
-    entries = malloc(entry_count * sizeof(*entries));
+    return ret;
+}
 
-#pragma omp parallel /* reduction(max:name_width) */
-    {
-#pragma omp for
-        for (e = 0; e < entry_count; ++e) {
-            thtk_error_t* error = NULL;
-            entries[e].name = thdat_entry_get_name(state->thdat, e, &error);
-            entries[e].size = thdat_entry_get_size(state->thdat, e, &error);
-            entries[e].zsize = thdat_entry_get_zsize(state->thdat, e, &error);
-            if (!entries[e].name || entries[e].size == -1 || entries[e].zsize == -1) {
-                print_error(error);
-                thtk_error_free(&error);
-                continue;
-            }
-            int entry_name_width = strlen(entries[e].name);
-#pragma omp critical
-            if (entry_name_width > name_width)
-                name_width = entry_name_width;
+/* Returns an upper bound for the size of an archive made from the files. */
+static off_t
+thdat_estimate_size(
+    char*** entries,
+    const int* entries_count,
+    size_t entry_count)
+{
+    off_t size = 4096;
+#ifdef HAVE_SYS_STAT_H
+    for (size_t i = 0; i < entry_count; ++i) {
+        for (int j = 0; j < entries_count[i]; ++j) {
+            struct stat st;
+            /* Room for the entry name and fields in the table. */
+            size += 256 + 16;
+            if (stat(entries[i][j], &st) == 0)
+                /* LZSS needs at most 9 bits per byte. */
+                size += st.st_size + st.st_size / 8 + 16;
         }
     }
+#else
+    size = 0;
+#endif
+    return size;
+}
 
-    // th105: Stored = Size
-    if (version == 105 || version == 123)
-        printf("%-*s  %7s\n", name_width, "Name", "Size");
-    else
-        printf("%-*s  %7s  %7s\n", name_width, "Name", "Size", "Stored");
-    for (e = 0; e < entry_count; ++e) {
-        if (version == 105 || version == 123)
-            printf("%-*s  %7zd\n", name_width, entries[e].name, entries[e].size);
-        else
-            printf("%-*s  %7zd  %7zd\n", name_width, entries[e].name, entries[e].size, entries[e].zsize);
-    }
-
-    free(entries);
-    thdat_state_free(state);
+/* An archive being created, and the files that go into it. */
+typedef struct {
+    thdat_state_t* state;
+    ssize_t entry_count;
+    /* The file to read for each entry, NULL once the entry is written or if
+     * it couldn't be named. */
+    char** realpaths;
+} thdat_creation_t;
 
-    return 1;
+static void
+thdat_creation_free(
+    thdat_creation_t* creation)
+{
+    if (creation) {
+        for (ssize_t i = 0; i < creation->entry_count; ++i)
+            free(creation->realpaths[i]);
+        free(creation->realpaths);
+        thdat_state_free(creation->state);
+        free(creation);
+    }
 }
 
-static int
-thdat_create_wrapper(
+/* Creates the archive and names its entries, leaving the data to be written
+ * by thdat_create_entry. */
+static thdat_creation_t*
+thdat_create_begin(
     unsigned int version,
     const char* path,
     const char** paths,
     size_t entry_count,
     thtk_error_t** error)
 {
-    thdat_state_t* state = thdat_state_alloc();
+    thdat_creation_t* creation = malloc(sizeof(*creation));
     char*** entries = calloc(entry_count, sizeof(char**));
-    char** realpaths;
     int* entries_count = calloc(entry_count, sizeof(int));
     size_t real_entry_count = 0;
 
-    if (!(state->stream = thtk_io_open_file(path, "wb", error))) {
-        thdat_state_free(state);
-        exit(1);
-    }
-
     for (size_t i = 0; i < entry_count; i++) {
         int n = util_scan_files(paths[i], &entries[i]);
         if (n == -1) {
@@ -231,26 +258,40 @@ thdat_create_wrapper(
         real_entry_count += n;
     }
 
-    if (!(state->thdat = thdat_create(version, state->stream, real_entry_count, error))) { 
-        thdat_state_free(state);
-        exit(1);
+    creation->state = thdat_state_alloc();
+    creation->entry_count = real_entry_count;
+    creation->realpaths = calloc(real_entry_count, sizeof(char*));
+
+    if (!(creation->state->stream = thtk_io_open_file_preallocated(path,
+            thdat_estimate_size(entries, entries_count, entry_count), error)) ||
+        !(creation->state->thdat = thdat_create(version, creation->state->stream, real_entry_count, error)) ||
+        (share_data && !thdat_set_shared_data(creation->state->thdat, 1, error))) {
+        for (size_t i = 0; i < entry_count; ++i) {
+            for (int j = 0; j < entries_count[i]; ++j)
+                free(entries[i][j]);
+            free(entries[i]);
+        }
+        free(entries);
+        free(entries_count);
+        thdat_creation_free(creation);
+        return NULL;
     }
 
+    if (print_timings)
+        thdat_set_progress(creation->state->thdat, thdat_print_progress, NULL);
+
     // Set entry names first...
-    realpaths = calloc(real_entry_count, sizeof(char*));
     size_t k = 0;
     for (size_t i = 0; i < entry_count; ++i) {
         thtk_error_t* error = NULL;
         for (size_t j = 0; j < entries_count[i]; j++) {
-            if (!thdat_entry_set_name(state->thdat, k, entries[i][j], &error)) {
+            if (!thdat_entry_set_name(creation->state->thdat, k, entries[i][j], &error)) {
                 print_error(error);
                 thtk_error_free(&error);
+                free(entries[i][j]);
                 continue;
             }
-            realpaths[k] = malloc(strlen(entries[i][j])+1);
-            strcpy(realpaths[k], entries[i][j]);
-            k++;
-            free(entries[i][j]);
+            creation->realpaths[k++] = entries[i][j];
         }
         free(entries[i]);
     }
@@ -259,65 +300,922 @@ thdat_create_wrapper(
     // ...and then module->create, if this is th105 archive.
     // This is because the list of entries comes first in th105 archives.
     if (version == 105 || version == 123) {
-        if (!thdat_init(state->thdat, error))
-        {
-            thdat_state_free(state);
-            exit(1);
+        if (!thdat_init(creation->state->thdat, error)) {
+            thdat_creation_free(creation);
+            return NULL;
         }
     }
 
-    k = 0;
+    return creation;
+}
+
+/* thdat_input_func_t that opens the file for an entry of the thdat_creation_t
+ * passed as arg. */
+static thtk_io_t*
+thdat_create_input(
+    void* arg,
+    thdat_t* thdat,
+    int entry_index,
+    size_t* length,
+    thtk_error_t** error)
+{
+    thdat_creation_t* creation = arg;
+    thtk_io_t* entry_stream;
+    off_t entry_size;
+
+    printf("%s...\n", thdat_entry_get_name(thdat, entry_index, NULL));
+
+    if (!(entry_stream = thtk_io_open_file(creation->realpaths[entry_index], "rb", error)))
+        return NULL;
+
+    if ((entry_size = thtk_io_seek(entry_stream, 0, SEEK_END, error)) == -1 ||
+        thtk_io_seek(entry_stream, 0, SEEK_SET, error) == -1) {
+        thtk_io_close(entry_stream);
+        return NULL;
+    }
+
+    *length = entry_size;
+    return entry_stream;
+}
+
+/* Writes one entry.  Safe to call for different entries in parallel.
+ * Errors are printed; 0 is returned if there was one. */
+static int
+thdat_create_entry(
+    thdat_creation_t* creation,
+    ssize_t i)
+{
+    thdat_t* thdat = creation->state->thdat;
+    thtk_error_t* error = NULL;
+    thtk_io_t* entry_stream;
+    size_t entry_size;
+    int ret = 1;
+
+    // Is entry name set?
+    if (!(thdat_entry_get_name(thdat, i, &error))[0])
+        return 1;
+
+    if (!(entry_stream = thdat_create_input(creation, thdat, i, &entry_size, &error)) ||
+        thdat_entry_write_data(thdat, i, entry_stream, entry_size, &error) == -1) {
+        print_error(error);
+        thtk_error_free(&error);
+        ret = 0;
+    }
+
+    if (entry_stream)
+        thtk_io_close(entry_stream);
+    free(creation->realpaths[i]);
+    creation->realpaths[i] = NULL;
+    return ret;
+}
+
+static int
+thdat_create_end(
+    thdat_creation_t* creation,
+    thtk_error_t** error)
+{
+    int ret = 1;
+
+    if (!thdat_close(creation->state->thdat, error))
+        ret = 0;
+
+    thdat_creation_free(creation);
+
+    return ret;
+}
+
+static int
+thdat_create_wrapper(
+    unsigned int version,
+    const char* path,
+    const char** paths,
+    size_t entry_count,
+    thtk_error_t** error)
+{
+    thdat_creation_t* creation;
+    if (!(creation = thdat_create_begin(version, path, paths, entry_count, error)))
+        return 0;
+
     /* TODO: Properly indicate when insertion fails. */
-    ssize_t i;
-#pragma omp parallel for schedule(dynamic)
-    for (i = 0; i < real_entry_count; ++i) {
-        thtk_error_t* error = NULL;
-        thtk_io_t* entry_stream;
-        off_t entry_size;
+    if (thdat_write_all(creation->state->thdat, thdat_create_input,
+            thdat_print_entry_error, creation, error) == -1) {
+        thdat_creation_free(creation);
+        return 0;
+    }
 
-        printf("%s...\n", thdat_entry_get_name(state->thdat, i, &error));
+    return thdat_create_end(creation, error);
+}
 
-        // Is entry name set?
-        if (!(thdat_entry_get_name(state->thdat, i, &error))[0])
-            continue;
+/* Returns the detected version of the archive, or 0 if there isn't exactly
+ * one candidate. */
+static unsigned int
+thdat_detect_version(
+    const char* path,
+    thtk_error_t** error)
+{
+    thtk_io_t* file;
+    if (!(file = thtk_io_open_file(path, "rb", error)))
+        return 0;
+    uint32_t out[4];
+    unsigned int heur;
+    printf("Detecting '%s'...\n", path);
+    if (-1 == thdat_detect(path, file, out, &heur, error)) {
+        thtk_io_close(file);
+        return 0;
+    }
+    thtk_io_close(file);
+    if (heur == -1) {
+        const thdat_detect_entry_t* ent;
+        printf("Couldn't detect version!\nPossible versions: ");
+        while ((ent = thdat_detect_iter(out))) {
+            printf("%d,", ent->alias);
+        }
+        printf("\n");
+        return 0;
+    }
+    printf("Detected version %d\n", heur);
+    return heur;
+}
 
-        if (!(entry_stream = thtk_io_open_file(realpaths[i], "rb", &error))) {
-            print_error(error);
-            thtk_error_free(&error);
+/* One line of a batch manifest. */
+typedef struct {
+    int mode;
+    unsigned int version;
+    char* archive;
+    /* Output directory for extraction, or NULL. */
+    char* dir;
+    /* Input files for creation. */
+    char** paths;
+    size_t path_count;
+    thdat_state_t* state;
+    thdat_creation_t* creation;
+} thdat_batch_op_t;
+
+/* An entry to extract or add. */
+typedef struct {
+    thdat_batch_op_t* op;
+    ssize_t entry;
+    off_t size;
+    /* 0 if the entry failed. */
+    int ok;
+} thdat_batch_job_t;
+
+static int
+thdat_batch_job_compar(
+    const void* a,
+    const void* b)
+{
+    const thdat_batch_job_t* ja = a;
+    const thdat_batch_job_t* jb = b;
+    return (ja->size < jb->size) - (ja->size > jb->size);
+}
+
+static void
+thdat_batch_task(
+    void* arg,
+    size_t j)
+{
+    thdat_batch_job_t* job = (thdat_batch_job_t*)arg + j;
+    thdat_batch_op_t* op = job->op;
+    thtk_error_t* error = NULL;
+    if (op->mode == 'c') {
+        job->ok = thdat_create_entry(op->creation, job->entry);
+    } else if (!(job->ok = thdat_extract_file(op->state->thdat, job->entry, op->dir, &error))) {
+        print_error(error);
+        thtk_error_free(&error);
+    }
+}
+
+static void
+thdat_batch_free(
+    thdat_batch_op_t* ops,
+    size_t op_count)
+{
+    for (size_t o = 0; o < op_count; ++o) {
+        free(ops[o].archive);
+        free(ops[o].dir);
+        for (size_t p = 0; p < ops[o].path_count; ++p)
+            free(ops[o].paths[p]);
+        free(ops[o].paths);
+        thdat_state_free(ops[o].state);
+        thdat_creation_free(ops[o].creation);
+    }
+    free(ops);
+}
+
+/* Reads a manifest with one operation per line:
+ *   x VERSION ARCHIVE [DIRECTORY]
+ *   l VERSION ARCHIVE
+ *   c VERSION ARCHIVE FILE...
+ * Blank lines and lines starting with '#' are ignored. */
+static thdat_batch_op_t*
+thdat_batch_read(
+    const char* manifest,
+    size_t* op_count,
+    thtk_error_t** error)
+{
+    FILE* stream;
+    char line[4096];
+    unsigned int lineno = 0;
+    size_t capacity = 16;
+    thdat_batch_op_t* ops;
+
+    if (!(stream = fopen(manifest, "r"))) {
+        thtk_error_new(error, "couldn't open %s: %s", manifest, strerror(errno));
+        return NULL;
+    }
+
+    ops = malloc(capacity * sizeof(*ops));
+    *op_count = 0;
+    while (fgets(line, sizeof(line), stream)) {
+        char* fields[3];
+        int field_count = 0;
+        char* field;
+
+        ++lineno;
+        if (line[0] == '#')
+            continue;
+        for (field = strtok(line, " \t\r\n"); field && field_count < 3; field = strtok(NULL, " \t\r\n"))
+            fields[field_count++] = field;
+        if (!field_count)
             continue;
+
+        if (field_count < 3 || strlen(fields[0]) != 1 || !strchr("clx", fields[0][0])) {
+            thtk_error_new(error, "%s:%u: expected x, l or c followed by a version and an archive", manifest, lineno);
+            break;
         }
 
-        if ((entry_size = thtk_io_seek(entry_stream, 0, SEEK_END, &error)) == -1) {
-            print_error(error);
-            thtk_error_free(&error);
-            continue;
+        if (*op_count == capacity) {
+            capacity *= 2;
+            ops = realloc(ops, capacity * sizeof(*ops));
         }
+        thdat_batch_op_t* op = &ops[(*op_count)++];
+        memset(op, 0, sizeof(*op));
+        op->mode = fields[0][0];
+        op->archive = thdat_strdup(fields[2]);
 
-        if (thtk_io_seek(entry_stream, 0, SEEK_SET, &error) == -1) {
-            print_error(error);
-            thtk_error_free(&error);
+        if (fields[1][0] == 'd' && !fields[1][1] && op->mode != 'c') {
+            if (!(op->version = thdat_detect_version(op->archive, error))) {
+                if (!*error)
+                    thtk_error_new(error, "%s:%u: couldn't detect the version of %s", manifest, lineno, op->archive);
+                break;
+            }
+        } else if (!(op->version = parse_version(fields[1]))) {
+            thtk_error_new(error, "%s:%u: unknown version: %s", manifest, lineno, fields[1]);
+            break;
+        }
+
+        /* field is the first unconsumed field, if any. */
+        if (op->mode == 'x' && field) {
+            op->dir = thdat_strdup(field);
+        } else if (op->mode == 'c') {
+            size_t path_capacity = 8;
+            op->paths = malloc(path_capacity * sizeof(char*));
+            for (; field; field = strtok(NULL, " \t\r\n")) {
+                if (op->path_count == path_capacity) {
+                    path_capacity *= 2;
+                    op->paths = realloc(op->paths, path_capacity * sizeof(char*));
+                }
+                op->paths[op->path_count++] = thdat_strdup(field);
+            }
+            if (!op->path_count) {
+                thtk_error_new(error, "%s:%u: no files to add to %s", manifest, lineno, op->archive);
+                break;
+            }
+        }
+    }
+
+    if (!*error && ferror(stream))
+        thtk_error_new(error, "couldn't read %s: %s", manifest, strerror(errno));
+    fclose(stream);
+    if (*error) {
+        thdat_batch_free(ops, *op_count);
+        return NULL;
+    }
+    return ops;
+}
+
+/* Runs every operation in a manifest.  The entries of all archives are
+ * processed together, largest first, so that one big file doesn't hold up
+ * the end of the run.  Errors with single entries are printed, and make the
+ * batch fail without stopping it. */
+static int
+thdat_batch(
+    const char* manifest,
+    thtk_error_t** error)
+{
+    thdat_batch_op_t* ops;
+    size_t op_count;
+    thdat_batch_job_t* jobs = NULL;
+    size_t job_count = 0;
+    int ret = 1;
+
+    if (!(ops = thdat_batch_read(manifest, &op_count, error)))
+        return 0;
+
+    for (size_t o = 0; o < op_count; ++o) {
+        thdat_batch_op_t* op = &ops[o];
+        thdat_t* thdat;
+        ssize_t entry_count;
+
+        switch (op->mode) {
+        case 'l':
+            if (!thdat_list(op->version, op->archive, error))
+                goto fail;
             continue;
+        case 'x':
+            if (!(op->state = thdat_open_file(op->version, op->archive, error)))
+                goto fail;
+            thdat = op->state->thdat;
+            break;
+        case 'c':
+            if (!(op->creation = thdat_create_begin(op->version, op->archive,
+                    (const char**)op->paths, op->path_count, error)))
+                goto fail;
+            thdat = op->creation->state->thdat;
+            break;
+        default:
+            goto fail;
         }
 
-        if (thdat_entry_write_data(state->thdat, i, entry_stream, entry_size, &error) == -1) {
-            print_error(error);
-            thtk_error_free(&error);
+        if ((entry_count = thdat_entry_count(thdat, error)) == -1)
+            goto fail;
+        jobs = realloc(jobs, (job_count + entry_count) * sizeof(*jobs));
+        for (ssize_t e = 0; e < entry_count; ++e) {
+            thdat_batch_job_t* job = &jobs[job_count++];
+            job->op = op;
+            job->entry = e;
+            job->size = 0;
+            job->ok = 1;
+            if (op->mode == 'x') {
+                job->size = thdat_entry_get_size(thdat, e, NULL);
+            } else {
+#ifdef HAVE_SYS_STAT_H
+                struct stat st;
+                if (op->creation->realpaths[e] && stat(op->creation->realpaths[e], &st) == 0)
+                    job->size = st.st_size;
+#endif
+            }
+        }
+    }
+
+    qsort(jobs, job_count, sizeof(*jobs), thdat_batch_job_compar);
+
+    thtk_parallel_for(job_count, thdat_batch_task, jobs);
+    for (size_t j = 0; j < job_count; ++j) {
+        if (!jobs[j].ok)
+            ret = 0;
+    }
+
+    for (size_t o = 0; o < op_count; ++o) {
+        if (ops[o].creation) {
+            thtk_error_t* error = NULL;
+            if (!thdat_create_end(ops[o].creation, &error)) {
+                print_error(error);
+                thtk_error_free(&error);
+                ret = 0;
+            }
+            ops[o].creation = NULL;
+        }
+    }
+
+    free(jobs);
+    thdat_batch_free(ops, op_count);
+    return ret;
+fail:
+    free(jobs);
+    thdat_batch_free(ops, op_count);
+    return 0;
+}
+
+typedef struct {
+    ssize_t entry;
+    ssize_t size;
+    unsigned char digest[UTIL_SHA256_SIZE];
+    int ok;
+} thdat_hash_t;
+
+static int
+thdat_hash_compar(
+    const void* a,
+    const void* b)
+{
+    const thdat_hash_t* ha = *(const thdat_hash_t* const*)a;
+    const thdat_hash_t* hb = *(const thdat_hash_t* const*)b;
+    return (ha->size < hb->size) - (ha->size > hb->size);
+}
+
+typedef struct {
+    thdat_t* thdat;
+    thdat_hash_t** order;
+} thdat_hash_run_t;
+
+static void
+thdat_hash_task(
+    void* arg,
+    size_t h)
+{
+    thdat_hash_run_t* run = arg;
+    thdat_hash_t* hash = run->order[h];
+    thtk_error_t* error = NULL;
+    unsigned char* data;
+    ssize_t size;
+
+    if (hash->entry == -1)
+        return;
+    data = malloc(hash->size > 0 ? hash->size : 1);
+    if ((size = thdat_entry_read_into(run->thdat, hash->entry, data, hash->size, &error)) == -1) {
+        print_error(error);
+        thtk_error_free(&error);
+    } else {
+        util_sha256(data, size, hash->digest);
+        hash->ok = 1;
+    }
+    free(data);
+}
+
+/* Decodes the entries in memory and hashes them, largest first.  Entries with
+ * an index of -1 are skipped.  Returns the number of entries that couldn't be
+ * hashed. */
+static size_t
+thdat_hash_entries(
+    thdat_t* thdat,
+    thdat_hash_t* hashes,
+    size_t count)
+{
+    thdat_hash_t** order = malloc(count * sizeof(*order));
+    size_t failed = 0;
+    ssize_t h;
+
+    for (h = 0; h < count; ++h) {
+        hashes[h].ok = 0;
+        hashes[h].size = hashes[h].entry == -1 ? -1 :
+            thdat_entry_get_size(thdat, hashes[h].entry, NULL);
+        order[h] = &hashes[h];
+    }
+    qsort(order, count, sizeof(*order), thdat_hash_compar);
+
+    thdat_hash_run_t run = { thdat, order };
+    thtk_parallel_for(count, thdat_hash_task, &run);
+    for (h = 0; h < count; ++h)
+        failed += !hashes[h].ok;
+
+    free(order);
+    return failed;
+}
+
+/* Prints the SHA-256 of each entry in the format of sha256sum. */
+static int
+thdat_hash(
+    unsigned int version,
+    const char* path,
+    char** names,
+    size_t name_count,
+    thtk_error_t** error)
+{
+    thdat_state_t* state;
+    thdat_hash_t* hashes;
+    ssize_t count;
+    size_t failed;
+
+    if (!(state = thdat_open_file(version, path, error)))
+        return 0;
+
+    if (name_count) {
+        count = name_count;
+        hashes = malloc(count * sizeof(*hashes));
+        for (size_t n = 0; n < name_count; ++n) {
+            thtk_error_t* error = NULL;
+            if ((hashes[n].entry = thdat_entry_by_name(state->thdat, names[n], &error)) == -1) {
+                if (error) {
+                    print_error(error);
+                    thtk_error_free(&error);
+                } else {
+                    fprintf(stderr, "%s: %s: no such entry\n", argv0, names[n]);
+                }
+            }
+        }
+    } else {
+        if ((count = thdat_entry_count(state->thdat, error)) == -1) {
+            thdat_state_free(state);
+            return 0;
+        }
+        hashes = malloc(count * sizeof(*hashes));
+        for (ssize_t e = 0; e < count; ++e)
+            hashes[e].entry = e;
+    }
+
+    failed = thdat_hash_entries(state->thdat, hashes, count);
+
+    for (ssize_t h = 0; h < count; ++h) {
+        char hex[UTIL_SHA256_SIZE * 2 + 1];
+        if (!hashes[h].ok)
+            continue;
+        util_sha256_hex(hashes[h].digest, hex);
+        printf("%s  %s\n", hex, thdat_entry_get_name(state->thdat, hashes[h].entry, NULL));
+    }
+
+    free(hashes);
+    thdat_state_free(state);
+
+    if (failed) {
+        thtk_error_new(error, "%zu entries couldn't be hashed", failed);
+        return 0;
+    }
+    return 1;
+}
+
+/* Checks the entries against a manifest written by thdat_hash or sha256sum. */
+static int
+thdat_verify(
+    unsigned int version,
+    const char* path,
+    const char* manifest,
+    thtk_error_t** error)
+{
+    thdat_state_t* state;
+    FILE* stream;
+    char line[4096];
+    unsigned int lineno = 0;
+    thdat_hash_t* hashes = NULL;
+    char (*expected)[UTIL_SHA256_SIZE * 2 + 1] = NULL;
+    char** names = NULL;
+    size_t count = 0, capacity = 0;
+    size_t mismatched = 0, unreadable;
+
+    if (!(stream = fopen(manifest, "r"))) {
+        thtk_error_new(error, "couldn't open %s: %s", manifest, strerror(errno));
+        return 0;
+    }
+
+    if (!(state = thdat_open_file(version, path, error))) {
+        fclose(stream);
+        return 0;
+    }
+
+    while (fgets(line, sizeof(line), stream)) {
+        char* name = line + UTIL_SHA256_SIZE * 2 + 2;
+        ++lineno;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (!line[0])
+            continue;
+        if (strlen(line) < UTIL_SHA256_SIZE * 2 + 3 ||
+            strspn(line, "0123456789abcdefABCDEF") != UTIL_SHA256_SIZE * 2 ||
+            line[UTIL_SHA256_SIZE * 2] != ' ' ||
+            (name[-1] != ' ' && name[-1] != '*')) {
+            fprintf(stderr, "%s: %s:%u: improperly formatted line\n", argv0, manifest, lineno);
             continue;
         }
 
-        thtk_io_close(entry_stream);
-        free(realpaths[i]);
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            hashes = realloc(hashes, capacity * sizeof(*hashes));
+            expected = realloc(expected, capacity * sizeof(*expected));
+            names = realloc(names, capacity * sizeof(*names));
+        }
+        for (int i = 0; i < UTIL_SHA256_SIZE * 2; ++i)
+            expected[count][i] = tolower((unsigned char)line[i]);
+        expected[count][UTIL_SHA256_SIZE * 2] = '\0';
+        hashes[count].entry = thdat_entry_by_name(state->thdat, name, NULL);
+        names[count] = thdat_strdup(name);
+        ++count;
     }
-    free(realpaths);
+    fclose(stream);
 
-    int ret = 1;
+    unreadable = thdat_hash_entries(state->thdat, hashes, count);
 
-    if (!thdat_close(state->thdat, error))
-        ret = 0;
+    for (size_t h = 0; h < count; ++h) {
+        char hex[UTIL_SHA256_SIZE * 2 + 1];
+        if (!hashes[h].ok) {
+            printf("%s: FAILED open or read\n", names[h]);
+        } else {
+            util_sha256_hex(hashes[h].digest, hex);
+            if (strcmp(hex, expected[h])) {
+                printf("%s: FAILED\n", names[h]);
+                ++mismatched;
+            } else {
+                printf("%s: OK\n", names[h]);
+            }
+        }
+        free(names[h]);
+    }
 
+    free(names);
+    free(hashes);
+    free(expected);
     thdat_state_free(state);
 
-    return ret;
+    if (mismatched || unreadable) {
+        thtk_error_new(error, "%zu of %zu entries failed verification",
+            mismatched + unreadable, count);
+        return 0;
+    }
+    return 1;
+}
+
+typedef struct {
+    const char* name;
+    ssize_t entry;
+} thdat_diff_name_t;
+
+static int
+thdat_diff_name_compar(
+    const void* a,
+    const void* b)
+{
+    return strcmp(((const thdat_diff_name_t*)a)->name, ((const thdat_diff_name_t*)b)->name);
+}
+
+typedef struct {
+    ssize_t a;
+    ssize_t b;
+    int changed;
+    int failed;
+    /* Differing byte ranges, as pairs of start and end offsets. */
+    size_t* ranges;
+    size_t range_count;
+} thdat_diff_t;
+
+/* Reads the stored data of both entries and compares it. */
+static int
+thdat_diff_raw_equal(
+    thdat_t* a,
+    ssize_t ea,
+    thdat_t* b,
+    ssize_t eb)
+{
+    const ssize_t zsize = thdat_entry_get_zsize(a, ea, NULL);
+    if (zsize < 0 || zsize != thdat_entry_get_zsize(b, eb, NULL))
+        return 0;
+
+    unsigned char* da = malloc(zsize ? zsize : 1);
+    unsigned char* db = malloc(zsize ? zsize : 1);
+    const int equal =
+        thdat_entry_read_raw(a, ea, da, zsize, NULL) == zsize &&
+        thdat_entry_read_raw(b, eb, db, zsize, NULL) == zsize &&
+        !memcmp(da, db, zsize);
+    free(da);
+    free(db);
+    return equal;
+}
+
+static unsigned char*
+thdat_diff_decode(
+    thdat_t* thdat,
+    ssize_t entry,
+    ssize_t* size)
+{
+    thtk_error_t* error = NULL;
+    unsigned char* data;
+
+    *size = thdat_entry_get_size(thdat, entry, NULL);
+    data = malloc(*size > 0 ? *size : 1);
+    if ((*size = thdat_entry_read_into(thdat, entry, data, *size, &error)) == -1) {
+        print_error(error);
+        thtk_error_free(&error);
+        free(data);
+        return NULL;
+    }
+    return data;
+}
+
+/* Decodes both entries and compares them, recording the differing ranges if
+ * ranges is set.  Returns 0 if the entries couldn't be decoded. */
+static int
+thdat_diff_decoded(
+    thdat_t* a,
+    thdat_t* b,
+    thdat_diff_t* diff,
+    int ranges)
+{
+    ssize_t size_a, size_b;
+    unsigned char* da = thdat_diff_decode(a, diff->a, &size_a);
+    unsigned char* db = da ? thdat_diff_decode(b, diff->b, &size_b) : NULL;
+    if (!db) {
+        free(da);
+        return 0;
+    }
+
+    const size_t common = size_a < size_b ? size_a : size_b;
+    diff->changed = size_a != size_b || memcmp(da, db, common);
+    if (diff->changed && ranges) {
+        size_t capacity = 0;
+        size_t i = 0;
+        for (;;) {
+            while (i < common && da[i] == db[i])
+                ++i;
+            if (i == common)
+                break;
+            const size_t start = i;
+            while (i < common && da[i] != db[i])
+                ++i;
+            if (diff->range_count == capacity) {
+                capacity = capacity ? capacity * 2 : 8;
+                diff->ranges = realloc(diff->ranges, capacity * 2 * sizeof(size_t));
+            }
+            diff->ranges[diff->range_count * 2] = start;
+            diff->ranges[diff->range_count * 2 + 1] = i;
+            ++diff->range_count;
+        }
+        /* One entry is longer than the other. */
+        if (size_a != size_b) {
+            diff->ranges = realloc(diff->ranges, (diff->range_count + 1) * 2 * sizeof(size_t));
+            diff->ranges[diff->range_count * 2] = common;
+            diff->ranges[diff->range_count * 2 + 1] = size_a > size_b ? size_a : size_b;
+            ++diff->range_count;
+        }
+    }
+
+    free(da);
+    free(db);
+    return 1;
+}
+
+typedef struct {
+    thdat_t* a;
+    thdat_t* b;
+    thdat_diff_t* diffs;
+    int ranges;
+    /* Whether equal stored data implies equal contents. */
+    int raw;
+} thdat_diff_run_t;
+
+static void
+thdat_diff_task(
+    void* arg,
+    size_t e)
+{
+    thdat_diff_run_t* run = arg;
+    thdat_diff_t* diff = &run->diffs[e];
+    if (diff->b == -1)
+        return;
+    if (!run->ranges &&
+        thdat_entry_get_size(run->a, diff->a, NULL) !=
+        thdat_entry_get_size(run->b, diff->b, NULL)) {
+        diff->changed = 1;
+        return;
+    }
+    if (run->raw && thdat_diff_raw_equal(run->a, diff->a, run->b, diff->b))
+        return;
+    if (!thdat_diff_decoded(run->a, run->b, diff, run->ranges))
+        diff->failed = 1;
+}
+
+/* Compares two archives by entry name, and prints the entries that were
+ * added, removed or changed. */
+static int
+thdat_diff(
+    unsigned int version_a,
+    const char* path_a,
+    unsigned int version_b,
+    const char* path_b,
+    int ranges,
+    thtk_error_t** error)
+{
+    thdat_state_t* state_a;
+    thdat_state_t* state_b;
+    ssize_t count_a, count_b;
+    thdat_diff_name_t* names_b;
+    thdat_diff_t* diffs;
+    char* in_a;
+    size_t failed = 0;
+
+    if (!(state_a = thdat_open_file(version_a, path_a, error)))
+        return 0;
+    if (!(state_b = thdat_open_file(version_b, path_b, error))) {
+        thdat_state_free(state_a);
+        return 0;
+    }
+    if ((count_a = thdat_entry_count(state_a->thdat, error)) == -1 ||
+        (count_b = thdat_entry_count(state_b->thdat, error)) == -1) {
+        thdat_state_free(state_a);
+        thdat_state_free(state_b);
+        return 0;
+    }
+
+    names_b = malloc((count_b ? count_b : 1) * sizeof(*names_b));
+    for (ssize_t e = 0; e < count_b; ++e) {
+        names_b[e].name = thdat_entry_get_name(state_b->thdat, e, NULL);
+        names_b[e].entry = e;
+    }
+    qsort(names_b, count_b, sizeof(*names_b), thdat_diff_name_compar);
+
+    diffs = calloc(count_a ? count_a : 1, sizeof(*diffs));
+    in_a = calloc(count_b ? count_b : 1, 1);
+    for (ssize_t e = 0; e < count_a; ++e) {
+        thdat_diff_name_t key = { thdat_entry_get_name(state_a->thdat, e, NULL), e };
+        const thdat_diff_name_t* found = bsearch(&key, names_b, count_b, sizeof(*names_b), thdat_diff_name_compar);
+        diffs[e].a = e;
+        diffs[e].b = found ? found->entry : -1;
+        if (found)
+            in_a[found->entry] = 1;
+    }
+
+    /* Stored data is compared first where equal stored data implies equal
+     * contents.  TH02-TH05 decrypt entries with a key from the entry list,
+     * and TH105 and TH123 with a key derived from the offset. */
+    const int raw_a = version_a >= 6 && version_a != 105 && version_a != 123;
+    thdat_diff_run_t run = {
+        state_a->thdat, state_b->thdat, diffs, ranges,
+        raw_a && version_a == version_b
+    };
+    thtk_parallel_for(count_a, thdat_diff_task, &run);
+
+    ssize_t e;
+    for (e = 0; e < count_a; ++e) {
+        failed += diffs[e].failed;
+        const char* name = thdat_entry_get_name(state_a->thdat, e, NULL);
+        if (diffs[e].b == -1) {
+            printf("removed %s\n", name);
+        } else if (diffs[e].changed) {
+            printf("changed %s", name);
+            for (size_t r = 0; r < diffs[e].range_count; ++r)
+                printf(" %zu-%zu", diffs[e].ranges[r * 2], diffs[e].ranges[r * 2 + 1]);
+            printf("\n");
+        }
+        free(diffs[e].ranges);
+    }
+    for (e = 0; e < count_b; ++e) {
+        if (!in_a[e])
+            printf("added %s\n", thdat_entry_get_name(state_b->thdat, e, NULL));
+    }
+
+    free(in_a);
+    free(diffs);
+    free(names_b);
+    thdat_state_free(state_a);
+    thdat_state_free(state_b);
+
+    if (failed) {
+        thtk_error_new(error, "%zu entries couldn't be compared", failed);
+        return 0;
+    }
+    return 1;
+}
+
+/* The result of detecting one of the files given to -d. */
+typedef struct {
+    const char* path;
+    char* line;
+    thtk_error_t* error;
+} thdat_detect_result_t;
+
+static void
+thdat_detect_task(
+    void* arg,
+    size_t a)
+{
+    thdat_detect_result_t* result = (thdat_detect_result_t*)arg + a;
+    thtk_io_t* file;
+    uint32_t out[4];
+    unsigned int heur;
+    const thdat_detect_entry_t* ent;
+    char* line;
+
+    if (!(file = thtk_io_open_file(result->path, "rb", &result->error)))
+        return;
+    if (-1 == thdat_detect(result->path, file, out, &heur, &result->error)) {
+        thtk_io_close(file);
+        return;
+    }
+    thtk_io_close(file);
+
+    /* Room for every alias in the table. */
+    line = result->line = malloc(strlen(result->path) + 64 + 32 * 5);
+    line += sprintf(line, "%d | possible versions: ", heur);
+    while ((ent = thdat_detect_iter(out))) {
+        line += sprintf(line, "%d,", ent->alias);
+    }
+    sprintf(line, " | filename: %d", thdat_detect_filename(result->path));
+}
+
+/* Long spellings of options, for util_getopt which only knows short ones. */
+static void
+thdat_translate_long_options(
+    char** argv)
+{
+    static const struct {
+        const char* name;
+        const char* option;
+    } long_options[] = {
+        { "--batch", "-b" },
+        { "--diff", "-D" },
+        { "--ranges", "-r" },
+        { "--hash", "-s" },
+        { "--share", "-S" },
+        { "--timings", "-t" },
+        { "--verify", "-v" },
+        { NULL, NULL }
+    };
+
+    for (; *argv && strcmp(*argv, "--"); ++argv) {
+        for (size_t i = 0; long_options[i].name; ++i) {
+            if (!strcmp(*argv, long_options[i].name)) {
+                *argv = (char*)long_options[i].option;
+                break;
+            }
+        }
+    }
 }
 
 /* TODO: Make sure errors are printed in all cases. */
@@ -333,10 +1231,28 @@ main(
     argv0 = util_shortname(argv[0]);
     int opt;
     int ind=0;
+    const char* manifest = NULL;
+    int ranges = 0;
+    thdat_translate_long_options(argv + 1);
     while(argv[util_optind]) {
-        switch(opt = util_getopt(argc, argv, ":c:l:x:Vd")) {
+        switch(opt = util_getopt(argc, argv, ":b:c:D:l:rs:Stv:x:Vd")) {
+        case 'r':
+            ranges = 1;
+            break;
+        case 'S':
+            share_data = 1;
+            break;
+        case 't':
+            print_timings = 1;
+            break;
+        case 'b':
+            manifest = util_optarg;
+            /* fallthrough */
         case 'c':
+        case 'D':
         case 'l':
+        case 's':
+        case 'v':
         case 'x':
         case 'd':
             if(mode != -1) {
@@ -345,10 +1261,10 @@ main(
                 exit(1);
             }
             mode = opt;
-            if((opt == 'x' || mode == 'l') && *util_optarg == 'd') {
+            if((opt == 'x' || opt == 'l' || opt == 's' || opt == 'v' || opt == 'D') && *util_optarg == 'd') {
                 version = ~0;
             }
-            else if(opt != 'd') version = parse_version(util_optarg);
+            else if(opt != 'd' && opt != 'b') version = parse_version(util_optarg);
             break;
         default:
             util_getopt_default(&ind,argv,opt,print_usage);
@@ -358,80 +1274,138 @@ main(
     argv[argc] = NULL;
 
     /* detect version */
-    if(argc && (mode == 'x' || mode == 'l') && version == ~0) {
-        thtk_io_t* file;
-        if(!(file = thtk_io_open_file(argv[0], "rb", &error))) {
-            print_error(error);
-            thtk_error_free(&error);
+    if(argc && (mode == 'x' || mode == 'l' || mode == 's' || mode == 'v') && version == ~0) {
+        if(!(version = thdat_detect_version(argv[0], &error))) {
+            if(error) {
+                print_error(error);
+                thtk_error_free(&error);
+            }
             exit(1);
         }
-        uint32_t out[4];
-        unsigned int heur;
-        printf("Detecting '%s'...\n",argv[0]);
-        if(-1 == thdat_detect(argv[0], file, out, &heur, &error)) {
-            thtk_io_close(file);
-            print_error(error);
-            thtk_error_free(&error);
+    }
+
+    /* Let a running thtkd do the work if there is one.  It is only sent the
+     * mode and the arguments, so with other options the work is done here. */
+    if (argc && (mode == 'l' || mode == 'x') && !print_timings && !share_data &&
+        getenv(UTIL_DAEMON_SOCKET_ENV)) {
+        char mode_arg[16];
+        char** request = malloc((argc + 3) * sizeof(char*));
+        snprintf(mode_arg, sizeof(mode_arg), "-%c%u", mode, version);
+        request[0] = "thdat";
+        request[1] = mode_arg;
+        memcpy(request + 2, argv, argc * sizeof(char*));
+        int status = util_daemon_request(getenv(UTIL_DAEMON_SOCKET_ENV), argc + 2, request);
+        free(request);
+        if (status != -1)
+            exit(status);
+    }
+
+    switch (mode) {
+    case 'b': {
+        if (!thdat_batch(manifest, &error)) {
+            /* Errors with single entries have been printed already. */
+            if (error) {
+                print_error(error);
+                thtk_error_free(&error);
+            }
             exit(1);
         }
-        if(heur == -1) {
-            const thdat_detect_entry_t* ent;
-            printf("Couldn't detect version!\nPossible versions: ");
-            while((ent = thdat_detect_iter(out))) {
-                printf("%d,",ent->alias);
-            }
-            printf("\n");
-            thtk_io_close(file);
+
+        exit(0);
+    }
+    case 'd': {
+        if (argc < 1) {
+            print_usage();
             exit(1);
         }
-        else {
-            printf("Detected version %d\n",heur);
-            version = heur;
+
+        /* Files are detected in parallel, and the results are printed in the
+         * order the files were given. */
+        thdat_detect_result_t* results = calloc(argc, sizeof(*results));
+        int failed = 0;
+        ssize_t a;
+        for (a = 0; a < argc; ++a)
+            results[a].path = argv[a];
+        thtk_parallel_for(argc, thdat_detect_task, results);
+
+        for (a = 0; a < argc; ++a) {
+            printf("Detecting '%s'... ", argv[a]);
+            if (results[a].error) {
+                printf("\n");
+                fflush(stdout);
+                print_error(results[a].error);
+                thtk_error_free(&results[a].error);
+                failed = 1;
+            } else {
+                printf("%s\n", results[a].line);
+                free(results[a].line);
+            }
         }
-        thtk_io_close(file);
+        free(results);
+        exit(failed ? 1 : 0);
     }
-
-    switch (mode) {
-    case 'd': {
+    case 'l': {
         if (argc < 1) {
             print_usage();
             exit(1);
         }
-        thtk_io_t* file;
-        if (!(file = thtk_io_open_file(argv[0], "rb", &error))) {
+
+        if (!thdat_list(version, argv[0], &error)) {
             print_error(error);
             thtk_error_free(&error);
             exit(1);
         }
 
-        uint32_t out[4];
-        unsigned int heur;
+        exit(0);
+    }
+    case 's': {
+        if (argc < 1) {
+            print_usage();
+            exit(1);
+        }
 
-        printf("Detecting '%s'... ",argv[0]);
-        if (-1 == thdat_detect(argv[0], file, out, &heur, &error)) {
-            printf("\n");
-            thtk_io_close(file);
+        if (!thdat_hash(version, argv[0], &argv[1], argc - 1, &error)) {
             print_error(error);
             thtk_error_free(&error);
             exit(1);
         }
 
-        const thdat_detect_entry_t* ent;
-        printf("%d | possible versions: ", heur);
-        while((ent = thdat_detect_iter(out))) {
-            printf("%d,",ent->alias);
+        exit(0);
+    }
+    case 'v': {
+        if (argc < 2) {
+            print_usage();
+            exit(1);
         }
-        printf(" | filename: %d\n", thdat_detect_filename(argv[0]));
-        thtk_io_close(file);
+
+        if (!thdat_verify(version, argv[0], argv[1], &error)) {
+            print_error(error);
+            thtk_error_free(&error);
+            exit(1);
+        }
+
         exit(0);
     }
-    case 'l': {
-        if (argc < 1) {
+    case 'D': {
+        if (argc < 2) {
             print_usage();
             exit(1);
         }
 
-        if (!thdat_list(version, argv[0], &error)) {
+        /* Each archive is detected on its own. */
+        unsigned int version_b = version;
+        if (version == ~0) {
+            if (!(version = thdat_detect_version(argv[0], &error)) ||
+                !(version_b = thdat_detect_version(argv[1], &error))) {
+                if (error) {
+                    print_error(error);
+                    thtk_error_free(&error);
+                }
+                exit(1);
+            }
+        }
+
+        if (!thdat_diff(version, argv[0], version_b, argv[1], ranges, &error)) {
             print_error(error);
             thtk_error_free(&error);
             exit(1);
@@ -467,42 +1441,13 @@ main(
         }
 
         if (argc > 1) {
-            ssize_t a;
-#pragma omp parallel for schedule(dynamic)
-            for (a = 1; a < argc; ++a) {
-                thtk_error_t* error = NULL;
-                int entry_index;
-
-                if ((entry_index = thdat_entry_by_name(state->thdat, argv[a], &error)) == -1) {
-                    print_error(error);
-                    thtk_error_free(&error);
-                    continue;
-                }
-
-                if (!thdat_extract_file(state, entry_index, &error)) {
-                    print_error(error);
-                    thtk_error_free(&error);
-                    continue;
-                }
-            }
+            thdat_extract_named(state->thdat, argc - 1, &argv[1]);
         } else {
-            ssize_t entry_count;
-            if ((entry_count = thdat_entry_count(state->thdat, &error)) == -1) {
+            if (!thdat_extract_all(state->thdat, NULL, &error)) {
                 print_error(error);
                 thtk_error_free(&error);
                 exit(1);
             }
-
-            ssize_t entry_index;
-#pragma omp parallel for schedule(dynamic)
-            for (entry_index = 0; entry_index < entry_count; ++entry_index) {
-                thtk_error_t* error = NULL;
-                if (!thdat_extract_file(state, entry_index, &error)) {
-                    print_error(error);
-                    thtk_error_free(&error);
-                    continue;
-                }
-            }
         }
 
         thdat_state_free(state);
@@ -114,3 +114,81 @@ bitstream_finish(
     while (b->bits)
         bitstream_write1(b, 0);
 }
+
+void
+bitreader_init(
+    struct bitreader* b,
+    const unsigned char* data,
+    size_t size)
+{
+    b->data = data;
+    b->size = size;
+    b->pos = 0;
+}
+
+uint32_t
+bitreader_read(
+    struct bitreader* b,
+    unsigned int bits)
+{
+    const size_t byte = b->pos >> 3;
+    const unsigned int shift = b->pos & 7;
+    uint64_t window = 0;
+    unsigned int i;
+
+    /* Any 32 bits fit in five bytes. */
+    if (byte + 5 <= b->size) {
+        for (i = 0; i < 5; ++i)
+            window = window << 8 | b->data[byte + i];
+    } else {
+        for (i = 0; i < 5; ++i)
+            window = window << 8 | (byte + i < b->size ? b->data[byte + i] : 0);
+    }
+
+    b->pos += bits;
+    return (window >> (40 - shift - bits)) & (((uint64_t)1 << bits) - 1);
+}
+
+void
+bitwriter_init(
+    struct bitwriter* b)
+{
+    b->data = NULL;
+    b->capacity = 0;
+    b->pos = 0;
+}
+
+void
+bitwriter_write(
+    struct bitwriter* b,
+    unsigned int bits,
+    uint32_t data)
+{
+    if (bits > 32)
+        bits = 32;
+
+    const size_t needed = (b->pos + bits + 7) >> 3;
+    if (needed > b->capacity) {
+        const size_t capacity = needed > b->capacity * 2 ? needed + 64 : b->capacity * 2;
+        b->data = realloc(b->data, capacity);
+        memset(b->data + b->capacity, 0, capacity - b->capacity);
+        b->capacity = capacity;
+    }
+
+    /* Fill the current byte, then whole bytes. */
+    while (bits) {
+        const unsigned int room = 8 - (b->pos & 7);
+        const unsigned int n = bits < room ? bits : room;
+        const unsigned int chunk = (data >> (bits - n)) & ((1u << n) - 1);
+        b->data[b->pos >> 3] |= chunk << (room - n);
+        b->pos += n;
+        bits -= n;
+    }
+}
+
+size_t
+bitwriter_size(
+    const struct bitwriter* b)
+{
+    return (b->pos + 7) >> 3;
+}
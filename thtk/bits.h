@@ -31,6 +31,7 @@
 
 #include <config.h>
 #include <inttypes.h>
+#include <stddef.h>
 #include <thtk/thtk.h>
 
 struct bitstream {
@@ -60,4 +61,46 @@ void bitstream_write(
 void bitstream_finish(
     struct bitstream* b);
 
+/* Reads bits from a buffer, most significant bit first.  Bits past the end
+ * of the buffer read as zero. */
+struct bitreader {
+    const unsigned char* data;
+    size_t size;
+    /* Position in bits. */
+    size_t pos;
+};
+
+void bitreader_init(
+    struct bitreader* b,
+    const unsigned char* data,
+    size_t size);
+
+/* Reads up to 32 bits. */
+uint32_t bitreader_read(
+    struct bitreader* b,
+    unsigned int bits);
+
+/* Writes bits to a buffer that grows as needed, most significant bit first.
+ * The data is freed by the caller. */
+struct bitwriter {
+    unsigned char* data;
+    size_t capacity;
+    /* Position in bits. */
+    size_t pos;
+};
+
+void bitwriter_init(
+    struct bitwriter* b);
+
+/* Writes the low bits of data, up to 32. */
+void bitwriter_write(
+    struct bitwriter* b,
+    unsigned int bits,
+    uint32_t data);
+
+/* Returns the number of bytes written, counting a partial last byte, which
+ * is padded with zero bits. */
+size_t bitwriter_size(
+    const struct bitwriter* b);
+
 #endif
@@ -32,6 +32,7 @@
 #ifdef HAVE_SYS_TYPES_H
 #include <sys/types.h>
 #endif
+#include <stdint.h>
 #include <thtk/error.h>
 #include <thtk/io.h>
 
@@ -68,6 +69,18 @@ API_SYMBOL thdat_t* thdat_create(
     size_t entry_count,
     thtk_error_t** error);
 
+/* Makes an entry of an archive being created whose content is the same as
+ * that of an earlier one share the data written for it, rather than storing
+ * it again.  Only TH06 and TH07 archives support this, and versions of thdat
+ * that predate it can't extract the shared entries.  Entries only share data
+ * if their contents are byte-for-byte the same, so the content of each entry
+ * written is kept in memory until the archive is freed.  It must be enabled
+ * before any entry is written.  0 indicates an error. */
+API_SYMBOL int thdat_set_shared_data(
+    thdat_t* thdat,
+    int enable,
+    thtk_error_t** error);
+
 /* Initializes the given archive.
  *
  * This function should be called manually when you create th105 archive,
@@ -125,6 +138,13 @@ API_SYMBOL ssize_t thdat_entry_get_zsize(
     int entry_index,
     thtk_error_t** error);
 
+/* Returns the offset of the entry's data in the archive.  -1 indicates an
+ * error. */
+API_SYMBOL off_t thdat_entry_get_offset(
+    thdat_t* thdat,
+    int entry_index,
+    thtk_error_t** error);
+
 /* TODO: Make sure functions implement these specs. */
 /* Reads no more bytes than the limit from the input stream, converts the data
  * as needed, and writes it to the archive's current offset using the specified
@@ -139,13 +159,188 @@ API_SYMBOL ssize_t thdat_entry_write_data(
 
 /* Reads all the data for the specified entry, converts it to its uncompressed
  * form, and writes all of it to output.  The number of bytes written to the
- * output stream is returned.  -1 indicates an error. */
+ * output stream is returned.  -1 indicates an error.  Entries of formats
+ * that store them uncompressed are passed through a fixed-size buffer, so
+ * memory use doesn't grow with the entry size.
+ *
+ * The archive is only accessed through positional reads, so any number of
+ * threads may call this on the same archive at once, each with its own output
+ * stream.  No locking is required from the caller. */
 API_SYMBOL ssize_t thdat_entry_read_data(
     thdat_t* thdat,
     int entry_index,
     thtk_io_t* output,
     thtk_error_t** error);
 
+/* Like thdat_entry_read_data, but decodes the entry straight into buf, which
+ * must be able to hold thdat_entry_get_size bytes.  capacity is the size of
+ * buf.  The number of bytes written is returned.  -1 indicates an error. */
+API_SYMBOL ssize_t thdat_entry_read_into(
+    thdat_t* thdat,
+    int entry_index,
+    void* buf,
+    size_t capacity,
+    thtk_error_t** error);
+
+/* Decodes count bytes starting at offset in the specified entry into buf.
+ * The range is cut off at the end of the entry.  For LZSS-compressed entries
+ * the first call builds an index of decoder checkpoints, after which a range
+ * only costs decoding from the closest checkpoint.  Like
+ * thdat_entry_read_data, this may be called from several threads at once.
+ * The number of bytes written is returned.  -1 indicates an error. */
+API_SYMBOL ssize_t thdat_entry_read_range(
+    thdat_t* thdat,
+    int entry_index,
+    void* buf,
+    size_t offset,
+    size_t count,
+    thtk_error_t** error);
+
+/* Copies the data of an entry as it is stored in the archive, compressed
+ * and encrypted, into buf.  buf must be able to hold thdat_entry_get_zsize
+ * bytes; capacity is its size.  The number of bytes written is returned.  -1
+ * indicates an error, which includes formats that don't record the stored
+ * size of entries. */
+API_SYMBOL ssize_t thdat_entry_read_raw(
+    thdat_t* thdat,
+    int entry_index,
+    void* buf,
+    size_t capacity,
+    thtk_error_t** error);
+
+/* Called by thdat_read_all with the decoded data of an entry.  The data is
+ * only valid during the call.  0 indicates an error. */
+typedef int (*thdat_read_func_t)(void* arg, thdat_t* thdat, int entry_index, const unsigned char* data, size_t size, thtk_error_t** error);
+
+/* Called by thdat_read_all_data to open the output for an entry.  The stream
+ * is closed after the entry is written.  NULL indicates an error. */
+typedef thtk_io_t* (*thdat_output_func_t)(void* arg, thdat_t* thdat, int entry_index, thtk_error_t** error);
+
+/* Called by thdat_write_all to open the input for an entry, whose length is
+ * stored in length.  The stream is closed after the entry is written.  NULL
+ * indicates an error. */
+typedef thtk_io_t* (*thdat_input_func_t)(void* arg, thdat_t* thdat, int entry_index, size_t* length, thtk_error_t** error);
+
+/* Called by the thdat_read_all functions and thdat_write_all for each entry
+ * that fails.
+ * The error is freed afterwards. */
+typedef void (*thdat_error_func_t)(void* arg, thdat_t* thdat, int entry_index, thtk_error_t* error);
+
+/* Decodes every entry on the thread pool and passes the data to read_func.
+ * Entries are decoded in the order in which they are stored, with the data
+ * ahead of them prefetched, so that the archive is read sequentially.  A
+ * failing entry is reported to error_func, which may be NULL, and doesn't
+ * stop the others.  read_func and error_func are called from several threads
+ * at once.  The number of entries that failed is returned.  -1 indicates an
+ * error. */
+API_SYMBOL ssize_t thdat_read_all(
+    thdat_t* thdat,
+    thdat_read_func_t read_func,
+    thdat_error_func_t error_func,
+    void* arg,
+    thtk_error_t** error);
+
+/* Like thdat_read_all, but writes each entry to the stream opened by
+ * output_func with thdat_entry_read_data, so that entries of formats that
+ * store them uncompressed are never held in memory whole. */
+API_SYMBOL ssize_t thdat_read_all_data(
+    thdat_t* thdat,
+    thdat_output_func_t output_func,
+    thdat_error_func_t error_func,
+    void* arg,
+    thtk_error_t** error);
+
+/* Writes the data of every named entry of an archive being created on the
+ * thread pool, taking it from the streams opened by input_func.  Entries
+ * without a name are skipped.  Failures are handled as for thdat_read_all.
+ * The number of entries that failed is returned.  -1 indicates an error. */
+API_SYMBOL ssize_t thdat_write_all(
+    thdat_t* thdat,
+    thdat_input_func_t input_func,
+    thdat_error_func_t error_func,
+    void* arg,
+    thtk_error_t** error);
+
+/* Phases of processing an entry.  When an entry is written, the decrypt and
+ * decompress phases cover encryption and compression instead. */
+typedef enum {
+    /* Reading the input: stored data, or the file being added. */
+    THDAT_PHASE_READ,
+    THDAT_PHASE_DECRYPT,
+    THDAT_PHASE_DECOMPRESS,
+    /* Writing the output: the decoded data, or the data being stored. */
+    THDAT_PHASE_WRITE,
+    THDAT_PHASE_COUNT
+} thdat_phase_t;
+
+typedef struct {
+    /* The entry that was processed, or -1 for writing the entry list when
+     * the archive is closed. */
+    int entry_index;
+    /* Sizes of the entry's data as stored and as decoded, or of the archive
+     * for entry_index -1.  The stored size is the decoded size for formats
+     * that don't record it. */
+    size_t stored_size;
+    size_t size;
+    /* Time spent in each phase, in nanoseconds. */
+    uint64_t ns[THDAT_PHASE_COUNT];
+    /* 0 if processing the entry failed. */
+    int ok;
+} thdat_progress_t;
+
+/* Called after an entry has been read or written. */
+typedef void (*thdat_progress_func_t)(void* arg, thdat_t* thdat, const thdat_progress_t* progress);
+
+/* Sets the function called after each entry is read or written, and after
+ * the archive is closed, or removes it if progress_func is NULL.  It is called
+ * from the thread that processed the entry, so it may be called from several
+ * threads at once.  Without a function set, no time is spent on timing. */
+API_SYMBOL void thdat_set_progress(
+    thdat_t* thdat,
+    thdat_progress_func_t progress_func,
+    void* arg);
+
+typedef struct thdat_builder_t thdat_builder_t;
+
+/* Starts creating an archive whose entries are added one at a time with
+ * thdat_builder_add, so that neither their number nor their names have to
+ * be known up front.  The stream has its reading position reset to zero.
+ * For formats with the entry list in front of the data (TH02 to TH05, TH105
+ * and TH123) the data is read back when the archive is finished, so the
+ * stream must be readable as well.  NULL indicates an error. */
+API_SYMBOL thdat_builder_t* thdat_builder_new(
+    unsigned int version,
+    thtk_io_t* output,
+    thtk_error_t** error);
+
+/* Returns the archive being built, for use with thdat_set_progress and the
+ * entry accessors.  It is freed along with the builder. */
+API_SYMBOL thdat_t* thdat_builder_archive(
+    thdat_builder_t* builder);
+
+/* Adds an entry, reading input_length bytes of its data from input and
+ * writing them to the archive straight away.  The index of the new entry is
+ * returned.  -1 indicates an error, in which case no entry is added and the
+ * space the entry took in the archive goes to the next one. */
+API_SYMBOL ssize_t thdat_builder_add(
+    thdat_builder_t* builder,
+    const char* name,
+    thtk_io_t* input,
+    size_t input_length,
+    thtk_error_t** error);
+
+/* Writes out the final pieces of the archive and frees the builder, but
+ * doesn't close the stream.  For formats with the entry list in front of the
+ * data, the data written so far is moved up to make room for it.  0
+ * indicates an error; the builder is freed either way. */
+API_SYMBOL int thdat_builder_finish(
+    thdat_builder_t* builder,
+    thtk_error_t** error);
+
+/* Frees a builder without finishing the archive. */
+API_SYMBOL void thdat_builder_free(
+    thdat_builder_t* builder);
+
 #ifdef __cplusplus
 }
 #endif
@@ -27,10 +27,11 @@
  * DAMAGE.
  */
 #include <config.h>
+#include <stdlib.h>
 #include <string.h>
 #include <thtk/thtk.h>
-#include <stdio.h> /* for SEEK_SET */
 #include "thcrypt.h"
+#include "thdat.h"
 #include "thlzss.h"
 #include "dattypes.h"
 #ifdef _WIN32
@@ -254,6 +255,7 @@ int
 thdat_detect_filename(
     const char* filename)
 {
+    if(!filename) return -1;
     filename = detect_basename(filename);
     return thdat_detect_filename_fn(filename);
 }
@@ -279,8 +281,121 @@ thdat_detect_filename_w(
 }
 #endif
 
+/* Trial decoding reads no more than this many bytes of entries. */
+#define DETECT_TRIAL_BUDGET (4 * 1024 * 1024)
+/* It also gives up after this many entries in a row that don't tell the
+ * remaining variants apart, such as those of archives holding data without
+ * known magic. */
+#define DETECT_TRIAL_TRIES 8
+
+typedef struct {
+    int index;
+    ssize_t zsize;
+} detect_trial_entry_t;
+
 static int
-thdat_detect_base(
+detect_trial_compar(
+    const void* a,
+    const void* b)
+{
+    const detect_trial_entry_t* ea = a;
+    const detect_trial_entry_t* eb = b;
+    return (ea->zsize > eb->zsize) - (ea->zsize < eb->zsize);
+}
+
+/* Tells apart variants that share a module, such as TH08 and TH09 or the
+ * THA1 formats, by decoding entries with the keys of each candidate, smallest
+ * entries first.  The entry list is only read once.  Variants that fail are
+ * removed from out.  Nothing is done if the filename heuristic fnheur already
+ * picks one of the candidates. */
+static void
+thdat_detect_trial(
+    int fnheur,
+    thtk_io_t* input,
+    uint32_t out[4])
+{
+    unsigned int variants[DETECT_ENTRIES];
+    int alive[DETECT_ENTRIES];
+    size_t variant_count = 0, alive_count;
+    const thdat_module_t* module = NULL;
+    const thdat_detect_entry_t* ent;
+    uint32_t out2[4];
+
+    memcpy(out2, out, sizeof(out2));
+    while ((ent = thdat_detect_iter(out2))) {
+        if (ent->alias == fnheur)
+            return;
+        const thdat_module_t* ent_module = thdat_version_to_module(ent->variant, NULL);
+        if (module && ent_module != module)
+            return;
+        module = ent_module;
+        if (!variant_count || variants[variant_count - 1] != ent->variant) {
+            alive[variant_count] = 1;
+            variants[variant_count++] = ent->variant;
+        }
+    }
+    if (variant_count < 2 || !module || !module->probe)
+        return;
+
+    thtk_error_t* error = NULL;
+    thdat_t* thdat = thdat_open(variants[0], input, &error);
+    if (!thdat) {
+        thtk_error_free(&error);
+        return;
+    }
+
+    detect_trial_entry_t* order = malloc(thdat->entry_count * sizeof(*order));
+    size_t order_count = 0;
+    for (size_t e = 0; e < thdat->entry_count; ++e) {
+        if (thdat->entries[e].zsize > 0 && thdat->entries[e].size >= 0) {
+            order[order_count].index = e;
+            order[order_count++].zsize = thdat->entries[e].zsize;
+        }
+    }
+    qsort(order, order_count, sizeof(*order), detect_trial_compar);
+
+    size_t budget = DETECT_TRIAL_BUDGET;
+    int tries = DETECT_TRIAL_TRIES;
+    alive_count = variant_count;
+    for (size_t o = 0; o < order_count && alive_count > 1 && tries > 0; ++o) {
+        int passed[DETECT_ENTRIES];
+        size_t passed_count = 0;
+        if ((size_t)order[o].zsize > budget)
+            break;
+        budget -= order[o].zsize;
+        for (size_t v = 0; v < variant_count; ++v) {
+            passed[v] = alive[v] && module->probe(thdat, order[o].index, variants[v]);
+            passed_count += passed[v];
+        }
+        /* An entry that no candidate, or every candidate, can decode says
+         * nothing. */
+        if (!passed_count || passed_count == alive_count) {
+            --tries;
+            continue;
+        }
+        tries = DETECT_TRIAL_TRIES;
+        for (size_t v = 0; v < variant_count; ++v) {
+            if (alive[v] && !passed[v]) {
+                alive[v] = 0;
+                --alive_count;
+            }
+        }
+    }
+    free(order);
+    thdat_free(thdat);
+
+    for (size_t v = 0; v < variant_count; ++v) {
+        if (alive[v])
+            continue;
+        for (size_t i = 0; i < DETECT_ENTRIES; ++i) {
+            if (detect_table[i].variant == variants[v])
+                out[i / 32] &= ~(1u << (i % 32));
+        }
+    }
+}
+
+static int
+thdat_detect_contents(
     int fnheur,
     thtk_io_t* input,
     uint32_t out[4],
@@ -290,25 +405,31 @@ thdat_detect_base(
     out[0]=out[1]=out[2]=out[3]=0;
     *heur = -1;
 
+    /* Every probe works on this much of the start of the file, which is read
+     * in one go.  The largest is the TH03 entry list. */
+    unsigned char prefix[sizeof(th03_archive_header_t) + 256 * sizeof(th03_entry_header_t)];
+    ssize_t prefix_size;
+    off_t file_size;
     union {
         th02_entry_header_t head2[256];
         th03_entry_header_t head3[256];
     } uni;
     th02_entry_header_t *head2 = uni.head2, emptyhead2={0};
-    th03_entry_header_t *head3 = uni.head3, emptyhead3={0};
-    /* Note that failed header reads are fatal, and make us immediately return
-     * The rationale for this is that if file can't fit a header (regardless of format)
-     * then it's probably not an archive
-     *
-     * Entry table reads, on the other hand, are considered nonfatal */
-
-    /* th02 */
-    if(-1 == thtk_io_seek(input, 0, SEEK_SET, error)) {
+    th03_entry_header_t *head3 = uni.head3;
+    /* Note that a failed read is fatal, and makes us immediately return.
+     * Anything past the end of the file reads as zeros; entry tables that
+     * don't fit in the file are rejected. */
+    if(-1 == (file_size = thtk_io_seek(input, 0, SEEK_END, error))) {
         return -1;
     }
-    if(-1 == thtk_io_read(input, head2, sizeof(head2[0]), error)) {
+    prefix_size = file_size < (off_t)sizeof(prefix) ? (ssize_t)file_size : (ssize_t)sizeof(prefix);
+    if(-1 == thtk_io_pread(input, prefix, prefix_size, 0, error)) {
         return -1;
     }
+    memset(prefix + prefix_size, 0, sizeof(prefix) - prefix_size);
+
+    /* th02 */
+    memcpy(head2, prefix, sizeof(uni.head2));
     if(head2[0].magic != magic1 && head2[0].magic != magic2) {
         goto notth02;
     }
@@ -316,10 +437,10 @@ thdat_detect_base(
         goto notth02;
     }
     int entry_count = head2[0].offset/sizeof(head2[0]);
-    if(entry_count > 256) { // maximum in vanilla archives is 180+1 (th03)
+    if(entry_count < 1 || entry_count > 256) { // maximum in vanilla archives is 180+1 (th03)
         goto notth02;
     }
-    if(-1 == thtk_io_read(input, &head2[1], head2[0].offset-sizeof(head2[0]), error)) {
+    if(head2[0].offset > prefix_size) {
         goto notth02;
     }
     for(int i=1;i<entry_count-1;i++) {
@@ -335,74 +456,69 @@ thdat_detect_base(
     SET_OUT(2);
 notth02:
     /* th03 */
-    if(-1 == thtk_io_seek(input, 0, SEEK_SET, error)) {
-        return -1;
-    }
-    th03_archive_header_t ahead;
-    if(-1 == thtk_io_read(input, &ahead, sizeof(ahead), error)) {
-        return -1;
-    }
-    if(++ahead.count > 256) {
-        goto notth03;
-    }
-    if(-1 == thtk_io_read(input, &head3[0], sizeof(head3[0])*ahead.count, error)) {
-        goto notth03;
-    }
-    unsigned char* data = (unsigned char*)head3;
-    for(int i=0;i<ahead.count*sizeof(head3[0]);i++) {
-        data[i] ^= ahead.key;
-        ahead.key -= data[i];
-    }
-    for(int i=0;i<ahead.count-1;i++) {
-        if(head3[i].magic != magic1 && head3[i].magic != magic2) {
+    {
+        th03_archive_header_t ahead;
+        memcpy(&ahead, prefix, sizeof(ahead));
+        if(++ahead.count > 256) {
             goto notth03;
         }
+        if(sizeof(ahead) + sizeof(head3[0])*ahead.count > prefix_size) {
+            goto notth03;
+        }
+        unsigned char* data = (unsigned char*)head3;
+        memcpy(data, prefix + sizeof(ahead), sizeof(head3[0])*ahead.count);
+        for(int i=0;i<ahead.count*sizeof(head3[0]);i++) {
+            data[i] ^= ahead.key;
+            ahead.key -= data[i];
+        }
+        for(int i=0;i<ahead.count-1;i++) {
+            if(head3[i].magic != magic1 && head3[i].magic != magic2) {
+                goto notth03;
+            }
+        }
+        if(head3[ahead.count-1].magic != 0) {
+            goto notth03;
+        }
+        SET_OUT(3);
+        SET_OUT(4);
+        SET_OUT(5);
     }
-    if(head3[ahead.count-1].magic != 0) {
-        goto notth03;
-    }
-    SET_OUT(3);
-    SET_OUT(4);
-    SET_OUT(5);
 notth03:
 
-    if(-1 == thtk_io_seek(input, 0, SEEK_SET, error)) {
-        return -1;
+    /* magic for TSA 06+ */
+    {
+        char magic[sizeof(th95_archive_header_t)];
+        memcpy(magic, prefix, sizeof(magic));
+        /* th06 */
+        if(!memcmp(magic,"PBG3",4))
+            SET_OUT(6);
+        /* th07*/
+        if(!memcmp(magic,"PBG4",4))
+            SET_OUT(7);
+        /* th08/th09, told apart by thdat_detect_trial */
+        if(!memcmp(magic,"PBGZ",4)) {
+            SET_OUT(8);
+            SET_OUT(9);
+        }
+        /* th095+ */
+        th_decrypt((unsigned char*)magic,sizeof(th95_archive_header_t),0x1b,0x37,sizeof(th95_archive_header_t),sizeof(th95_archive_header_t));
+        if(!memcmp(magic,"THA1",4)) {
+            SET_OUT(95);
+            SET_OUT(10);
+            SET_OUT(103);
+            SET_OUT(11);
+            SET_OUT(12);
+            SET_OUT(125);
+            SET_OUT(128);
+            SET_OUT(13);
+            SET_OUT(14);
+            SET_OUT(143);
+            SET_OUT(15);
+            SET_OUT(16);
+        }
     }
 
-    /* read magic for TSA 06+ */
-    char magic[sizeof(th95_archive_header_t)];
-    if(-1 == thtk_io_read(input, magic, sizeof(magic), error)) {
-        return -1;
-    }
-    /* th06 */
-    if(!memcmp(magic,"PBG3",4))
-        SET_OUT(6);
-    /* th07*/
-    if(!memcmp(magic,"PBG4",4))
-        SET_OUT(7);
-    /* th08/th09 */
-    if(!memcmp(magic,"PBGZ",4)) {
-        /* TODO: differentiate */
-        SET_OUT(8);
-        SET_OUT(9);
-    }
-    /* th095+ */
-    th_decrypt((unsigned char*)magic,sizeof(th95_archive_header_t),0x1b,0x37,sizeof(th95_archive_header_t),sizeof(th95_archive_header_t));
-    if(!memcmp(magic,"THA1",4)) {
-        SET_OUT(95);
-        SET_OUT(10);
-        SET_OUT(103);
-        SET_OUT(11);
-        SET_OUT(12);
-        SET_OUT(125);
-        SET_OUT(128);
-        SET_OUT(13);
-        SET_OUT(14);
-        SET_OUT(143);
-        SET_OUT(15);
-        SET_OUT(16);
-    }
+    thdat_detect_trial(fnheur, input, out);
 
     /* heur */
     uint32_t out2[4];
@@ -443,6 +559,25 @@ notth03:
     return 0;
 }
 
+/* Opening the archive for a trial moves the position of the stream, so it is
+ * put back afterwards. */
+static int
+thdat_detect_base(
+    int fnheur,
+    thtk_io_t* input,
+    uint32_t out[4],
+    unsigned int *heur,
+    thtk_error_t** error)
+{
+    const off_t position = thtk_io_seek(input, 0, SEEK_CUR, error);
+    if (position == -1)
+        return -1;
+    int ret = thdat_detect_contents(fnheur, input, out, heur, error);
+    if (thtk_io_seek(input, position, SEEK_SET, ret == -1 ? NULL : error) == -1)
+        ret = -1;
+    return ret;
+}
+
 int
 thdat_detect(
     const char* filename,
@@ -62,10 +62,19 @@ API_SYMBOL int thdat_detect_filename_w(
  *
  * Returns 0 if successful, and -1 if io error happened (check thtk_error_t)
  *
+ * The first few kilobytes of input are read with a single positional read.
+ * When the contents match variants that can only be told apart by decoding
+ * entries, the archive is also opened and up to 4 MiB of its entries are
+ * decoded.  The position of the stream is restored afterwards.
+ *
  * Filename heur is optional, use NULL as filename to disable it.
  *
  * out is bits corresponding to entries in detect_table.
- * Note that out array is only based on file contents.
+ * Note that out array is only based on file contents.  Formats with the same
+ * layout but different keys (TH08/TH09, and the THA1 variants) are told apart
+ * by trial-decoding the smallest entries of the archive, unless the filename
+ * heuristic already picks one of them; variants that decode all of those
+ * alike are all kept.
  *
  * heur is set in following cases:
  * - Only one bit of out is set
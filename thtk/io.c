@@ -28,20 +28,43 @@
  */
 #include <config.h>
 #include <errno.h>
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stddef.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
 #include <thtk/io.h>
+#include "util.h"
+
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP) && defined(HAVE_MUNMAP) && \
+    defined(HAVE_FCNTL_H) && defined(HAVE_UNISTD_H) && \
+    defined(HAVE_PREAD) && defined(HAVE_PWRITE) && defined(HAVE_FTRUNCATE)
+# define THTK_IO_MAPPED_FILE
+#endif
 
 struct thtk_io_t {
     void* private;
 
     ssize_t (*read)(thtk_io_t* io, void* buf, size_t count, thtk_error_t** error);
+    ssize_t (*pread)(thtk_io_t* io, void* buf, size_t count, off_t offset, thtk_error_t** error);
     ssize_t (*write)(thtk_io_t* io, const void* buf, size_t count, thtk_error_t** error);
+    ssize_t (*pwrite)(thtk_io_t* io, const void* buf, size_t count, off_t offset, thtk_error_t** error);
     off_t (*seek)(thtk_io_t* io, off_t offset, int whence, thtk_error_t** error);
     unsigned char* (*map)(thtk_io_t* io, off_t offset, size_t count, thtk_error_t** error);
     void (*unmap)(thtk_io_t* io, unsigned char* map);
+    void (*prefetch)(thtk_io_t* io, off_t offset, size_t count);
     int (*close)(thtk_io_t* io);
 };
 
@@ -53,10 +76,12 @@ thtk_io_read(
     thtk_error_t** error)
 {
     ssize_t ret;
-    if (!io || !buf || !count) {
+    if (!io || (!buf && count)) {
         thtk_error_new(error, "invalid parameter passed");
         return -1;
     }
+    if (!count)
+        return 0;
     ret = io->read(io, buf, count, error);
     if (ret != (ssize_t)count) {
         thtk_error_new(error, "short read");
@@ -65,6 +90,29 @@ thtk_io_read(
     return ret;
 }
 
+ssize_t
+thtk_io_pread(
+    thtk_io_t* io,
+    void* buf,
+    size_t count,
+    off_t offset,
+    thtk_error_t** error)
+{
+    ssize_t ret;
+    if (!io || (!buf && count) || offset < 0) {
+        thtk_error_new(error, "invalid parameter passed");
+        return -1;
+    }
+    if (!count)
+        return 0;
+    ret = io->pread(io, buf, count, offset, error);
+    if (ret != (ssize_t)count) {
+        thtk_error_new(error, "short read");
+        return -1;
+    }
+    return ret;
+}
+
 ssize_t
 thtk_io_write(
     thtk_io_t* io,
@@ -73,10 +121,12 @@ thtk_io_write(
     thtk_error_t** error)
 {
     ssize_t ret;
-    if (!io || !buf || !count) {
+    if (!io || (!buf && count)) {
         thtk_error_new(error, "invalid parameter passed");
         return -1;
     }
+    if (!count)
+        return 0;
     ret = io->write(io, buf, count, error);
     if (ret != (ssize_t)count) {
         thtk_error_new(error, "short write");
@@ -85,6 +135,29 @@ thtk_io_write(
     return ret;
 }
 
+ssize_t
+thtk_io_pwrite(
+    thtk_io_t* io,
+    const void* buf,
+    size_t count,
+    off_t offset,
+    thtk_error_t** error)
+{
+    ssize_t ret;
+    if (!io || (!buf && count) || offset < 0) {
+        thtk_error_new(error, "invalid parameter passed");
+        return -1;
+    }
+    if (!count)
+        return 0;
+    ret = io->pwrite(io, buf, count, offset, error);
+    if (ret != (ssize_t)count) {
+        thtk_error_new(error, "short write");
+        return -1;
+    }
+    return ret;
+}
+
 off_t
 thtk_io_seek(
     thtk_io_t* io,
@@ -124,6 +197,18 @@ thtk_io_unmap(
     io->unmap(io, map);
 }
 
+void
+thtk_io_prefetch(
+    thtk_io_t* io,
+    off_t offset,
+    size_t count)
+{
+    if (!io || !count || offset < 0 || !io->prefetch) {
+        return;
+    }
+    io->prefetch(io, offset, count);
+}
+
 int
 thtk_io_close(
     thtk_io_t* io)
@@ -174,12 +259,148 @@ thtk_io_file_seek(
     int whence,
     thtk_error_t** error)
 {
+    off_t ret;
+#if defined(_MSC_VER)
+    if (_fseeki64(io->private, offset, whence) == -1) {
+        thtk_error_new(error, "error while seeking: %s", strerror(errno));
+        return (off_t)-1;
+    }
+    ret = _ftelli64(io->private);
+#elif defined(HAVE_FSEEKO) && defined(HAVE_FTELLO)
+    if (fseeko(io->private, offset, whence) == -1) {
+        thtk_error_new(error, "error while seeking: %s", strerror(errno));
+        return (off_t)-1;
+    }
+    ret = ftello(io->private);
+#else
+    if ((off_t)(long)offset != offset) {
+        thtk_error_new(error, "seek offset out of range");
+        return (off_t)-1;
+    }
     if (fseek(io->private, (long)offset, whence) == -1) {
         thtk_error_new(error, "error while seeking: %s", strerror(errno));
         return (off_t)-1;
     }
+    ret = ftell(io->private);
+#endif
+    if (ret == -1)
+        thtk_error_new(error, "error while seeking: %s", strerror(errno));
+
+    return ret;
+}
+
+#if defined(_WIN32)
+/* Handle I/O would move the file pointer behind the CRT's back and miss
+ * whatever it has buffered, so positional I/O goes through the CRT.  Its
+ * stream lock is recursive and keeps other users of the stream out while
+ * the position is borrowed. */
+# define THTK_IO_FILE_AT
+# define thtk_io_file_lock_stream(stream) _lock_file(stream)
+# define thtk_io_file_unlock_stream(stream) _unlock_file(stream)
+#elif !(defined(HAVE_PREAD) && defined(HAVE_PWRITE) && defined(HAVE_FILENO))
+/* Seeking and transferring have to happen together.  Without a way to lock
+ * a single stream, one lock covers all of them. */
+# define THTK_IO_FILE_AT
+static thtk_mutex_t thtk_io_file_lock = THTK_MUTEX_INIT;
+# define thtk_io_file_lock_stream(stream) ((void)(stream), thtk_mutex_lock(&thtk_io_file_lock))
+# define thtk_io_file_unlock_stream(stream) ((void)(stream), thtk_mutex_unlock(&thtk_io_file_lock))
+#endif
 
-    return ftell(io->private);
+#ifdef THTK_IO_FILE_AT
+/* Reads into rbuf, or writes wbuf, at offset, leaving the stream
+ * position where it was. */
+static ssize_t
+thtk_io_file_at(
+    thtk_io_t* io,
+    void* rbuf,
+    const void* wbuf,
+    size_t count,
+    off_t offset,
+    thtk_error_t** error)
+{
+    FILE* stream = io->private;
+    ssize_t ret = -1;
+    off_t prev;
+    thtk_io_file_lock_stream(stream);
+    prev = thtk_io_file_seek(io, 0, SEEK_CUR, error);
+    if (prev != -1 && thtk_io_file_seek(io, offset, SEEK_SET, error) != -1) {
+        if (rbuf)
+            ret = thtk_io_file_read(io, rbuf, count, error);
+        else
+            ret = thtk_io_file_write(io, wbuf, count, error);
+        /* The position is restored even if the transfer failed, but only
+         * the first error is reported. */
+        if (thtk_io_file_seek(io, prev, SEEK_SET, ret == -1 ? NULL : error) == -1)
+            ret = -1;
+    }
+    thtk_io_file_unlock_stream(stream);
+    return ret;
+}
+#endif
+
+static ssize_t
+thtk_io_file_pread(
+    thtk_io_t* io,
+    void* buf,
+    size_t count,
+    off_t offset,
+    thtk_error_t** error)
+{
+#if defined(HAVE_PREAD) && defined(HAVE_FILENO) && !defined(_WIN32)
+    FILE* stream = io->private;
+    size_t done = 0;
+    while (done < count) {
+        ssize_t ret = pread(fileno(stream), (unsigned char*)buf + done,
+            count - done, offset + done);
+        if (ret == -1) {
+            if (errno == EINTR)
+                continue;
+            thtk_error_new(error, "error while reading: %s", strerror(errno));
+            return -1;
+        }
+        if (ret == 0)
+            break;
+        done += ret;
+    }
+    return done;
+#else
+    return thtk_io_file_at(io, buf, NULL, count, offset, error);
+#endif
+}
+
+static ssize_t
+thtk_io_file_pwrite(
+    thtk_io_t* io,
+    const void* buf,
+    size_t count,
+    off_t offset,
+    thtk_error_t** error)
+{
+#if defined(HAVE_PWRITE) && defined(HAVE_FILENO) && !defined(_WIN32)
+    FILE* stream = io->private;
+    size_t written = 0;
+    /* Anything still buffered has to reach the file first. */
+    if (fflush(stream) == EOF) {
+        thtk_error_new(error, "error while writing: %s", strerror(errno));
+        return -1;
+    }
+    while (written < count) {
+        ssize_t ret = pwrite(fileno(stream), (const unsigned char*)buf + written,
+            count - written, offset + written);
+        if (ret == -1) {
+            if (errno == EINTR)
+                continue;
+            thtk_error_new(error, "error while writing: %s", strerror(errno));
+            return -1;
+        }
+        if (ret == 0)
+            break;
+        written += ret;
+    }
+    return written;
+#else
+    return thtk_io_file_at(io, NULL, buf, count, offset, error);
+#endif
 }
 
 static unsigned char*
@@ -189,10 +410,8 @@ thtk_io_file_map(
     size_t count,
     thtk_error_t** error)
 {
-    if (thtk_io_file_seek(io, offset, SEEK_SET, error) == -1)
-        return NULL;
     unsigned char* map = malloc(count);
-    if (thtk_io_file_read(io, map, count, error) != (ssize_t)count) {
+    if (thtk_io_file_pread(io, map, count, offset, error) != (ssize_t)count) {
         free(map);
         return NULL;
     }
@@ -207,6 +426,17 @@ thtk_io_file_unmap(
     free(map);
 }
 
+static void
+thtk_io_file_prefetch(
+    thtk_io_t* io,
+    off_t offset,
+    size_t count)
+{
+#if defined(HAVE_POSIX_FADVISE) && defined(HAVE_FILENO)
+    posix_fadvise(fileno((FILE*)io->private), offset, count, POSIX_FADV_WILLNEED);
+#endif
+}
+
 static int
 thtk_io_file_close(
     thtk_io_t* io)
@@ -218,10 +448,13 @@ static const thtk_io_t
 thtk_io_file_template = {
     NULL,
     thtk_io_file_read,
+    thtk_io_file_pread,
     thtk_io_file_write,
+    thtk_io_file_pwrite,
     thtk_io_file_seek,
     thtk_io_file_map,
     thtk_io_file_unmap,
+    thtk_io_file_prefetch,
     thtk_io_file_close,
 };
 
@@ -286,6 +519,23 @@ thtk_io_memory_read(
     return count;
 }
 
+static ssize_t
+thtk_io_memory_pread(
+    thtk_io_t* io,
+    void* buf,
+    size_t count,
+    off_t offset,
+    thtk_error_t** error)
+{
+    thtk_io_memory_t* private = io->private;
+    if (offset >= private->size)
+        return 0;
+    if (offset + (ssize_t)count >= private->size)
+        count = private->size - offset;
+    memcpy(buf, (unsigned char*)private->memory + offset, count);
+    return count;
+}
+
 static ssize_t
 thtk_io_memory_write(
     thtk_io_t* io,
@@ -301,6 +551,23 @@ thtk_io_memory_write(
     return count;
 }
 
+static ssize_t
+thtk_io_memory_pwrite(
+    thtk_io_t* io,
+    const void* buf,
+    size_t count,
+    off_t offset,
+    thtk_error_t** error)
+{
+    thtk_io_memory_t* private = io->private;
+    if (offset >= private->size)
+        return 0;
+    if (offset + (ssize_t)count >= private->size)
+        count = private->size - offset;
+    memcpy((unsigned char*)private->memory + offset, buf, count);
+    return count;
+}
+
 static off_t
 thtk_io_memory_seek(
     thtk_io_t* io,
@@ -379,10 +646,13 @@ static const thtk_io_t
 thtk_io_memory_template = {
     NULL,
     thtk_io_memory_read,
+    thtk_io_memory_pread,
     thtk_io_memory_write,
+    thtk_io_memory_pwrite,
     thtk_io_memory_seek,
     thtk_io_memory_map,
     thtk_io_memory_unmap,
+    NULL,
     thtk_io_memory_close,
 };
 
@@ -408,6 +678,8 @@ typedef struct {
     ssize_t size;
     ssize_t memory_size;
     void* memory;
+    /* Taken by pread and pwrite. */
+    thtk_mutex_t lock;
 } thtk_io_growing_memory_t;
 
 static ssize_t
@@ -418,6 +690,8 @@ thtk_io_growing_memory_read(
     thtk_error_t** error)
 {
     thtk_io_growing_memory_t* private = io->private;
+    if (private->offset >= private->size)
+        return 0;
     if (private->offset + (ssize_t)count >= private->size)
         count = private->size - private->offset;
     memcpy(buf, (unsigned char*)private->memory + private->offset, count);
@@ -425,6 +699,27 @@ thtk_io_growing_memory_read(
     return count;
 }
 
+static ssize_t
+thtk_io_growing_memory_pread(
+    thtk_io_t* io,
+    void* buf,
+    size_t count,
+    off_t offset,
+    thtk_error_t** error)
+{
+    thtk_io_growing_memory_t* private = io->private;
+    ssize_t ret = 0;
+    thtk_mutex_lock(&private->lock);
+    if (offset < private->size) {
+        if (offset + (ssize_t)count >= private->size)
+            count = private->size - offset;
+        memcpy(buf, (unsigned char*)private->memory + offset, count);
+        ret = count;
+    }
+    thtk_mutex_unlock(&private->lock);
+    return ret;
+}
+
 static ssize_t
 thtk_io_growing_memory_write(
     thtk_io_t* io,
@@ -434,6 +729,7 @@ thtk_io_growing_memory_write(
 {
     thtk_io_growing_memory_t* private = io->private;
     if (private->offset + (ssize_t)count >= private->size) {
+        const ssize_t prev_size = private->size;
         private->size = private->offset + (ssize_t)count;
         if (private->size >= private->memory_size) {
             while (private->size >= private->memory_size) {
@@ -445,12 +741,38 @@ thtk_io_growing_memory_write(
             }
             private->memory = realloc(private->memory, private->memory_size);
         }
+        /* Like a file, the gap left by seeking past the end reads as
+         * zeros. */
+        if (private->offset > prev_size)
+            memset((unsigned char*)private->memory + prev_size, 0,
+                private->offset - prev_size);
     }
     memcpy((unsigned char*)(private->memory) + private->offset, buf, count);
     private->offset += count;
     return count;
 }
 
+static ssize_t
+thtk_io_growing_memory_pwrite(
+    thtk_io_t* io,
+    const void* buf,
+    size_t count,
+    off_t offset,
+    thtk_error_t** error)
+{
+    thtk_io_growing_memory_t* private = io->private;
+    ssize_t ret;
+    /* The buffer may be reallocated, so this can't run alongside other
+     * writes. */
+    thtk_mutex_lock(&private->lock);
+    const off_t prev_offset = private->offset;
+    private->offset = offset;
+    ret = thtk_io_growing_memory_write(io, buf, count, error);
+    private->offset = prev_offset;
+    thtk_mutex_unlock(&private->lock);
+    return ret;
+}
+
 static off_t
 thtk_io_growing_memory_seek(
     thtk_io_t* io,
@@ -459,26 +781,25 @@ thtk_io_growing_memory_seek(
     thtk_error_t** error)
 {
     thtk_io_growing_memory_t* private = io->private;
+    /* Seeking past the end is allowed, as for files; the stream grows when
+     * something is written there. */
     switch (whence) {
     case SEEK_SET:
-        if (offset > private->size ||
-            offset < 0) {
+        if (offset < 0) {
             thtk_error_new(error, "seek out of bounds");
             return (off_t)-1;
         }
         private->offset = offset;
         break;
     case SEEK_CUR:
-        if (private->offset + offset > private->size ||
-            private->offset + offset < 0) {
+        if (private->offset + offset < 0) {
             thtk_error_new(error, "seek out of bounds");
             return (off_t)-1;
         }
         private->offset += offset;
         break;
     case SEEK_END:
-        if (private->size + offset > private->size ||
-            private->size + offset < 0) {
+        if (private->size + offset < 0) {
             thtk_error_new(error, "seek out of bounds");
             return (off_t)-1;
         }
@@ -520,6 +841,7 @@ thtk_io_growing_memory_close(
     thtk_io_t* io)
 {
     thtk_io_growing_memory_t* private = io->private;
+    thtk_mutex_destroy(&private->lock);
     free(private->memory);
     free(io->private);
     return 1;
@@ -529,10 +851,13 @@ static const thtk_io_t
 thtk_io_growing_memory_template = {
     NULL,
     thtk_io_growing_memory_read,
+    thtk_io_growing_memory_pread,
     thtk_io_growing_memory_write,
+    thtk_io_growing_memory_pwrite,
     thtk_io_growing_memory_seek,
     thtk_io_growing_memory_map,
     thtk_io_growing_memory_unmap,
+    NULL,
     thtk_io_growing_memory_close,
 };
 
@@ -547,7 +872,322 @@ thtk_io_open_growing_memory(
     private->size = 0;
     private->memory_size = 0;
     private->memory = NULL;
+    thtk_mutex_init(&private->lock);
     io->private = private;
 
     return io;
 }
+
+#ifdef THTK_IO_MAPPED_FILE
+typedef struct {
+    int fd;
+    /* Shared mapping of the first map_size bytes of the file. */
+    unsigned char* map;
+    off_t map_size;
+    off_t offset;
+    /* End of the data written so far. */
+    off_t size;
+    int read_only;
+    /* Guards size, which writes at different offsets may extend at the
+     * same time. */
+    thtk_mutex_t lock;
+} thtk_io_mapped_file_t;
+
+static ssize_t
+thtk_io_mapped_file_pread(
+    thtk_io_t* io,
+    void* buf,
+    size_t count,
+    off_t offset,
+    thtk_error_t** error)
+{
+    thtk_io_mapped_file_t* private = io->private;
+    size_t done = 0;
+    off_t size;
+    thtk_mutex_lock(&private->lock);
+    size = private->size;
+    thtk_mutex_unlock(&private->lock);
+    if (offset >= size)
+        return 0;
+    if (offset + (off_t)count > size)
+        count = size - offset;
+    if (offset < private->map_size) {
+        done = private->map_size - offset;
+        if (done > count)
+            done = count;
+        memcpy(buf, private->map + offset, done);
+    }
+    while (done < count) {
+        ssize_t ret = pread(private->fd, (unsigned char*)buf + done,
+            count - done, offset + done);
+        if (ret == -1) {
+            if (errno == EINTR)
+                continue;
+            thtk_error_new(error, "error while reading: %s", strerror(errno));
+            return -1;
+        }
+        if (ret == 0)
+            break;
+        done += ret;
+    }
+    return done;
+}
+
+static ssize_t
+thtk_io_mapped_file_read(
+    thtk_io_t* io,
+    void* buf,
+    size_t count,
+    thtk_error_t** error)
+{
+    thtk_io_mapped_file_t* private = io->private;
+    ssize_t ret = thtk_io_mapped_file_pread(io, buf, count, private->offset, error);
+    if (ret != -1)
+        private->offset += ret;
+    return ret;
+}
+
+static ssize_t
+thtk_io_mapped_file_pwrite(
+    thtk_io_t* io,
+    const void* buf,
+    size_t count,
+    off_t offset,
+    thtk_error_t** error)
+{
+    thtk_io_mapped_file_t* private = io->private;
+    size_t done = 0;
+    if (private->read_only) {
+        thtk_error_new(error, "error while writing: stream is read-only");
+        return -1;
+    }
+    if (offset < private->map_size) {
+        done = private->map_size - offset;
+        if (done > count)
+            done = count;
+        memcpy(private->map + offset, buf, done);
+    }
+    /* Whatever doesn't fit in the mapping goes through the descriptor. */
+    while (done < count) {
+        ssize_t ret = pwrite(private->fd, (const unsigned char*)buf + done,
+            count - done, offset + done);
+        if (ret == -1) {
+            if (errno == EINTR)
+                continue;
+            thtk_error_new(error, "error while writing: %s", strerror(errno));
+            return -1;
+        }
+        done += ret;
+    }
+    thtk_mutex_lock(&private->lock);
+    if (offset + (off_t)count > private->size)
+        private->size = offset + count;
+    thtk_mutex_unlock(&private->lock);
+    return count;
+}
+
+static ssize_t
+thtk_io_mapped_file_write(
+    thtk_io_t* io,
+    const void* buf,
+    size_t count,
+    thtk_error_t** error)
+{
+    thtk_io_mapped_file_t* private = io->private;
+    ssize_t ret = thtk_io_mapped_file_pwrite(io, buf, count, private->offset, error);
+    if (ret != -1)
+        private->offset += ret;
+    return ret;
+}
+
+static off_t
+thtk_io_mapped_file_seek(
+    thtk_io_t* io,
+    off_t offset,
+    int whence,
+    thtk_error_t** error)
+{
+    thtk_io_mapped_file_t* private = io->private;
+    switch (whence) {
+    case SEEK_SET:
+        break;
+    case SEEK_CUR:
+        offset += private->offset;
+        break;
+    case SEEK_END:
+        thtk_mutex_lock(&private->lock);
+        offset += private->size;
+        thtk_mutex_unlock(&private->lock);
+        break;
+    default:
+        thtk_error_new(error, "impossible");
+        return (off_t)-1;
+    }
+    /* Like a file, the position may be past the end of the data. */
+    if (offset < 0) {
+        thtk_error_new(error, "seek out of bounds");
+        return (off_t)-1;
+    }
+    private->offset = offset;
+    return private->offset;
+}
+
+static unsigned char*
+thtk_io_mapped_file_map(
+    thtk_io_t* io,
+    off_t offset,
+    size_t count,
+    thtk_error_t** error)
+{
+    thtk_io_mapped_file_t* private = io->private;
+    if (offset + (off_t)count <= private->map_size)
+        return private->map + offset;
+
+    unsigned char* map = malloc(count);
+    if (thtk_io_mapped_file_pread(io, map, count, offset, error) != (ssize_t)count) {
+        free(map);
+        return NULL;
+    }
+    return map;
+}
+
+static void
+thtk_io_mapped_file_unmap(
+    thtk_io_t* io,
+    unsigned char* map)
+{
+    thtk_io_mapped_file_t* private = io->private;
+    if (map >= private->map && map < private->map + private->map_size)
+        return;
+    free(map);
+}
+
+static int
+thtk_io_mapped_file_close(
+    thtk_io_t* io)
+{
+    thtk_io_mapped_file_t* private = io->private;
+    int ret = 1;
+    if (private->map && munmap(private->map, private->map_size) == -1)
+        ret = 0;
+    /* Drop whatever was reserved but never written. */
+    if (!private->read_only && ftruncate(private->fd, private->size) == -1)
+        ret = 0;
+    if (close(private->fd) == -1)
+        ret = 0;
+    thtk_mutex_destroy(&private->lock);
+    free(private);
+    return ret;
+}
+
+static const thtk_io_t
+thtk_io_mapped_file_template = {
+    NULL,
+    thtk_io_mapped_file_read,
+    thtk_io_mapped_file_pread,
+    thtk_io_mapped_file_write,
+    thtk_io_mapped_file_pwrite,
+    thtk_io_mapped_file_seek,
+    thtk_io_mapped_file_map,
+    thtk_io_mapped_file_unmap,
+    NULL,
+    thtk_io_mapped_file_close,
+};
+#endif
+
+thtk_io_t*
+thtk_io_open_file_preallocated(
+    const char* path,
+    off_t size,
+    thtk_error_t** error)
+{
+#ifdef THTK_IO_MAPPED_FILE
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (fd == -1) {
+        thtk_error_new(error, "error while opening file `%s': %s", path, strerror(errno));
+        return NULL;
+    }
+
+    thtk_io_mapped_file_t* private = malloc(sizeof(*private));
+    private->fd = fd;
+    private->map = NULL;
+    private->map_size = 0;
+    private->offset = 0;
+    private->size = 0;
+    private->read_only = 0;
+    thtk_mutex_init(&private->lock);
+
+    /* If the space can't be reserved or mapped, every write simply goes
+     * through the descriptor instead. */
+    if (size > 0 && (off_t)(size_t)size == size) {
+#ifdef HAVE_POSIX_FALLOCATE
+        int ret = posix_fallocate(fd, 0, size);
+#else
+        int ret = ftruncate(fd, size) == -1 ? errno : 0;
+#endif
+        if (ret == 0) {
+            void* map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (map != MAP_FAILED) {
+                private->map = map;
+                private->map_size = size;
+            }
+        }
+    }
+
+    thtk_io_t* io = malloc(sizeof(*io));
+    *io = thtk_io_mapped_file_template;
+    io->private = private;
+
+    return io;
+#else
+    (void)size;
+    return thtk_io_open_file(path, "wb", error);
+#endif
+}
+
+thtk_io_t*
+thtk_io_open_file_mapped(
+    const char* path,
+    thtk_error_t** error)
+{
+#if defined(THTK_IO_MAPPED_FILE) && defined(HAVE_SYS_STAT_H)
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        thtk_error_new(error, "error while opening file `%s': %s", path, strerror(errno));
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        thtk_error_new(error, "error while opening file `%s': %s", path, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    thtk_io_mapped_file_t* private = malloc(sizeof(*private));
+    private->fd = fd;
+    private->map = NULL;
+    private->map_size = 0;
+    private->offset = 0;
+    private->size = st.st_size;
+    private->read_only = 1;
+    thtk_mutex_init(&private->lock);
+
+    /* Reads go through the descriptor if the file can't be mapped. */
+    if (st.st_size > 0 && (off_t)(size_t)st.st_size == st.st_size) {
+        void* map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map != MAP_FAILED) {
+            private->map = map;
+            private->map_size = st.st_size;
+        }
+    }
+
+    thtk_io_t* io = malloc(sizeof(*io));
+    *io = thtk_io_mapped_file_template;
+    io->private = private;
+
+    return io;
+#else
+    return thtk_io_open_file(path, "rb", error);
+#endif
+}
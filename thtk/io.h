@@ -44,9 +44,18 @@ typedef struct thtk_io_t thtk_io_t;
 /* See the documentation for read(2).  Returns the number of bytes read, or -1
  * on error. */
 API_SYMBOL ssize_t thtk_io_read(thtk_io_t* io, void* buf, size_t count, thtk_error_t** error);
+/* See the documentation for pread(2).  Reads from the given offset without
+ * using or changing the current position, so several threads can read from
+ * the same object at once.  Returns the number of bytes read, or -1 on error. */
+API_SYMBOL ssize_t thtk_io_pread(thtk_io_t* io, void* buf, size_t count, off_t offset, thtk_error_t** error);
 /* See the documentation for write(2).  Returns the number of bytes written, or
  * -1 on error. */
 API_SYMBOL ssize_t thtk_io_write(thtk_io_t* io, const void* buf, size_t count, thtk_error_t** error);
+/* See the documentation for pwrite(2).  Writes at the given offset without
+ * using or changing the current position, so several threads can write
+ * non-overlapping ranges at once.  Returns the number of bytes written, or -1
+ * on error. */
+API_SYMBOL ssize_t thtk_io_pwrite(thtk_io_t* io, const void* buf, size_t count, off_t offset, thtk_error_t** error);
 /* See the documentation for lseek(2).  Returns the new offset, or -1 on error. */
 API_SYMBOL off_t thtk_io_seek(thtk_io_t* io, off_t offset, int whence, thtk_error_t** error);
 /* Returns a memory location which maps to the content of the IO object at the specified offset.
@@ -54,6 +63,9 @@ API_SYMBOL off_t thtk_io_seek(thtk_io_t* io, off_t offset, int whence, thtk_erro
 API_SYMBOL unsigned char* thtk_io_map(thtk_io_t* io, off_t offset, size_t count, thtk_error_t** error);
 /* Frees a mapping. */
 API_SYMBOL void thtk_io_unmap(thtk_io_t* io, unsigned char* map);
+/* Hints that the specified range will be read soon, so that it can be read
+ * ahead in one go.  Does nothing for objects where that doesn't apply. */
+API_SYMBOL void thtk_io_prefetch(thtk_io_t* io, off_t offset, size_t count);
 /* Closes and frees the IO object.  Returns 0 on error, otherwise 1. */
 API_SYMBOL int thtk_io_close(thtk_io_t* io);
 
@@ -62,6 +74,16 @@ API_SYMBOL thtk_io_t* thtk_io_open_file(const char* path, const char* mode, thtk
 #ifdef _WIN32
 API_SYMBOL thtk_io_t* thtk_io_open_file_w(const wchar_t* path, const wchar_t* mode, thtk_error_t** error);
 #endif
+/* Creates a file for writing and reserves size bytes for it.  Where mmap is
+ * available, writes within the reserved size are copied straight into a
+ * shared mapping of the file.  Writes past it still work, and the file is
+ * truncated to the written length when closed.  Falls back to
+ * thtk_io_open_file(path, "wb") elsewhere. */
+API_SYMBOL thtk_io_t* thtk_io_open_file_preallocated(const char* path, off_t size, thtk_error_t** error);
+/* Opens a file for reading only.  Where mmap is available the whole file is
+ * mapped, so reads and thtk_io_map are served from the mapping.  Falls back
+ * to thtk_io_open_file(path, "rb") elsewhere. */
+API_SYMBOL thtk_io_t* thtk_io_open_file_mapped(const char* path, thtk_error_t** error);
 /* Opens a memory buffer for IO. */
 API_SYMBOL thtk_io_t* thtk_io_open_memory(void* buf, size_t size, thtk_error_t** error);
 /* Creates a new memory buffer that automatically expands. */
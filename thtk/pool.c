@@ -0,0 +1,349 @@
+/*
+ * Redistribution and use in source and binary forms, with
+ * or without modification, are permitted provided that the
+ * following conditions are met:
+ *
+ * 1. Redistributions of source code must retain this list
+ *    of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce this
+ *    list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+#include <config.h>
+#include <stdlib.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include <thtk/thtk.h>
+#include "util.h"
+
+/* The pool keeps threads - 1 worker threads; the thread that starts a loop
+ * does its share of the work as worker 0.  Workers sleep on work_cond until
+ * the generation changes, and the last one to finish signals done_cond. */
+
+#ifdef _WIN32
+typedef CONDITION_VARIABLE pool_cond_t;
+typedef HANDLE pool_thread_t;
+#define pool_cond_init(cond) InitializeConditionVariable(cond)
+#define pool_cond_destroy(cond) ((void)(cond))
+#define pool_cond_wait(cond, mutex) SleepConditionVariableSRW((cond), (mutex), INFINITE, 0)
+#define pool_cond_broadcast(cond) WakeAllConditionVariable(cond)
+#define pool_cond_signal(cond) WakeConditionVariable(cond)
+#else
+typedef pthread_cond_t pool_cond_t;
+typedef pthread_t pool_thread_t;
+#define pool_cond_init(cond) pthread_cond_init((cond), NULL)
+#define pool_cond_destroy(cond) pthread_cond_destroy(cond)
+#define pool_cond_wait(cond, mutex) pthread_cond_wait((cond), (mutex))
+#define pool_cond_broadcast(cond) pthread_cond_broadcast(cond)
+#define pool_cond_signal(cond) pthread_cond_signal(cond)
+#endif
+
+/* The indices a worker has left, [begin, end). */
+typedef struct {
+    thtk_mutex_t lock;
+    size_t begin;
+    size_t end;
+} pool_share_t;
+
+typedef struct {
+    unsigned int threads;
+    pool_thread_t* workers;
+    pool_share_t* shares;
+
+    thtk_mutex_t lock;
+    pool_cond_t work_cond;
+    pool_cond_t done_cond;
+    unsigned long generation;
+    unsigned int busy;
+    int quit;
+
+    thtk_task_t task;
+    void* arg;
+} pool_t;
+
+static pool_t pool;
+static thtk_mutex_t pool_setup_lock = THTK_MUTEX_INIT;
+/* Held for the duration of a loop. */
+static thtk_mutex_t pool_loop_lock = THTK_MUTEX_INIT;
+static unsigned int pool_threads;
+static THTK_THREAD_LOCAL int pool_in_task;
+
+static unsigned int
+pool_default_threads(
+    void)
+{
+    const char* env = getenv("THTK_THREADS");
+    long n = env ? strtol(env, NULL, 10) : 0;
+    if (n > 0)
+        return n;
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    n = info.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+    n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return n > 0 ? n : 1;
+}
+
+/* Takes the next index of a worker's own share, or steals half of what
+ * another worker has left.  Returns 0 when no work is left anywhere. */
+static int
+pool_next(
+    unsigned int self,
+    size_t* index)
+{
+    pool_share_t* share = &pool.shares[self];
+
+    thtk_mutex_lock(&share->lock);
+    if (share->begin < share->end) {
+        *index = share->begin++;
+        thtk_mutex_unlock(&share->lock);
+        return 1;
+    }
+    thtk_mutex_unlock(&share->lock);
+
+    for (unsigned int i = 1; i < pool.threads; ++i) {
+        pool_share_t* victim = &pool.shares[(self + i) % pool.threads];
+        size_t begin, end;
+
+        thtk_mutex_lock(&victim->lock);
+        end = victim->end;
+        begin = victim->begin + (victim->end - victim->begin) / 2;
+        if (begin < end)
+            victim->end = begin;
+        thtk_mutex_unlock(&victim->lock);
+        if (begin >= end)
+            continue;
+
+        /* The first stolen index is run right away. */
+        thtk_mutex_lock(&share->lock);
+        share->begin = begin + 1;
+        share->end = end;
+        thtk_mutex_unlock(&share->lock);
+        *index = begin;
+        return 1;
+    }
+    return 0;
+}
+
+static void
+pool_work(
+    unsigned int self)
+{
+    size_t index;
+    pool_in_task = 1;
+    while (pool_next(self, &index))
+        pool.task(pool.arg, index);
+    pool_in_task = 0;
+}
+
+#ifdef _WIN32
+static DWORD WINAPI
+#else
+static void*
+#endif
+pool_worker(
+    void* arg)
+{
+    const unsigned int self = (unsigned int)(size_t)arg;
+    unsigned long generation = 0;
+
+    thtk_mutex_lock(&pool.lock);
+    for (;;) {
+        while (pool.generation == generation && !pool.quit)
+            pool_cond_wait(&pool.work_cond, &pool.lock);
+        if (pool.quit)
+            break;
+        generation = pool.generation;
+        thtk_mutex_unlock(&pool.lock);
+
+        pool_work(self);
+
+        thtk_mutex_lock(&pool.lock);
+        if (!--pool.busy)
+            pool_cond_signal(&pool.done_cond);
+    }
+    thtk_mutex_unlock(&pool.lock);
+    return 0;
+}
+
+#ifndef _WIN32
+/* A forked child has none of the workers, so it starts its own pool. */
+static void
+pool_atfork_child(
+    void)
+{
+    pool.workers = NULL;
+    pool.shares = NULL;
+    thtk_mutex_init(&pool_setup_lock);
+    thtk_mutex_init(&pool_loop_lock);
+}
+#endif
+
+/* Starts the worker threads.  Called with pool_setup_lock held. */
+static void
+pool_start(
+    void)
+{
+#ifndef _WIN32
+    static int registered = 0;
+    if (!registered) {
+        pthread_atfork(NULL, NULL, pool_atfork_child);
+        registered = 1;
+    }
+#endif
+
+    if (!pool_threads)
+        pool_threads = pool_default_threads();
+
+    pool.threads = pool_threads;
+    pool.generation = 0;
+    pool.busy = 0;
+    pool.quit = 0;
+    thtk_mutex_init(&pool.lock);
+    pool_cond_init(&pool.work_cond);
+    pool_cond_init(&pool.done_cond);
+    pool.shares = malloc(pool.threads * sizeof(*pool.shares));
+    pool.workers = malloc(pool.threads * sizeof(*pool.workers));
+    for (unsigned int i = 0; i < pool.threads; ++i)
+        thtk_mutex_init(&pool.shares[i].lock);
+
+    for (unsigned int i = 1; i < pool.threads; ++i) {
+        void* arg = (void*)(size_t)i;
+#ifdef _WIN32
+        pool.workers[i] = CreateThread(NULL, 0, pool_worker, arg, 0, NULL);
+        if (!pool.workers[i]) {
+#else
+        if (pthread_create(&pool.workers[i], NULL, pool_worker, arg)) {
+#endif
+            /* Carry on with the threads there are. */
+            pool.threads = i;
+            break;
+        }
+    }
+}
+
+/* Stops the worker threads.  Called with pool_setup_lock held. */
+static void
+pool_stop(
+    void)
+{
+    if (!pool.workers)
+        return;
+
+    thtk_mutex_lock(&pool.lock);
+    pool.quit = 1;
+    pool_cond_broadcast(&pool.work_cond);
+    thtk_mutex_unlock(&pool.lock);
+
+    for (unsigned int i = 1; i < pool.threads; ++i) {
+#ifdef _WIN32
+        WaitForSingleObject(pool.workers[i], INFINITE);
+        CloseHandle(pool.workers[i]);
+#else
+        pthread_join(pool.workers[i], NULL);
+#endif
+    }
+    for (unsigned int i = 0; i < pool.threads; ++i)
+        thtk_mutex_destroy(&pool.shares[i].lock);
+    pool_cond_destroy(&pool.work_cond);
+    pool_cond_destroy(&pool.done_cond);
+    thtk_mutex_destroy(&pool.lock);
+    free(pool.shares);
+    free(pool.workers);
+    pool.shares = NULL;
+    pool.workers = NULL;
+}
+
+void
+thtk_set_threads(
+    unsigned int threads)
+{
+    thtk_mutex_lock(&pool_setup_lock);
+    pool_stop();
+    pool_threads = threads ? threads : pool_default_threads();
+    thtk_mutex_unlock(&pool_setup_lock);
+}
+
+unsigned int
+thtk_get_threads(
+    void)
+{
+    thtk_mutex_lock(&pool_setup_lock);
+    if (!pool_threads)
+        pool_threads = pool_default_threads();
+    const unsigned int threads = pool_threads;
+    thtk_mutex_unlock(&pool_setup_lock);
+    return threads;
+}
+
+void
+thtk_parallel_for(
+    size_t count,
+    thtk_task_t task,
+    void* arg)
+{
+    size_t i;
+
+    if (!count)
+        return;
+
+    if (count == 1 || pool_in_task || !thtk_mutex_trylock(&pool_loop_lock)) {
+        for (i = 0; i < count; ++i)
+            task(arg, i);
+        return;
+    }
+
+    thtk_mutex_lock(&pool_setup_lock);
+    if (!pool.workers)
+        pool_start();
+    thtk_mutex_unlock(&pool_setup_lock);
+
+    if (pool.threads == 1) {
+        for (i = 0; i < count; ++i)
+            task(arg, i);
+        thtk_mutex_unlock(&pool_loop_lock);
+        return;
+    }
+
+    for (unsigned int w = 0; w < pool.threads; ++w) {
+        pool.shares[w].begin = count * w / pool.threads;
+        pool.shares[w].end = count * (w + 1) / pool.threads;
+    }
+    pool.task = task;
+    pool.arg = arg;
+
+    thtk_mutex_lock(&pool.lock);
+    pool.busy = pool.threads - 1;
+    ++pool.generation;
+    pool_cond_broadcast(&pool.work_cond);
+    thtk_mutex_unlock(&pool.lock);
+
+    pool_work(0);
+
+    thtk_mutex_lock(&pool.lock);
+    while (pool.busy)
+        pool_cond_wait(&pool.done_cond, &pool.lock);
+    thtk_mutex_unlock(&pool.lock);
+
+    thtk_mutex_unlock(&pool_loop_lock);
+}
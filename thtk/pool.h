@@ -0,0 +1,70 @@
+/*
+ * Redistribution and use in source and binary forms, with
+ * or without modification, are permitted provided that the
+ * following conditions are met:
+ *
+ * 1. Redistributions of source code must retain this list
+ *    of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce this
+ *    list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+#ifndef THTK_POOL_H_
+#define THTK_POOL_H_
+
+#include <stddef.h>
+
+#ifndef API_SYMBOL
+#define API_SYMBOL /* */
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Sets the number of threads thtk runs parallel work on, counting the thread
+ * that starts the work.  0 picks the value of the THTK_THREADS environment
+ * variable, or one thread per processor if it isn't set, which is also the
+ * default.  Must not be called while parallel work is running. */
+API_SYMBOL void thtk_set_threads(
+    unsigned int threads);
+
+/* Returns the number of threads parallel work runs on. */
+API_SYMBOL unsigned int thtk_get_threads(
+    void);
+
+typedef void (*thtk_task_t)(void* arg, size_t index);
+
+/* Calls task(arg, index) for every index below count on the thread pool and
+ * returns when all calls have returned.  Each thread works through its own
+ * share of the indices from the front, and threads that run out take half of
+ * what another has left from the back, so work listed largest first spreads
+ * best.  A loop started from inside a task, or while another thread's loop
+ * is running, runs on the calling thread alone. */
+API_SYMBOL void thtk_parallel_for(
+    size_t count,
+    thtk_task_t task,
+    void* arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
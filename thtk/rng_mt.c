@@ -31,18 +31,24 @@
 #include <stdlib.h>
 #include "rng_mt.h"
 
-const int32_t N = 624;
-const int32_t M = 397;
-const uint32_t UPPER_MASK = 0x80000000UL;
-const uint32_t LOWER_MASK = 0x7FFFFFFFUL;
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RNG_MT_SSE2
+#include <emmintrin.h>
+#endif
+
+#define N RNG_MT_N
+#define M 397
+#define UPPER_MASK 0x80000000UL
+#define LOWER_MASK 0x7FFFFFFFUL
+#define MATRIX_A 0x9908b0dfUL
 
 void
-rng_mt_internal_init(
+rng_mt_seed(
     rng_mt* rng,
     uint32_t seed)
 {
     uint32_t* mt = rng->mt;
-    
+
     mt[0] = seed;
     for (int32_t i = 1; i < N; ++i) {
         mt[i] = (0x6c078965UL * (mt[i-1] ^ (mt[i-1] >> 30)) + i);
@@ -55,8 +61,7 @@ rng_mt_init(
     uint32_t seed)
 {
     rng_mt* ret = malloc(sizeof(rng_mt));
-    ret->mt = calloc(N, sizeof(uint32_t));
-    rng_mt_internal_init(ret, seed);
+    rng_mt_seed(ret, seed);
     return ret;
 }
 
@@ -64,44 +69,125 @@ int
 rng_mt_free(
     rng_mt* rng)
 {
-    free(rng->mt);
     free(rng);
     return 1;
 }
-    
+
+static inline uint32_t
+rng_mt_twist1(
+    const uint32_t* mt,
+    int i,
+    int j)
+{
+    const uint32_t t = (mt[i]&UPPER_MASK) | (mt[(i+1) % N]&LOWER_MASK);
+    return mt[j] ^ (t>>1) ^ (-(t&1) & MATRIX_A);
+}
+
+#ifdef RNG_MT_SSE2
+/* Twists mt[i..i+3].  None of the words read are written by the same step, so
+ * four can be done at once. */
+static inline void
+rng_mt_twist4(
+    uint32_t* mt,
+    int i,
+    int j)
+{
+    const __m128i upper = _mm_set1_epi32((int)UPPER_MASK);
+    const __m128i lower = _mm_set1_epi32((int)LOWER_MASK);
+    const __m128i one = _mm_set1_epi32(1);
+    const __m128i matrix = _mm_set1_epi32((int)MATRIX_A);
+
+    const __m128i a = _mm_loadu_si128((const __m128i*)(mt + i));
+    const __m128i b = _mm_loadu_si128((const __m128i*)(mt + i + 1));
+    const __m128i c = _mm_loadu_si128((const __m128i*)(mt + j));
+    const __m128i t = _mm_or_si128(_mm_and_si128(a, upper), _mm_and_si128(b, lower));
+    const __m128i mag = _mm_and_si128(_mm_cmpeq_epi32(_mm_and_si128(t, one), one), matrix);
+    _mm_storeu_si128((__m128i*)(mt + i),
+        _mm_xor_si128(_mm_xor_si128(c, _mm_srli_epi32(t, 1)), mag));
+}
+#endif
+
+/* Generates the next block of N words. */
+static void
+rng_mt_generate(
+    rng_mt* rng)
+{
+    uint32_t* mt = rng->mt;
+    int i = 0;
+
+    /* Not seeded yet. */
+    if (rng->mti == N+1)
+        rng_mt_seed(rng, 5489);
+
+#ifdef RNG_MT_SSE2
+    for (; i + 4 <= N-M; i += 4)
+        rng_mt_twist4(mt, i, i+M);
+#endif
+    for (; i < N-M; ++i)
+        mt[i] = rng_mt_twist1(mt, i, i+M);
+#ifdef RNG_MT_SSE2
+    for (; i + 4 <= N-1; i += 4)
+        rng_mt_twist4(mt, i, i+(M-N));
+#endif
+    for (; i < N; ++i)
+        mt[i] = rng_mt_twist1(mt, i, i+(M-N));
+
+    rng->mti = 0;
+}
+
+static inline uint32_t
+rng_mt_temper(
+    uint32_t y)
+{
+    y ^= (y>>11);
+    y ^= (y<<7) & 0x9d2c5680UL;
+    y ^= (y<<15) & 0xefc60000UL;
+    y ^= (y>>18);
+    return y;
+}
+
 uint32_t
 rng_mt_nextint(
     rng_mt* rng)
 {
-    uint32_t* mt = rng->mt;
-    uint32_t ret;
-    static uint32_t mag01[2] = {0x0UL, 0x9908b0dfUL};
-    if (rng->mti >= N) {
-        int i;
-        uint32_t t;
-        if (rng->mti == N+1)
-            rng_mt_init(5489);
-        
-        for (i = 0; i < N-M; ++i) {
-            t = (mt[i]&UPPER_MASK) | (mt[i+1]&LOWER_MASK);
-            mt[i] = mt[i+M] ^ (t>>1) ^ mag01[t&1];
-        }
-        for (; i < N-1; i++) {
-            t = (mt[i]&UPPER_MASK) | (mt[i+1]&LOWER_MASK);
-            mt[i] = mt[i+(M-N)] ^ (t>>1) ^ mag01[t&1];
+    if (rng->mti >= N)
+        rng_mt_generate(rng);
+
+    return rng_mt_temper(rng->mt[rng->mti++]);
+}
+
+void
+rng_mt_fill(
+    rng_mt* rng,
+    uint32_t* out,
+    size_t count)
+{
+    while (count) {
+        if (rng->mti >= N)
+            rng_mt_generate(rng);
+
+        size_t n = N - rng->mti;
+        if (n > count)
+            n = count;
+        const uint32_t* mt = rng->mt + rng->mti;
+        size_t i = 0;
+#ifdef RNG_MT_SSE2
+        const __m128i mask1 = _mm_set1_epi32((int)0x9d2c5680UL);
+        const __m128i mask2 = _mm_set1_epi32((int)0xefc60000UL);
+        for (; i + 4 <= n; i += 4) {
+            __m128i y = _mm_loadu_si128((const __m128i*)(mt + i));
+            y = _mm_xor_si128(y, _mm_srli_epi32(y, 11));
+            y = _mm_xor_si128(y, _mm_and_si128(_mm_slli_epi32(y, 7), mask1));
+            y = _mm_xor_si128(y, _mm_and_si128(_mm_slli_epi32(y, 15), mask2));
+            y = _mm_xor_si128(y, _mm_srli_epi32(y, 18));
+            _mm_storeu_si128((__m128i*)(out + i), y);
         }
-        t = (mt[N-1]&UPPER_MASK) | (mt[0]&LOWER_MASK);
-        mt[N-1] = mt[M-1] ^ (t>>1) ^ mag01[t&1];
-        
-        rng->mti = 0;
+#endif
+        for (; i < n; ++i)
+            out[i] = rng_mt_temper(mt[i]);
+
+        rng->mti += n;
+        out += n;
+        count -= n;
     }
-    
-    ret = mt[rng->mti++];
-    
-    ret ^= (ret>>11);
-    ret ^= (ret<<7) & 0x9d2c5680UL;
-    ret ^= (ret<<15) & 0xefc60000UL;
-    ret ^= (ret>>18);
-    
-    return ret;
 }
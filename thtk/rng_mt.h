@@ -31,12 +31,21 @@
 #define RNG_MT_H_
 
 #include <inttypes.h>
+#include <stddef.h>
+
+#define RNG_MT_N 624
 
 typedef struct {
-    uint32_t* mt;
+    uint32_t mt[RNG_MT_N];
     int32_t mti;
 } rng_mt;
 
+/* Seeds a generator in place, so that it can live on the stack. */
+void
+rng_mt_seed(
+    rng_mt* rng,
+    uint32_t seed);
+
 rng_mt*
 rng_mt_init(
     uint32_t seed);
@@ -44,9 +53,16 @@ rng_mt_init(
 int
 rng_mt_free(
     rng_mt* rng);
-    
+
 uint32_t
 rng_mt_nextint(
     rng_mt* rng);
 
-#endif
\ No newline at end of file
+/* Writes the next count outputs to out, a block of the state at a time. */
+void
+rng_mt_fill(
+    rng_mt* rng,
+    uint32_t* out,
+    size_t count);
+
+#endif
@@ -32,19 +32,17 @@
 #include <stdlib.h>
 #include "thcrypt.h"
 
-void
-th_encrypt(
-    unsigned char* data,
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define THCRYPT_SSE2
+#include <emmintrin.h>
+#endif
+
+unsigned int
+th_crypt_extent(
     unsigned int size,
-    unsigned char key,
-    const unsigned char step,
     unsigned int block,
     unsigned int limit)
 {
-    const unsigned char* end;
-    unsigned char* temp = malloc(block);
-    unsigned int increment = (block >> 1) + (block & 1);
-
     if (size < block >> 2)
         size = 0;
     else
@@ -53,7 +51,55 @@ th_encrypt(
     if (limit % block != 0)
         limit = limit + (block - (limit % block));
 
-    end = data + (size < limit ? size : limit);
+    return size < limit ? size : limit;
+}
+
+/* Blocks up to this size are shuffled through a buffer on the stack. */
+#define TH_CRYPT_STACK_BLOCK 0x2000
+
+#ifdef THCRYPT_SSE2
+/* Reverses the order of the eight 16-bit words. */
+static inline __m128i
+th_crypt_reverse_words(
+    __m128i v)
+{
+    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+    v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+    return _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+}
+
+/* The keys for eight pairs of bytes: key + step * k in the low half and
+ * key + step * (increment + k) in the high half, for k from 0 to 7. */
+static inline __m128i
+th_crypt_keys(
+    unsigned char key,
+    unsigned char step,
+    unsigned int increment)
+{
+    unsigned char keys[16];
+    for (unsigned int k = 0; k < 8; ++k) {
+        keys[k] = key + step * k;
+        keys[k + 8] = key + step * (increment + k);
+    }
+    return _mm_loadu_si128((const __m128i*)keys);
+}
+#endif
+
+void
+th_encrypt(
+    unsigned char* data,
+    unsigned int size,
+    unsigned char key,
+    const unsigned char step,
+    unsigned int block,
+    unsigned int limit)
+{
+    const unsigned char* end;
+    unsigned char stack[TH_CRYPT_STACK_BLOCK];
+    unsigned char* temp = block <= sizeof(stack) ? stack : malloc(block);
+    unsigned int increment = (block >> 1) + (block & 1);
+
+    end = data + th_crypt_extent(size, block, limit);
 
     while (data < end) {
         unsigned char* in;
@@ -63,7 +109,27 @@ th_encrypt(
             increment = (block >> 1) + (block & 1);
         }
 
-        for (in = data + block - 1; in > data;) {
+        /* The bytes are read backwards in pairs; the first of each pair goes
+         * to the first half of the block and the second to the second. */
+        in = data + block - 1;
+#ifdef THCRYPT_SSE2
+        const unsigned int pairs = block >> 1;
+        const __m128i key_step = _mm_set1_epi8((char)(step * 8));
+        __m128i keys = th_crypt_keys(key, step, increment);
+        for (unsigned int j = 0; j + 8 <= pairs; j += 8) {
+            const __m128i v = _mm_loadu_si128((const __m128i*)(in - 15));
+            const __m128i first = th_crypt_reverse_words(_mm_srli_epi16(v, 8));
+            const __m128i second = th_crypt_reverse_words(_mm_and_si128(v, _mm_set1_epi16(0xff)));
+            const __m128i x = _mm_xor_si128(_mm_packus_epi16(first, second), keys);
+            _mm_storel_epi64((__m128i*)out, x);
+            _mm_storel_epi64((__m128i*)(out + increment), _mm_unpackhi_epi64(x, x));
+            keys = _mm_add_epi8(keys, key_step);
+            in -= 16;
+            out += 8;
+            key += step * 8;
+        }
+#endif
+        for (; in > data;) {
             *out = *in-- ^ key;
             *(out + increment) = *in-- ^ (key + step * increment);
             ++out;
@@ -80,7 +146,8 @@ th_encrypt(
         data += block;
     }
 
-    free(temp);
+    if (temp != stack)
+        free(temp);
 }
 
 void
@@ -93,18 +160,11 @@ th_decrypt(
     unsigned int limit)
 {
     const unsigned char* end;
-    unsigned char* temp = malloc(block);
+    unsigned char stack[TH_CRYPT_STACK_BLOCK];
+    unsigned char* temp = block <= sizeof(stack) ? stack : malloc(block);
     unsigned int increment = (block >> 1) + (block & 1);
 
-    if (size < block >> 2)
-        size = 0;
-    else
-        size -= (size % block < block >> 2) * size % block + size % 2;
-
-    if (limit % block != 0)
-        limit = limit + (block - (limit % block));
-
-    end = data + (size < limit ? size : limit);
+    end = data + th_crypt_extent(size, block, limit);
 
     while (data < end) {
         unsigned char* in = data;
@@ -114,7 +174,24 @@ th_decrypt(
             increment = (block >> 1) + (block & 1);
         }
 
-        for (out = temp + block - 1; out > temp;) {
+        out = temp + block - 1;
+#ifdef THCRYPT_SSE2
+        const unsigned int pairs = block >> 1;
+        const __m128i key_step = _mm_set1_epi8((char)(step * 8));
+        __m128i keys = th_crypt_keys(key, step, increment);
+        for (unsigned int j = 0; j + 8 <= pairs; j += 8) {
+            const __m128i first = _mm_loadl_epi64((const __m128i*)in);
+            const __m128i second = _mm_loadl_epi64((const __m128i*)(in + increment));
+            const __m128i x = _mm_xor_si128(_mm_unpacklo_epi64(first, second), keys);
+            const __m128i pairs16 = _mm_unpacklo_epi8(_mm_unpackhi_epi64(x, x), x);
+            _mm_storeu_si128((__m128i*)(out - 15), th_crypt_reverse_words(pairs16));
+            keys = _mm_add_epi8(keys, key_step);
+            in += 8;
+            out -= 16;
+            key += step * 8;
+        }
+#endif
+        for (; out > temp;) {
             *out-- = *in ^ key;
             *out-- = *(in + increment) ^ (key + step * increment);
             ++in;
@@ -131,5 +208,6 @@ th_decrypt(
         data += block;
     }
 
-    free(temp);
+    if (temp != stack)
+        free(temp);
 }
@@ -31,6 +31,13 @@
 
 #include <config.h>
 
+/* Returns how many bytes at the start of size bytes of data are changed by
+ * th_encrypt and th_decrypt. */
+unsigned int th_crypt_extent(
+    unsigned int size,
+    unsigned int block,
+    unsigned int limit);
+
 void th_encrypt(
     unsigned char* data,
     unsigned int size,
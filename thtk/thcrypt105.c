@@ -33,6 +33,11 @@
 #include "thcrypt105.h"
 #include "rng_mt.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define THCRYPT105_SSE2
+#include <emmintrin.h>
+#endif
+
 /* These function can be used for encrypting and decrypting. */
 void
 th_crypt105_list(
@@ -42,14 +47,23 @@ th_crypt105_list(
     unsigned char step1,
     unsigned char step2)
 {
-    unsigned int i;
-    rng_mt* rng = rng_mt_init(6+size);
-    for (i = 0; i < size; i++) {
-        int ti = i-1;
-        data[i] ^= (key + i*step1 + (ti*ti+ti)/2 * step2);
-        data[i] ^= (rng_mt_nextint(rng) & 0xff);
+    rng_mt rng;
+    uint32_t block[RNG_MT_N];
+    /* The key for byte i is key + i*step1 + (i-1)*i/2*step2, and the
+     * difference from one byte to the next grows by step2 each time. */
+    unsigned char k = key;
+    unsigned char delta = step1;
+
+    rng_mt_seed(&rng, 6+size);
+    for (unsigned int i = 0; i < size; i += RNG_MT_N) {
+        const unsigned int n = size - i < RNG_MT_N ? size - i : RNG_MT_N;
+        rng_mt_fill(&rng, block, n);
+        for (unsigned int j = 0; j < n; ++j) {
+            data[i + j] ^= k ^ (unsigned char)block[j];
+            k += delta;
+            delta += step2;
+        }
     }
-    rng_mt_free(rng);
 }
 
 void
@@ -58,9 +72,31 @@ th_crypt105_file(
     unsigned int size,
     unsigned int offset)
 {
-    unsigned char key = ((offset>>1) | 0x23) & 0xff;
-    unsigned int i;
-    for (i = 0; i < size; i++) {
+    const unsigned char key = ((offset>>1) | 0x23) & 0xff;
+    unsigned int i = 0;
+
+    /* Every byte uses the same key, so whole words can be done at once. */
+#ifdef THCRYPT105_SSE2
+    const __m128i key128 = _mm_set1_epi8((char)key);
+    for (; i + 64 <= size; i += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(data + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(data + i + 16));
+        __m128i c = _mm_loadu_si128((const __m128i*)(data + i + 32));
+        __m128i d = _mm_loadu_si128((const __m128i*)(data + i + 48));
+        _mm_storeu_si128((__m128i*)(data + i), _mm_xor_si128(a, key128));
+        _mm_storeu_si128((__m128i*)(data + i + 16), _mm_xor_si128(b, key128));
+        _mm_storeu_si128((__m128i*)(data + i + 32), _mm_xor_si128(c, key128));
+        _mm_storeu_si128((__m128i*)(data + i + 48), _mm_xor_si128(d, key128));
+    }
+#endif
+    const uint64_t key64 = key * UINT64_C(0x0101010101010101);
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        word ^= key64;
+        memcpy(data + i, &word, 8);
+    }
+    for (; i < size; i++) {
         data[i] ^= key;
     }
 }
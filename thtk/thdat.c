@@ -35,7 +35,9 @@
 #include <string.h>
 #include <thtk/thtk.h>
 #include "thdat.h"
+#include "thlzss.h"
 #include "thrle.h"
+#include "util.h"
 
 extern const thdat_module_t archive_th02;
 extern const thdat_module_t archive_th06;
@@ -43,7 +45,7 @@ extern const thdat_module_t archive_th08;
 extern const thdat_module_t archive_th95;
 extern const thdat_module_t archive_th105;
 
-static const thdat_module_t*
+const thdat_module_t*
 thdat_version_to_module(
     unsigned int version,
     thtk_error_t** error)
@@ -91,6 +93,8 @@ thdat_entry_init(
         memset(entry->name, 0, sizeof(entry->name));
         entry->extra = 0;
         entry->offset = entry->zsize = entry->size = -1;
+        entry->size_partial = 0;
+        entry->lzss_index = NULL;
     }
 }
 
@@ -115,9 +119,338 @@ thdat_new(
     thdat->entry_count = 0;
     thdat->entries = NULL;
     thdat->offset = 0;
+    thtk_mutex_init(&thdat->offset_lock);
+    thtk_mutex_init(&thdat->size_lock);
+    thdat->progress_func = NULL;
+    thdat->progress_arg = NULL;
+    thdat->contents = NULL;
     return thdat;
 }
 
+/* Phase times of the entry being processed on a thread. */
+typedef struct thdat_timing_t {
+    thdat_progress_t progress;
+    thdat_phase_t phase;
+    uint64_t mark;
+    /* Timing interrupted by this one, if entries are processed from within
+     * a callback. */
+    struct thdat_timing_t* prev;
+} thdat_timing_t;
+
+static THTK_THREAD_LOCAL thdat_timing_t* thdat_timing;
+
+void
+thdat_set_progress(
+    thdat_t* thdat,
+    thdat_progress_func_t progress_func,
+    void* arg)
+{
+    if (thdat) {
+        thdat->progress_func = progress_func;
+        thdat->progress_arg = arg;
+    }
+}
+
+void
+thdat_phase_mark(
+    thdat_phase_t phase)
+{
+    thdat_timing_t* timing = thdat_timing;
+    if (!timing)
+        return;
+    const uint64_t now = thtk_clock_ns();
+    timing->progress.ns[timing->phase] += now - timing->mark;
+    timing->phase = phase;
+    timing->mark = now;
+}
+
+/* Starts timing an entry, or the archive for entry_index -1, if a progress
+ * function is set.  Returns whether it is. */
+static int
+thdat_timing_begin(
+    thdat_t* thdat,
+    thdat_timing_t* timing,
+    int entry_index,
+    thdat_phase_t phase)
+{
+    if (!thdat->progress_func)
+        return 0;
+    memset(&timing->progress, 0, sizeof(timing->progress));
+    timing->progress.entry_index = entry_index;
+    timing->phase = phase;
+    timing->prev = thdat_timing;
+    thdat_timing = timing;
+    timing->mark = thtk_clock_ns();
+    return 1;
+}
+
+/* Finishes timing started by thdat_timing_begin and reports it. */
+static void
+thdat_timing_end(
+    thdat_t* thdat,
+    thdat_timing_t* timing,
+    int timed,
+    int ok)
+{
+    if (!timed)
+        return;
+    thdat_phase_mark(timing->phase);
+    thdat_timing = timing->prev;
+
+    thdat_progress_t* progress = &timing->progress;
+    if (progress->entry_index == -1) {
+        progress->stored_size = progress->size = thdat->offset;
+    } else {
+        const thdat_entry_t* entry = &thdat->entries[progress->entry_index];
+        progress->size = entry->size > 0 ? entry->size : 0;
+        /* Entries of archives being created start out with a size of 0. */
+        progress->stored_size = entry->zsize > 0 ? (size_t)entry->zsize : progress->size;
+    }
+    progress->ok = ok;
+    thdat->progress_func(thdat->progress_arg, thdat, progress);
+}
+
+/* An entry whose data was written, keyed by a hash of its content. */
+typedef struct {
+    uint64_t hash[2];
+    size_t size;
+    /* The content itself, as the hash alone can't tell two contents apart
+     * for certain.  Kept until the archive is freed. */
+    unsigned char* data;
+    /* -1 for an unused slot. */
+    int entry;
+} thdat_content_t;
+
+typedef struct {
+    int entry;
+    int owner;
+} thdat_alias_t;
+
+struct thdat_contents_t {
+    thtk_mutex_t lock;
+    /* Open addressing table; capacity is a power of two. */
+    thdat_content_t* table;
+    size_t capacity;
+    size_t count;
+    /* Entries that share the data written for another. */
+    thdat_alias_t* aliases;
+    size_t alias_count;
+};
+
+static struct thdat_contents_t*
+thdat_contents_new(void)
+{
+    struct thdat_contents_t* contents = malloc(sizeof(*contents));
+    thtk_mutex_init(&contents->lock);
+    contents->capacity = 64;
+    contents->count = 0;
+    contents->table = malloc(contents->capacity * sizeof(*contents->table));
+    for (size_t i = 0; i < contents->capacity; ++i)
+        contents->table[i].entry = -1;
+    contents->aliases = NULL;
+    contents->alias_count = 0;
+    return contents;
+}
+
+static void
+thdat_contents_free(
+    struct thdat_contents_t* contents)
+{
+    if (contents) {
+        thtk_mutex_destroy(&contents->lock);
+        for (size_t i = 0; i < contents->capacity; ++i) {
+            if (contents->table[i].entry >= 0)
+                free(contents->table[i].data);
+        }
+        free(contents->table);
+        free(contents->aliases);
+        free(contents);
+    }
+}
+
+static inline uint64_t
+thdat_rotl64(
+    uint64_t x,
+    unsigned int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t
+thdat_fmix64(
+    uint64_t x)
+{
+    x ^= x >> 33;
+    x *= UINT64_C(0xff51afd7ed558ccd);
+    x ^= x >> 33;
+    x *= UINT64_C(0xc4ceb9fe1a85ec53);
+    x ^= x >> 33;
+    return x;
+}
+
+/* Two independently mixed 64-bit hashes of the data, taken eight bytes at a
+ * time.  Together they make telling different contents apart a matter of
+ * 128 bits. */
+static void
+thdat_content_hash(
+    const unsigned char* data,
+    size_t size,
+    uint64_t hash[2])
+{
+    uint64_t a = UINT64_C(0x9e3779b97f4a7c15) ^ size;
+    uint64_t b = UINT64_C(0x87c37b91114253d5) + size;
+    size_t i;
+
+    for (i = 0; i + 8 <= size; i += 8) {
+        uint64_t w;
+        memcpy(&w, data + i, 8);
+        a = thdat_rotl64(a ^ (w * UINT64_C(0x87c37b91114253d5)), 31) * UINT64_C(0x4cf5ad432745937f);
+        b = thdat_rotl64(b + (w * UINT64_C(0x9e3779b97f4a7c15)), 27) * UINT64_C(0x52dce729) + UINT64_C(0x38495ab5);
+    }
+    if (i < size) {
+        uint64_t w = 0;
+        memcpy(&w, data + i, size - i);
+        a = thdat_rotl64(a ^ (w * UINT64_C(0x87c37b91114253d5)), 31) * UINT64_C(0x4cf5ad432745937f);
+        b = thdat_rotl64(b + (w * UINT64_C(0x9e3779b97f4a7c15)), 27) * UINT64_C(0x52dce729) + UINT64_C(0x38495ab5);
+    }
+
+    hash[0] = thdat_fmix64(a ^ thdat_rotl64(b, 17));
+    hash[1] = thdat_fmix64(b + a);
+}
+
+/* Returns the slot holding the content, or the empty slot ending its probe
+ * sequence. */
+static thdat_content_t*
+thdat_contents_find(
+    thdat_content_t* table,
+    size_t capacity,
+    const thdat_content_t* content)
+{
+    size_t i = content->hash[0] & (capacity - 1);
+    for (;; i = (i + 1) & (capacity - 1)) {
+        thdat_content_t* slot = &table[i];
+        if (slot->entry == -1)
+            return slot;
+        if (slot->entry >= 0 &&
+            slot->hash[0] == content->hash[0] &&
+            slot->hash[1] == content->hash[1] &&
+            slot->size == content->size)
+            return slot;
+    }
+}
+
+/* Looks up content, which is for the specified entry.  If another entry's
+ * data with the same content has been written, that entry is returned and
+ * the two are recorded to share the data.  Otherwise -1 is returned. */
+static int
+thdat_contents_share(
+    struct thdat_contents_t* contents,
+    const thdat_content_t* content)
+{
+    thtk_mutex_lock(&contents->lock);
+    const thdat_content_t* slot = thdat_contents_find(contents->table, contents->capacity, content);
+    const int owner = slot->entry;
+    const unsigned char* owner_data = slot->data;
+    thtk_mutex_unlock(&contents->lock);
+
+    /* The data of an added content doesn't change or move, so it can be
+     * compared without holding the lock. */
+    if (owner < 0 || memcmp(owner_data, content->data, content->size))
+        return -1;
+
+    thtk_mutex_lock(&contents->lock);
+    thdat_alias_t* alias;
+    ARRAY_GROW(contents->alias_count, contents->aliases, alias);
+    alias->entry = content->entry;
+    alias->owner = owner;
+    thtk_mutex_unlock(&contents->lock);
+    return owner;
+}
+
+/* Adds the content of an entry whose data has been written, taking over its
+ * data, unless an entry with the same hash got there first. */
+static void
+thdat_contents_add(
+    struct thdat_contents_t* contents,
+    const thdat_content_t* content)
+{
+    thtk_mutex_lock(&contents->lock);
+
+    if (thdat_contents_find(contents->table, contents->capacity, content)->entry >= 0) {
+        thtk_mutex_unlock(&contents->lock);
+        free(content->data);
+        return;
+    }
+
+    if ((contents->count + 1) * 2 > contents->capacity) {
+        const size_t capacity = contents->capacity * 2;
+        thdat_content_t* table = malloc(capacity * sizeof(*table));
+        for (size_t i = 0; i < capacity; ++i)
+            table[i].entry = -1;
+        for (size_t i = 0; i < contents->capacity; ++i) {
+            if (contents->table[i].entry >= 0)
+                *thdat_contents_find(table, capacity, &contents->table[i]) = contents->table[i];
+        }
+        free(contents->table);
+        contents->table = table;
+        contents->capacity = capacity;
+    }
+
+    *thdat_contents_find(contents->table, contents->capacity, content) = *content;
+    ++contents->count;
+    thtk_mutex_unlock(&contents->lock);
+}
+
+/* Writes an entry through the module.  With shared data enabled the input is
+ * hashed first, and an entry whose content was written before is only pointed
+ * at that data when the archive is closed.  Only data that was written
+ * successfully is shared, so an entry never ends up pointing at nothing. */
+static ssize_t
+thdat_write_entry(
+    thdat_t* thdat,
+    int entry_index,
+    thtk_io_t* input,
+    size_t input_length,
+    thtk_error_t** error)
+{
+    if (!thdat->contents)
+        return thdat->module->write(thdat, entry_index, input, input_length, error);
+
+    unsigned char* data = malloc(input_length ? input_length : 1);
+    if (thtk_io_read(input, data, input_length, error) != (ssize_t)input_length) {
+        free(data);
+        return -1;
+    }
+
+    thdat_content_t content;
+    thdat_content_hash(data, input_length, content.hash);
+    content.size = input_length;
+    content.data = data;
+    content.entry = entry_index;
+    if (thdat_contents_share(thdat->contents, &content) != -1) {
+        free(data);
+        thdat->entries[entry_index].size = input_length;
+        return input_length;
+    }
+
+    /* The stream takes over its buffer, and data is kept for comparing. */
+    unsigned char* copy = malloc(input_length ? input_length : 1);
+    memcpy(copy, data, input_length);
+    thtk_io_t* stream = thtk_io_open_memory(copy, input_length, error);
+    if (!stream) {
+        free(copy);
+        free(data);
+        return -1;
+    }
+    const ssize_t ret = thdat->module->write(thdat, entry_index, stream, input_length, error);
+    thtk_io_close(stream);
+    if (ret != -1)
+        thdat_contents_add(thdat->contents, &content);
+    else
+        free(data);
+    return ret;
+}
+
 thdat_t*
 thdat_open(
     unsigned int version,
@@ -177,6 +510,84 @@ thdat_create(
     return thdat;
 }
 
+int
+thdat_set_shared_data(
+    thdat_t* thdat,
+    int enable,
+    thtk_error_t** error)
+{
+    if (!thdat) {
+        thtk_error_new(error, "invalid parameter passed");
+        return 0;
+    }
+    if (enable && !(thdat->module->flags & THDAT_SHARED_DATA)) {
+        thtk_error_new(error, "format can't share data between entries");
+        return 0;
+    }
+    if (enable && !thdat->contents) {
+        thdat->contents = thdat_contents_new();
+    } else if (!enable && thdat->contents) {
+        if (thdat->contents->alias_count) {
+            thtk_error_new(error, "entries already share data");
+            return 0;
+        }
+        thdat_contents_free(thdat->contents);
+        thdat->contents = NULL;
+    }
+    return 1;
+}
+
+static int
+thdat_offset_compar(
+    const void* a,
+    const void* b)
+{
+    const off_t oa = *(const off_t*)a;
+    const off_t ob = *(const off_t*)b;
+    return (oa > ob) - (oa < ob);
+}
+
+void
+thdat_set_zsizes(
+    thdat_t* thdat,
+    off_t end)
+{
+    const size_t count = thdat->entry_count;
+    off_t* offsets = malloc((count ? count : 1) * sizeof(*offsets));
+    for (size_t i = 0; i < count; ++i)
+        offsets[i] = thdat->entries[i].offset;
+    qsort(offsets, count, sizeof(*offsets), thdat_offset_compar);
+
+    for (size_t i = 0; i < count; ++i) {
+        thdat_entry_t* entry = &thdat->entries[i];
+        /* Find the first offset past the entry's. */
+        size_t lo = 0;
+        size_t hi = count;
+        while (lo < hi) {
+            const size_t mid = lo + (hi - lo) / 2;
+            if (offsets[mid] <= entry->offset)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        entry->zsize = (lo < count ? offsets[lo] : end) - entry->offset;
+    }
+
+    free(offsets);
+}
+
+off_t
+thdat_reserve(
+    thdat_t* thdat,
+    size_t size)
+{
+    thtk_mutex_lock(&thdat->offset_lock);
+    const off_t offset = thdat->offset;
+    thdat->offset += size;
+    thtk_mutex_unlock(&thdat->offset_lock);
+    return offset;
+}
+
 static int
 thdat_entry_compar(
     const void* a,
@@ -184,7 +595,13 @@ thdat_entry_compar(
 {
     const thdat_entry_t* ea = a;
     const thdat_entry_t* eb = b;
-    return (int)ea->offset - eb->offset;
+    /* The difference of two offsets does not necessarily fit in an int. */
+    if (ea->offset != eb->offset)
+        return (ea->offset > eb->offset) - (ea->offset < eb->offset);
+    /* Empty entries take no space, so one written in parallel may share its
+     * offset with the next entry.  Formats that derive stored sizes from the
+     * following offset need it to come first. */
+    return (ea->zsize > eb->zsize) - (ea->zsize < eb->zsize);
 }
 
 int
@@ -196,8 +613,33 @@ thdat_close(
         thtk_error_new(error, "invalid parameter passed");
         return 0;
     }
+    /* All formats store offsets as 32-bit values. */
+    if (thdat->offset > UINT32_MAX) {
+        thtk_error_new(error, "archive is too large for this format");
+        return 0;
+    }
+    /* Point entries with the same content as an earlier one at its data. */
+    if (thdat->contents) {
+        for (size_t a = 0; a < thdat->contents->alias_count; ++a) {
+            const thdat_alias_t* alias = &thdat->contents->aliases[a];
+            thdat_entry_t* entry = &thdat->entries[alias->entry];
+            const thdat_entry_t* owner = &thdat->entries[alias->owner];
+            entry->extra = owner->extra;
+            entry->zsize = owner->zsize;
+            entry->offset = owner->offset;
+        }
+        thdat->contents->alias_count = 0;
+    }
     qsort(thdat->entries, thdat->entry_count, sizeof(thdat_entry_t), thdat_entry_compar);
-    return thdat->module->close(thdat, error);
+    /* Entries are written to the offsets reserved for them, so the stream
+     * position has to be moved past the last one. */
+    if (thtk_io_seek(thdat->stream, thdat->offset, SEEK_SET, error) == -1)
+        return 0;
+    thdat_timing_t timing;
+    const int timed = thdat_timing_begin(thdat, &timing, -1, THDAT_PHASE_DECOMPRESS);
+    const int ret = thdat->module->close(thdat, error);
+    thdat_timing_end(thdat, &timing, timed, ret);
+    return ret;
 }
 
 void
@@ -205,7 +647,14 @@ thdat_free(
     thdat_t* thdat)
 {
     if (thdat) {
+        if (thdat->entries) {
+            for (size_t e = 0; e < thdat->entry_count; ++e)
+                th_unlzss_index_free(thdat->entries[e].lzss_index);
+        }
         free(thdat->entries);
+        thdat_contents_free(thdat->contents);
+        thtk_mutex_destroy(&thdat->offset_lock);
+        thtk_mutex_destroy(&thdat->size_lock);
         free(thdat);
     }
 }
@@ -302,6 +751,33 @@ thdat_entry_get_name(
     return thdat->entries[entry_index].name;
 }
 
+/* Has the module work out the size of an entry whose entry list only
+ * records part of it.  This is left until the size is needed, as it can take
+ * decoding the entry.  0 indicates an error. */
+static int
+thdat_entry_find_size(
+    thdat_t* thdat,
+    int entry_index,
+    thtk_error_t** error)
+{
+    if (!thdat->module->size)
+        return 1;
+    thdat_entry_t* entry = &thdat->entries[entry_index];
+    int ret = 1;
+    thtk_mutex_lock(&thdat->size_lock);
+    if (entry->size_partial) {
+        const ssize_t size = thdat->module->size(thdat, entry_index, error);
+        if (size == -1) {
+            ret = 0;
+        } else {
+            entry->size = size;
+            entry->size_partial = 0;
+        }
+    }
+    thtk_mutex_unlock(&thdat->size_lock);
+    return ret;
+}
+
 ssize_t
 thdat_entry_get_size(
     thdat_t* thdat,
@@ -312,6 +788,8 @@ thdat_entry_get_size(
         thtk_error_new(error, "invalid parameter passed");
         return -1;
     }
+    if (!thdat_entry_find_size(thdat, entry_index, error))
+        return -1;
     return thdat->entries[entry_index].size;
 }
 
@@ -328,6 +806,19 @@ thdat_entry_get_zsize(
     return thdat->entries[entry_index].zsize;
 }
 
+off_t
+thdat_entry_get_offset(
+    thdat_t* thdat,
+    int entry_index,
+    thtk_error_t** error)
+{
+    if (!thdat || entry_index < 0 || entry_index >= (int)thdat->entry_count) {
+        thtk_error_new(error, "invalid parameter passed");
+        return -1;
+    }
+    return thdat->entries[entry_index].offset;
+}
+
 ssize_t
 thdat_entry_write_data(
     thdat_t* thdat,
@@ -340,9 +831,16 @@ thdat_entry_write_data(
         thtk_error_new(error, "invalid parameter passed");
         return -1;
     }
-    return thdat->module->write(thdat, entry_index, input, input_length, error);
+    thdat_timing_t timing;
+    const int timed = thdat_timing_begin(thdat, &timing, entry_index, THDAT_PHASE_READ);
+    const ssize_t ret = thdat_write_entry(thdat, entry_index, input, input_length, error);
+    thdat_timing_end(thdat, &timing, timed, ret != -1);
+    return ret;
 }
 
+/* Size of the buffer stored entries are streamed through. */
+#define THDAT_STREAM_CHUNK (1024 * 1024)
+
 ssize_t
 thdat_entry_read_data(
     thdat_t* thdat,
@@ -354,5 +852,607 @@ thdat_entry_read_data(
         thtk_error_new(error, "invalid parameter passed");
         return -1;
     }
-    return thdat->module->read(thdat, entry_index, output, error);
+    if (!thdat_entry_find_size(thdat, entry_index, error))
+        return -1;
+    const ssize_t size = thdat->entries[entry_index].size;
+    if (size < 0) {
+        thtk_error_new(error, "entry size is unknown");
+        return -1;
+    }
+
+    thdat_timing_t timing;
+    const int timed = thdat_timing_begin(thdat, &timing, entry_index, THDAT_PHASE_READ);
+    ssize_t ret;
+    if ((thdat->module->flags & THDAT_STORED) && thdat->module->read_range &&
+        size > THDAT_STREAM_CHUNK) {
+        /* Stored entries are passed through a fixed-size buffer. */
+        unsigned char* data = malloc(THDAT_STREAM_CHUNK);
+        ret = 0;
+        while (ret < size) {
+            const size_t count = size - ret < THDAT_STREAM_CHUNK ?
+                size - ret : THDAT_STREAM_CHUNK;
+            THDAT_PHASE(thdat, THDAT_PHASE_READ);
+            if (thdat->module->read_range(thdat, entry_index, data, ret, count, error) != (ssize_t)count) {
+                ret = -1;
+                break;
+            }
+            THDAT_PHASE(thdat, THDAT_PHASE_WRITE);
+            if (thtk_io_write(output, data, count, error) == -1) {
+                ret = -1;
+                break;
+            }
+            ret += count;
+        }
+        free(data);
+    } else {
+        unsigned char* data = malloc(size ? size : 1);
+        ret = thdat->module->read(thdat, entry_index, data, error);
+        THDAT_PHASE(thdat, THDAT_PHASE_WRITE);
+        if (ret > 0 && thtk_io_write(output, data, ret, error) == -1)
+            ret = -1;
+        free(data);
+    }
+    thdat_timing_end(thdat, &timing, timed, ret != -1);
+    return ret;
+}
+
+ssize_t
+thdat_entry_read_into(
+    thdat_t* thdat,
+    int entry_index,
+    void* buf,
+    size_t capacity,
+    thtk_error_t** error)
+{
+    if (!thdat || entry_index < 0 || entry_index >= (int)thdat->entry_count || !buf) {
+        thtk_error_new(error, "invalid parameter passed");
+        return -1;
+    }
+    if (!thdat_entry_find_size(thdat, entry_index, error))
+        return -1;
+    if (thdat->entries[entry_index].size < 0 ||
+        (size_t)thdat->entries[entry_index].size > capacity) {
+        thtk_error_new(error, "buffer too small");
+        return -1;
+    }
+    thdat_timing_t timing;
+    const int timed = thdat_timing_begin(thdat, &timing, entry_index, THDAT_PHASE_READ);
+    const ssize_t ret = thdat->module->read(thdat, entry_index, buf, error);
+    thdat_timing_end(thdat, &timing, timed, ret != -1);
+    return ret;
+}
+
+th_unlzss_index_t*
+thdat_entry_lzss_index(
+    thdat_entry_t* entry,
+    const unsigned char* zdata)
+{
+    th_unlzss_index_t* index = THTK_ATOMIC_LOAD_PTR(&entry->lzss_index);
+    if (index)
+        return index;
+
+    index = th_unlzss_index_new(zdata, entry->zsize, entry->size, THDAT_LZSS_INDEX_INTERVAL);
+    if (!THTK_ATOMIC_CAS_PTR(&entry->lzss_index, NULL, index)) {
+        th_unlzss_index_free(index);
+        index = THTK_ATOMIC_LOAD_PTR(&entry->lzss_index);
+    }
+    return index;
+}
+
+ssize_t
+thdat_entry_read_range(
+    thdat_t* thdat,
+    int entry_index,
+    void* buf,
+    size_t offset,
+    size_t count,
+    thtk_error_t** error)
+{
+    if (!thdat || entry_index < 0 || entry_index >= (int)thdat->entry_count || !buf) {
+        thtk_error_new(error, "invalid parameter passed");
+        return -1;
+    }
+
+    if (!thdat_entry_find_size(thdat, entry_index, error))
+        return -1;
+    const ssize_t size = thdat->entries[entry_index].size;
+    if (size < 0) {
+        thtk_error_new(error, "entry size is unknown");
+        return -1;
+    }
+    if (offset >= (size_t)size || !count)
+        return 0;
+    if (count > size - offset)
+        count = size - offset;
+
+    thdat_timing_t timing;
+    const int timed = thdat_timing_begin(thdat, &timing, entry_index, THDAT_PHASE_READ);
+    ssize_t ret;
+    if (thdat->module->read_range) {
+        ret = thdat->module->read_range(thdat, entry_index, buf, offset, count, error);
+        thdat_timing_end(thdat, &timing, timed, ret != -1);
+        return ret;
+    }
+
+    /* Otherwise the whole entry is decoded. */
+    unsigned char* data = malloc(size);
+    ret = thdat->module->read(thdat, entry_index, data, error);
+    if (ret != -1) {
+        if ((size_t)ret <= offset) {
+            ret = 0;
+        } else {
+            if (count > (size_t)ret - offset)
+                count = (size_t)ret - offset;
+            memcpy(buf, data + offset, count);
+            ret = count;
+        }
+    }
+    free(data);
+    thdat_timing_end(thdat, &timing, timed, ret != -1);
+    return ret;
+}
+
+ssize_t
+thdat_entry_read_raw(
+    thdat_t* thdat,
+    int entry_index,
+    void* buf,
+    size_t capacity,
+    thtk_error_t** error)
+{
+    if (!thdat || entry_index < 0 || entry_index >= (int)thdat->entry_count || !buf) {
+        thtk_error_new(error, "invalid parameter passed");
+        return -1;
+    }
+
+    const thdat_entry_t* entry = &thdat->entries[entry_index];
+    if (entry->zsize < 0 || entry->offset < 0) {
+        thtk_error_new(error, "stored size is unknown");
+        return -1;
+    }
+    if ((size_t)entry->zsize > capacity) {
+        thtk_error_new(error, "buffer too small");
+        return -1;
+    }
+    return thtk_io_pread(thdat->stream, buf, entry->zsize, entry->offset, error);
+}
+
+/* Entries are read in groups spanning at least this many bytes of the
+ * archive, and the next group is prefetched while one is being decoded. */
+#define THDAT_READ_WINDOW (8 * 1024 * 1024)
+
+typedef struct {
+    int index;
+    off_t offset;
+    /* Number of bytes to prefetch when reading reaches this entry, 0 for
+     * entries that don't start a group. */
+    off_t prefetch;
+    int failed;
+} thdat_read_order_t;
+
+typedef struct {
+    thdat_t* thdat;
+    thdat_read_func_t read_func;
+    thdat_output_func_t output_func;
+    thdat_input_func_t input_func;
+    thdat_error_func_t error_func;
+    void* arg;
+    thdat_read_order_t* order;
+    size_t count;
+} thdat_bulk_t;
+
+static int
+thdat_read_order_compar(
+    const void* a,
+    const void* b)
+{
+    const thdat_read_order_t* ea = a;
+    const thdat_read_order_t* eb = b;
+    return (ea->offset > eb->offset) - (ea->offset < eb->offset);
+}
+
+static void
+thdat_bulk_fail(
+    thdat_bulk_t* bulk,
+    size_t i,
+    thtk_error_t* error)
+{
+    bulk->order[i].failed = 1;
+    if (bulk->error_func)
+        bulk->error_func(bulk->arg, bulk->thdat, bulk->order[i].index, error);
+}
+
+static void
+thdat_read_all_task(
+    void* arg,
+    size_t i)
+{
+    thdat_bulk_t* bulk = arg;
+    thdat_t* thdat = bulk->thdat;
+    const thdat_read_order_t* order = bulk->order;
+    thtk_error_t* error = NULL;
+
+    if (order[i].prefetch) {
+        /* Read the following group ahead. */
+        const off_t offset = order[i].offset + order[i].prefetch;
+        for (size_t n = i + 1; n < bulk->count; ++n) {
+            if (order[n].offset >= offset) {
+                thtk_io_prefetch(thdat->stream, order[n].offset, order[n].prefetch);
+                break;
+            }
+        }
+    }
+
+    const int entry = order[i].index;
+    if (bulk->output_func) {
+        /* thdat_entry_read_data does the timing. */
+        thtk_io_t* output = bulk->output_func(bulk->arg, thdat, entry, &error);
+        int ok = 0;
+        if (output) {
+            ok = thdat_entry_read_data(thdat, entry, output, &error) != -1;
+            thtk_io_close(output);
+        }
+        if (!ok)
+            thdat_bulk_fail(bulk, i, error);
+        thtk_error_free(&error);
+        return;
+    }
+
+    unsigned char* data = NULL;
+    ssize_t ret = -1;
+    thdat_timing_t timing;
+    const int timed = thdat_timing_begin(thdat, &timing, entry, THDAT_PHASE_READ);
+    ssize_t size = -1;
+    if (thdat_entry_find_size(thdat, entry, &error)) {
+        size = thdat->entries[entry].size;
+        if (size < 0)
+            thtk_error_new(&error, "entry size is unknown");
+    }
+    if (size >= 0) {
+        data = malloc(size ? size : 1);
+        ret = thdat->module->read(thdat, entry, data, &error);
+        THDAT_PHASE(thdat, THDAT_PHASE_WRITE);
+    }
+    const int ok = ret != -1 && bulk->read_func(bulk->arg, thdat, entry, data, ret, &error);
+    thdat_timing_end(thdat, &timing, timed, ok);
+    if (!ok)
+        thdat_bulk_fail(bulk, i, error);
+    thtk_error_free(&error);
+    free(data);
+}
+
+static ssize_t
+thdat_read_all_base(
+    thdat_t* thdat,
+    thdat_read_func_t read_func,
+    thdat_output_func_t output_func,
+    thdat_error_func_t error_func,
+    void* arg,
+    thtk_error_t** error)
+{
+    const size_t count = thdat->entry_count;
+    if (!count)
+        return 0;
+
+    thdat_read_order_t* order = malloc(count * sizeof(*order));
+    size_t i;
+    for (i = 0; i < count; ++i) {
+        order[i].index = i;
+        order[i].offset = thdat->entries[i].offset;
+        order[i].prefetch = 0;
+        order[i].failed = 0;
+    }
+    qsort(order, count, sizeof(*order), thdat_read_order_compar);
+
+    /* The last entry's stored size isn't known for every format, so its
+     * group ends wherever the uncompressed size says it might. */
+    const thdat_entry_t* last = &thdat->entries[order[count - 1].index];
+    const ssize_t last_size = last->zsize >= 0 ? last->zsize : last->size;
+    const off_t end = order[count - 1].offset + (last_size > 0 ? last_size : 0);
+    size_t group = 0;
+    for (i = 1; i <= count; ++i) {
+        const off_t next = i < count ? order[i].offset : end;
+        if (i == count || next - order[group].offset >= THDAT_READ_WINDOW) {
+            order[group].prefetch = next - order[group].offset;
+            group = i;
+        }
+    }
+
+    thdat_bulk_t bulk = {
+        thdat, read_func, output_func, NULL, error_func, arg, order, count
+    };
+    thtk_io_prefetch(thdat->stream, order[0].offset, order[0].prefetch);
+    thtk_parallel_for(count, thdat_read_all_task, &bulk);
+
+    ssize_t failed = 0;
+    for (i = 0; i < count; ++i)
+        failed += order[i].failed;
+    free(order);
+    return failed;
+}
+
+ssize_t
+thdat_read_all(
+    thdat_t* thdat,
+    thdat_read_func_t read_func,
+    thdat_error_func_t error_func,
+    void* arg,
+    thtk_error_t** error)
+{
+    if (!thdat || !read_func) {
+        thtk_error_new(error, "invalid parameter passed");
+        return -1;
+    }
+    return thdat_read_all_base(thdat, read_func, NULL, error_func, arg, error);
+}
+
+ssize_t
+thdat_read_all_data(
+    thdat_t* thdat,
+    thdat_output_func_t output_func,
+    thdat_error_func_t error_func,
+    void* arg,
+    thtk_error_t** error)
+{
+    if (!thdat || !output_func) {
+        thtk_error_new(error, "invalid parameter passed");
+        return -1;
+    }
+    return thdat_read_all_base(thdat, NULL, output_func, error_func, arg, error);
+}
+
+static void
+thdat_write_all_task(
+    void* arg,
+    size_t i)
+{
+    thdat_bulk_t* bulk = arg;
+    thdat_t* thdat = bulk->thdat;
+    const int entry = bulk->order[i].index;
+    thtk_error_t* error = NULL;
+    thtk_io_t* input;
+    size_t length;
+
+    if (!thdat->entries[entry].name[0])
+        return;
+
+    thdat_timing_t timing;
+    const int timed = thdat_timing_begin(thdat, &timing, entry, THDAT_PHASE_READ);
+    int ok = 0;
+    if ((input = bulk->input_func(bulk->arg, thdat, entry, &length, &error))) {
+        ok = thdat_write_entry(thdat, entry, input, length, &error) != -1;
+        thtk_io_close(input);
+    }
+    thdat_timing_end(thdat, &timing, timed, ok);
+    if (!ok)
+        thdat_bulk_fail(bulk, i, error);
+    thtk_error_free(&error);
+}
+
+ssize_t
+thdat_write_all(
+    thdat_t* thdat,
+    thdat_input_func_t input_func,
+    thdat_error_func_t error_func,
+    void* arg,
+    thtk_error_t** error)
+{
+    if (!thdat || !input_func) {
+        thtk_error_new(error, "invalid parameter passed");
+        return -1;
+    }
+    const size_t count = thdat->entry_count;
+    thdat_read_order_t* order = malloc((count ? count : 1) * sizeof(*order));
+    size_t i;
+    for (i = 0; i < count; ++i) {
+        order[i].index = i;
+        order[i].failed = 0;
+    }
+
+    thdat_bulk_t bulk = {
+        thdat, NULL, NULL, input_func, error_func, arg, order, count
+    };
+    thtk_parallel_for(count, thdat_write_all_task, &bulk);
+
+    ssize_t failed = 0;
+    for (i = 0; i < count; ++i)
+        failed += order[i].failed;
+    free(order);
+    return failed;
+}
+
+struct thdat_builder_t {
+    thdat_t* thdat;
+    /* Room allocated for entries. */
+    size_t capacity;
+    /* Where the data starts, which is where the archive was laid out for no
+     * entries. */
+    off_t start;
+};
+
+thdat_builder_t*
+thdat_builder_new(
+    unsigned int version,
+    thtk_io_t* output,
+    thtk_error_t** error)
+{
+    thdat_t* thdat;
+    if (!(thdat = thdat_create(version, output, 0, error)))
+        return NULL;
+    /* thdat_create leaves laying out archives with the entry list in front
+     * to the caller. */
+    if ((version == 105 || version == 123) && !thdat_init(thdat, error))
+        return NULL;
+
+    thdat_builder_t* builder = malloc(sizeof(*builder));
+    builder->thdat = thdat;
+    builder->capacity = 0;
+    builder->start = thdat->offset;
+    return builder;
+}
+
+thdat_t*
+thdat_builder_archive(
+    thdat_builder_t* builder)
+{
+    return builder ? builder->thdat : NULL;
+}
+
+ssize_t
+thdat_builder_add(
+    thdat_builder_t* builder,
+    const char* name,
+    thtk_io_t* input,
+    size_t input_length,
+    thtk_error_t** error)
+{
+    if (!builder || !name || !input) {
+        thtk_error_new(error, "invalid parameter passed");
+        return -1;
+    }
+    thdat_t* thdat = builder->thdat;
+
+    if (thdat->entry_count == builder->capacity) {
+        builder->capacity = builder->capacity ? builder->capacity * 2 : 64;
+        thdat->entries = realloc(thdat->entries, builder->capacity * sizeof(*thdat->entries));
+    }
+    const int entry_index = thdat->entry_count++;
+    /* Start out the same as the entries of thdat_create. */
+    memset(&thdat->entries[entry_index], 0, sizeof(thdat->entries[entry_index]));
+    const off_t offset = thdat->offset;
+
+    if (!thdat_entry_set_name(thdat, entry_index, name, error) ||
+        thdat_entry_write_data(thdat, entry_index, input, input_length, error) == -1) {
+        --thdat->entry_count;
+        /* Entries are added one at a time, so any space reserved since was
+         * reserved for this one, and the next entry can have it. */
+        thdat->offset = offset;
+        return -1;
+    }
+
+    return entry_index;
+}
+
+/* Moves the data between start and the end of the archive up by delta,
+ * re-encoding entries whose stored data depends on their offset.  Entries
+ * are moved starting from the end, so none is overwritten before it has been
+ * read. */
+static int
+thdat_builder_relocate(
+    thdat_builder_t* builder,
+    off_t delta,
+    thtk_error_t** error)
+{
+    thdat_t* thdat = builder->thdat;
+    unsigned char* buffer = malloc(THDAT_STREAM_CHUNK);
+    off_t end = thdat->offset;
+    int ret = 1;
+
+    /* Entries are added one at a time, so they are stored in order. */
+    for (size_t i = thdat->entry_count; ret && i--;) {
+        thdat_entry_t* entry = &thdat->entries[i];
+        const off_t old_offset = entry->offset;
+        off_t pos = end;
+
+        entry->offset += delta;
+        while (pos > old_offset) {
+            const size_t count = pos - old_offset < THDAT_STREAM_CHUNK ?
+                pos - old_offset : THDAT_STREAM_CHUNK;
+            pos -= count;
+            if (thtk_io_pread(thdat->stream, buffer, count, pos, error) != (ssize_t)count) {
+                ret = 0;
+                break;
+            }
+            if (thdat->module->rekey)
+                thdat->module->rekey(thdat, i, old_offset, buffer, count);
+            if (thtk_io_pwrite(thdat->stream, buffer, count, pos + delta, error) != (ssize_t)count) {
+                ret = 0;
+                break;
+            }
+        }
+        end = old_offset;
+    }
+
+    free(buffer);
+    thdat->offset += delta;
+    return ret;
+}
+
+int
+thdat_builder_finish(
+    thdat_builder_t* builder,
+    thtk_error_t** error)
+{
+    if (!builder) {
+        thtk_error_new(error, "invalid parameter passed");
+        return 0;
+    }
+    thdat_t* thdat = builder->thdat;
+    const off_t end = thdat->offset;
+    int ret = 1;
+
+    /* Lay the archive out again for the entries it ended up with, to see how
+     * much room the entry list in front of the data needs. */
+    if (!thdat->module->create(thdat, error)) {
+        ret = 0;
+    } else {
+        const off_t delta = thdat->offset - builder->start;
+        thdat->offset = end;
+        if (delta < 0) {
+            thtk_error_new(error, "entry list shrank while adding entries");
+            ret = 0;
+        } else if (delta > 0) {
+            ret = thdat_builder_relocate(builder, delta, error);
+        }
+    }
+
+    if (ret)
+        ret = thdat_close(thdat, error);
+    thdat_builder_free(builder);
+    return ret;
+}
+
+void
+thdat_builder_free(
+    thdat_builder_t* builder)
+{
+    if (builder) {
+        thdat_free(builder->thdat);
+        free(builder);
+    }
+}
+
+int
+thdat_plausible_magic(
+    const char* name,
+    const unsigned char* data,
+    size_t size)
+{
+    static const struct {
+        const char* extension;
+        const char* magic;
+        size_t magic_size;
+    } magics[] = {
+        { ".bmp", "BM", 2 },
+        { ".jpg", "\xff\xd8\xff", 3 },
+        { ".ogg", "OggS", 4 },
+        { ".png", "\x89PNG", 4 },
+        { ".wav", "RIFF", 4 },
+    };
+    const char* extension = strrchr(name, '.');
+    if (!extension)
+        return 1;
+
+    for (size_t m = 0; m < sizeof(magics) / sizeof(magics[0]); ++m) {
+        const char* a = extension;
+        const char* b = magics[m].extension;
+        while (*a && tolower((unsigned char)*a) == *b) {
+            ++a;
+            ++b;
+        }
+        if (!*a && !*b)
+            return size >= magics[m].magic_size &&
+                !memcmp(data, magics[m].magic, magics[m].magic_size);
+    }
+    return 1;
 }
@@ -33,6 +33,7 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include <thtk/thtk.h>
+#include "util.h"
 
 typedef struct {
     char name[256];
@@ -41,10 +42,15 @@ typedef struct {
     /* These fields are -1 before being filled out. */
     /* Original file size. */
     ssize_t size;
+    /* Set when size only holds the lower bits of the original size, which
+     * the module's size function works out when it is first needed. */
+    int size_partial;
     /* Compressed file size. */
     ssize_t zsize;
     /* Offset in archive. */
-    ssize_t offset;
+    off_t offset;
+    /* Built on the first thdat_entry_read_range call for LZSS entries. */
+    struct th_unlzss_index_t* lzss_index;
 } thdat_entry_t;
 
 void thdat_entry_init(thdat_entry_t* entry);
@@ -57,7 +63,18 @@ struct thdat_t {
     thtk_io_t* stream;
     size_t entry_count;
     thdat_entry_t* entries;
-    uint32_t offset;
+    /* Offset at which the next entry is written. */
+    off_t offset;
+    /* Guards offset while entries are written in parallel. */
+    thtk_mutex_t offset_lock;
+    /* Guards the sizes of entries with size_partial set. */
+    thtk_mutex_t size_lock;
+    /* Set by thdat_set_progress. */
+    thdat_progress_func_t progress_func;
+    void* progress_arg;
+    /* Data written so far, for archives being created with shared data
+     * enabled by thdat_set_shared_data. */
+    struct thdat_contents_t* contents;
 };
 
 /* Strip path names. */
@@ -66,6 +83,12 @@ struct thdat_t {
 #define THDAT_UPPERCASE 2
 /* Check filenames for 8.3 format. */
 #define THDAT_8_3 4
+/* Entries are stored without compression, so reading them a range at a time
+ * costs no more than reading them whole. */
+#define THDAT_STORED 8
+/* The stored data of an entry depends on nothing but its content, so entries
+ * with the same content can point at the same data. */
+#define THDAT_SHARED_DATA 16
 
 struct thdat_module_t {
     /* THDAT_ flags. */
@@ -75,10 +98,76 @@ struct thdat_module_t {
     int (*create)(thdat_t* thdat, thtk_error_t** error);
     int (*close)(thdat_t* thdat, thtk_error_t** error);
 
-    ssize_t (*read)(thdat_t* thdat, int entry, thtk_io_t* output, thtk_error_t** error);
+    /* Decodes the entry into data, which has room for the entry's size.
+     * Returns the number of bytes written. */
+    ssize_t (*read)(thdat_t* thdat, int entry, unsigned char* data, thtk_error_t** error);
     ssize_t (*write)(thdat_t* thdat, int entry, thtk_io_t* input, size_t length, thtk_error_t** error);
+
+    /* Optional.  Decodes count bytes from offset in the entry into data; the
+     * range is within the entry.  Returns the number of bytes written. */
+    ssize_t (*read_range)(thdat_t* thdat, int entry, unsigned char* data, size_t offset, size_t count, thtk_error_t** error);
+
+    /* Optional.  Used by detection to tell apart versions sharing a module.
+     * Returns 0 if the entry doesn't decode to plausible data when read as
+     * the specified version, and 1 if it does or if that can't be told. */
+    int (*probe)(thdat_t* thdat, int entry, unsigned int version);
+
+    /* Optional.  Called when thdat_builder_finish moves the data of an entry
+     * that used to be stored at old_offset to its current offset.  data
+     * holds count bytes of it, which are re-encoded for the new offset. */
+    void (*rekey)(thdat_t* thdat, int entry, off_t old_offset, unsigned char* data, size_t count);
+
+    /* Optional.  Works out the original size of an entry with size_partial
+     * set.  Returns the size, or -1 on error. */
+    ssize_t (*size)(thdat_t* thdat, int entry, thtk_error_t** error);
 };
 
+/* Ends the current phase of processing an entry on this thread and starts
+ * the specified one. */
+void thdat_phase_mark(
+    thdat_phase_t phase);
+
+/* Used by modules to mark where the phases of reading and writing entries
+ * start.  Only costs a test when no progress function is set. */
+#define THDAT_PHASE(thdat, phase) \
+    do { \
+        if ((thdat)->progress_func) \
+            thdat_phase_mark(phase); \
+    } while (0)
+
+/* Reserves size bytes at the end of the archive being written and returns
+ * their offset.  Safe to call from parallel writes. */
+off_t thdat_reserve(
+    thdat_t* thdat,
+    size_t size);
+
+/* Sets the stored size of every entry to the distance to the next data stored
+ * after it, or to end for the last.  Entries may share data. */
+void thdat_set_zsizes(
+    thdat_t* thdat,
+    off_t end);
+
+/* Returns the module handling the version, or NULL if there is none. */
+const thdat_module_t* thdat_version_to_module(
+    unsigned int version,
+    thtk_error_t** error);
+
+/* Returns 0 if the extension of name calls for a magic number that data
+ * doesn't start with, otherwise 1. */
+int thdat_plausible_magic(
+    const char* name,
+    const unsigned char* data,
+    size_t size);
+
+/* Checkpoints are kept every this many bytes of an LZSS entry's output. */
+#define THDAT_LZSS_INDEX_INTERVAL (64 * 1024)
+
+/* Builds the LZSS index for an entry from its whole compressed data, unless
+ * another thread did so first.  Returns the index in use. */
+struct th_unlzss_index_t* thdat_entry_lzss_index(
+    thdat_entry_t* entry,
+    const unsigned char* zdata);
+
 #define ARRAY_GROW(counter, array, target) \
     do { \
         ++(counter); \
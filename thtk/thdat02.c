@@ -51,7 +51,7 @@ th02_open(
         if (thtk_io_seek(thdat->stream, 0, SEEK_SET, error) == -1)
             return 0;
 
-        if (eh2.offset % sizeof(eh2)) {
+        if (eh2.offset % sizeof(eh2) || eh2.offset < sizeof(eh2)) {
             thtk_error_new(error, "first entry offset invalid");
             return 0;
         }
@@ -63,7 +63,9 @@ th02_open(
         thdat->entry_count = th03_archive_header.count;
     }
 
-    thdat->entries = malloc(thdat->entry_count * sizeof(thdat_entry_t));
+    /* Cleared, so that thdat_free can free an archive that fails to open
+     * halfway. */
+    thdat->entries = calloc(thdat->entry_count, sizeof(thdat_entry_t));
 
     if (thdat->version <= 2) {
         th02_entry_headers = malloc(thdat->entry_count * sizeof(th02_entry_header_t));
@@ -85,6 +87,7 @@ th02_open(
 
     for (unsigned int e = 0; e < thdat->entry_count; ++e) {
         thdat_entry_t* entry = &thdat->entries[e];
+        thdat_entry_init(entry);
 
         entry->extra = thdat->version <= 2
             ? th02_keys[thdat->version - 1] /* th02_entry_headers[e].key */
@@ -111,38 +114,71 @@ th02_open(
     free(th02_entry_headers);
     free(th03_entry_headers);
 
+    /* TH03 and later only store the lower 16 bits of the size.  Runs expand
+     * two bytes into up to 256, so when the compressed data could expand
+     * past that, the real size is found by scanning it once it is needed. */
+    if (thdat->version >= 3) {
+        for (unsigned int e = 0; e < thdat->entry_count; ++e) {
+            thdat_entry_t* entry = &thdat->entries[e];
+            if (entry->size != entry->zsize && entry->zsize > 0xffff / 128)
+                entry->size_partial = 1;
+        }
+    }
+
     return 1;
 }
 
+static ssize_t
+th02_size(
+    thdat_t* thdat,
+    int entry_index,
+    thtk_error_t** error)
+{
+    thdat_entry_t* entry = &thdat->entries[entry_index];
+    unsigned char* zdata = malloc(entry->zsize);
+    if (thtk_io_pread(thdat->stream, zdata, entry->zsize, entry->offset, error) != entry->zsize) {
+        free(zdata);
+        return -1;
+    }
+    for (ssize_t i = 0; i < entry->zsize; ++i)
+        zdata[i] ^= entry->extra;
+    const size_t size = thtk_unrle_mem(zdata, entry->zsize, NULL, 0);
+    free(zdata);
+
+    if ((size & 0xffff) != (size_t)entry->size) {
+        thtk_error_new(error, "decompressed size doesn't match the entry list");
+        return -1;
+    }
+    return size;
+}
+
 static ssize_t
 th02_read(
     thdat_t* thdat,
     int entry_index,
-    thtk_io_t* output,
+    unsigned char* data,
     thtk_error_t** error)
 {
     thdat_entry_t* entry = &thdat->entries[entry_index];
-    unsigned char* data;
+    /* Stored entries are read straight into the output. */
+    unsigned char* zdata = entry->size == entry->zsize ? data : malloc(entry->zsize);
     ssize_t ret;
-#pragma omp critical
-    {
-        data = thtk_io_map(thdat->stream, entry->offset, entry->zsize, error);
-    }
-    if (!data)
+    if (thtk_io_pread(thdat->stream, zdata, entry->zsize, entry->offset, error) != entry->zsize) {
+        if (zdata != data)
+            free(zdata);
         return -1;
+    }
 
+    THDAT_PHASE(thdat, THDAT_PHASE_DECRYPT);
     for (ssize_t i = 0; i < entry->zsize; ++i)
-        data[i] ^= entry->extra;
+        zdata[i] ^= entry->extra;
 
-    if (entry->size == entry->zsize) {
-        ret = thtk_io_write(output, data, entry->zsize, error);
-        thtk_io_unmap(thdat->stream, data);
+    THDAT_PHASE(thdat, THDAT_PHASE_DECOMPRESS);
+    if (zdata == data) {
+        ret = entry->zsize;
     } else {
-        thtk_io_t* data_stream = thtk_io_open_memory(data, entry->zsize, error);
-        if (!data_stream)
-            return -1;
-        ret = thtk_unrle(data_stream, entry->zsize, output, error);
-        thtk_io_close(data_stream);
+        ret = thtk_unrle_mem(zdata, entry->zsize, data, entry->size);
+        free(zdata);
     }
 
     return ret;
@@ -174,55 +210,40 @@ th02_write(
     thdat_entry_t* entry = &thdat->entries[entry_index];
     entry->size = input_length;
 
-    off_t input_offset = thtk_io_seek(input, 0, SEEK_CUR, error);
-    if (input_offset == -1)
-        return -1;
-
     if (thdat->version <= 2) {
         for (unsigned int i = 0; i < 13; ++i)
             if (entry->name[i])
                 entry->name[i] ^= 0xff;
     }
 
-    thtk_io_t* output = thtk_io_open_growing_memory(error);
-    if (!output)
-        return -1;
-
-    if ((entry->zsize = thtk_rle(input, entry->size, output, error)) == -1)
+    unsigned char* data = malloc(entry->size ? entry->size : 1);
+    if (thtk_io_read(input, data, entry->size, error) != entry->size) {
+        free(data);
         return -1;
+    }
 
+    /* Data that doesn't get smaller is stored as it is. */
+    THDAT_PHASE(thdat, THDAT_PHASE_DECOMPRESS);
+    unsigned char* zdata = malloc(entry->size ? entry->size : 1);
+    entry->zsize = thtk_rle_mem(data, entry->size, zdata, entry->size);
     if (entry->zsize >= entry->size) {
         entry->zsize = entry->size;
-        thtk_io_close(output);
-        if (thtk_io_seek(input, input_offset, SEEK_SET, error) == -1)
-            return -1;
-        output = input;
+        free(zdata);
+        zdata = data;
+    } else {
+        free(data);
     }
 
-    unsigned char* data = thtk_io_map(output, 0, entry->zsize, error);
-    if (!data)
-        return -1;
-
+    THDAT_PHASE(thdat, THDAT_PHASE_DECRYPT);
     for (ssize_t i = 0; i < entry->zsize; ++i)
-        data[i] ^= thdat->version <= 2 ? th02_keys[thdat->version - 1] : entry_key;
-
-    ssize_t ret = -1;
+        zdata[i] ^= thdat->version <= 2 ? th02_keys[thdat->version - 1] : entry_key;
 
-#pragma omp critical
-    {
-        entry->offset = thtk_io_seek(thdat->stream, 0, SEEK_CUR, error);
-
-        if (entry->offset != -1)
-            ret = thtk_io_write(thdat->stream, data, entry->zsize, error);
-
-        if (ret != -1)
-            thdat->offset += ret;
-    }
+    THDAT_PHASE(thdat, THDAT_PHASE_WRITE);
+    entry->offset = thdat_reserve(thdat, entry->zsize);
 
-    thtk_io_unmap(output, data);
+    ssize_t ret = thtk_io_pwrite(thdat->stream, zdata, entry->zsize, entry->offset, error);
 
-    if (output != input)
-        thtk_io_close(output);
+    free(zdata);
 
     return ret;
 }
@@ -307,5 +328,9 @@ const thdat_module_t archive_th02 = {
     th02_create,
     th02_close,
     th02_read,
-    th02_write
+    th02_write,
+    NULL,
+    NULL,
+    NULL,
+    th02_size
 };
@@ -33,19 +33,21 @@
 #include "bits.h"
 #include "thdat.h"
 #include "thlzss.h"
+#include "util.h"
 #include "dattypes.h"
 
+/* Values are stored with a two bit prefix giving their size in bytes. */
 static uint32_t
 th06_read_uint32(
-    struct bitstream* b)
+    struct bitreader* b)
 {
-    uint32_t size = bitstream_read(b, 2);
-    return bitstream_read(b, (size + 1) * 8);
+    uint32_t size = bitreader_read(b, 2);
+    return bitreader_read(b, (size + 1) * 8);
 }
 
 static void
 th06_write_uint32(
-    struct bitstream* b,
+    struct bitwriter* b,
     uint32_t value)
 {
     unsigned int size = 1;
@@ -58,18 +60,18 @@ th06_write_uint32(
         }
     }
 
-    bitstream_write(b, 2, size - 1);
-    bitstream_write(b, size * 8, value);
+    bitwriter_write(b, 2, size - 1);
+    bitwriter_write(b, size * 8, value);
 }
 
 static void
 th06_read_string(
-    struct bitstream* b,
+    struct bitreader* b,
     unsigned int length,
     char* data)
 {
     while (length) {
-        *data = bitstream_read(b, 8);
+        *data = bitreader_read(b, 8);
         if (!*data)
             break;
         data++;
@@ -79,38 +81,67 @@ th06_read_string(
 
 static void
 th06_write_string(
-    struct bitstream* b,
+    struct bitwriter* b,
     unsigned int length,
     char* data)
 {
     unsigned int i;
     for (i = 0; i < length; ++i)
-        bitstream_write(b, 8, data[i]);
+        bitwriter_write(b, 8, data[i]);
 }
 
+/* The smallest possible PBG3 entry: five one byte values and an empty name. */
+#define TH06_MIN_ENTRY_BITS (5 * 10 + 8)
+
 static int
 th06_open(
     thdat_t* thdat,
     thtk_error_t** error)
 {
     char magic[4];
+    off_t table_offset;
 
     if (thtk_io_read(thdat->stream, magic, 4, error) != 4)
         return 0;
 
     if (strncmp(magic, "PBG3", 4) == 0) {
-        struct bitstream b;
-        bitstream_init(&b, thdat->stream);
+        /* The header has two values of at most 34 bits each, but small
+         * values take fewer bytes than that. */
+        unsigned char header[9] = { 0 };
+        struct bitreader b;
+        off_t end = thtk_io_seek(thdat->stream, 0, SEEK_END, error);
+        if (end == -1)
+            return 0;
+        const size_t header_size = end - 4 < (off_t)sizeof(header) ? (size_t)(end - 4) : sizeof(header);
+        if (thtk_io_pread(thdat->stream, header, header_size, 4, error) == -1)
+            return 0;
+        bitreader_init(&b, header, sizeof(header));
         uint32_t entry_count = th06_read_uint32(&b);
         thdat->offset = th06_read_uint32(&b);
 
-        if (thtk_io_seek(thdat->stream, thdat->offset, SEEK_SET, error) == -1)
+        if (thdat->offset > end) {
+            thtk_error_new(error, "entry list is past the end of the archive");
             return 0;
+        }
+        table_offset = thdat->offset;
+
+        /* The entry list runs to the end of the archive. */
+        const size_t table_size = end - thdat->offset;
+        if (entry_count > table_size * 8 / TH06_MIN_ENTRY_BITS) {
+            thtk_error_new(error, "entry count doesn't fit in the entry list");
+            return 0;
+        }
+        unsigned char* table = malloc(table_size ? table_size : 1);
+        if (thtk_io_pread(thdat->stream, table, table_size, thdat->offset, error) != (ssize_t)table_size) {
+            free(table);
+            return 0;
+        }
 
-        bitstream_init(&b, thdat->stream);
+        thdat->entry_count = entry_count;
+        thdat->entries = calloc(entry_count, sizeof(*thdat->entries));
+        bitreader_init(&b, table, table_size);
         for (unsigned int i = 0; i < entry_count; ++i) {
-            thdat_entry_t* entry;
-            ARRAY_GROW(thdat->entry_count, thdat->entries, entry);
+            thdat_entry_t* entry = &thdat->entries[i];
             thdat_entry_init(entry);
             th06_read_uint32(&b);
             th06_read_uint32(&b);
@@ -119,6 +150,7 @@ th06_open(
             entry->size = th06_read_uint32(&b);
             th06_read_string(&b, 255, entry->name);
         }
+        free(table);
     } else if (strncmp(magic, "PBG4", 4) == 0) {
         th07_header_t header;
 
@@ -129,6 +161,12 @@ th06_open(
         if (end == -1)
             return 0;
 
+        if (header.offset > end) {
+            thtk_error_new(error, "entry list is past the end of the archive");
+            return 0;
+        }
+        table_offset = header.offset;
+
         if (thtk_io_seek(thdat->stream, header.offset, SEEK_SET, error) == -1)
             return 0;
 
@@ -158,20 +196,9 @@ th06_open(
         return 0;
     }
 
-    off_t end_offset = thtk_io_seek(thdat->stream, 0, SEEK_END, error);
-    if (end_offset == -1)
-        return 0;
-
-    if (thdat->entry_count) {
-        thdat_entry_t* prev = NULL;
-        for (unsigned int i = 0; i < thdat->entry_count; ++i) {
-            thdat_entry_t* entry = &thdat->entries[i];
-            if (prev)
-                prev->zsize = entry->offset - prev->offset;
-            prev = entry;
-        }
-        prev->zsize = end_offset - prev->offset;
-    }
+    /* The data ends where the entry list starts.  Entries with the same
+     * content may share their data. */
+    thdat_set_zsizes(thdat, table_offset);
 
     return 1;
 }
@@ -180,29 +207,58 @@ static ssize_t
 th06_read(
     thdat_t* thdat,
     int entry_index,
-    thtk_io_t* output,
+    unsigned char* data,
     thtk_error_t** error)
 {
     thdat_entry_t* entry = &thdat->entries[entry_index];
     unsigned char* zdata = malloc(entry->zsize);
 
-    int failed;
-#pragma omp critical
-    {
-        failed = (thtk_io_seek(thdat->stream, entry->offset, SEEK_SET, error) == -1) ||
-                 (thtk_io_read(thdat->stream, zdata, entry->zsize, error) != entry->zsize);
-    }
-    if (failed)
+    if (thtk_io_pread(thdat->stream, zdata, entry->zsize, entry->offset, error) != entry->zsize) {
+        free(zdata);
         return -1;
+    }
 
-    thtk_io_t* zdata_stream = thtk_io_open_memory(zdata, entry->zsize, error);
-    if (!zdata_stream)
+    THDAT_PHASE(thdat, THDAT_PHASE_DECOMPRESS);
+    ssize_t ret = th_unlzss_mem(zdata, entry->zsize, data, entry->size);
+
+    free(zdata);
+
+    return ret;
+}
+
+static ssize_t
+th06_read_range(
+    thdat_t* thdat,
+    int entry_index,
+    unsigned char* data,
+    size_t offset,
+    size_t count,
+    thtk_error_t** error)
+{
+    thdat_entry_t* entry = &thdat->entries[entry_index];
+    th_unlzss_index_t* index = THTK_ATOMIC_LOAD_PTR(&entry->lzss_index);
+    size_t input_start = 0;
+    size_t input_end = entry->zsize;
+
+    if (index)
+        th_unlzss_index_input(index, entry->zsize, offset, count, &input_start, &input_end);
+
+    unsigned char* zdata = malloc(input_end - input_start + 1);
+    if (input_end > input_start &&
+        thtk_io_pread(thdat->stream, zdata, input_end - input_start,
+            entry->offset + input_start, error) != (ssize_t)(input_end - input_start)) {
+        free(zdata);
         return -1;
+    }
 
-    int ret = th_unlzss(zdata_stream, output, entry->size, error);
+    THDAT_PHASE(thdat, THDAT_PHASE_DECOMPRESS);
+    if (!index)
+        index = thdat_entry_lzss_index(entry, zdata);
+
+    ssize_t ret = th_unlzss_index_read(index, zdata, input_start, input_end, data, offset, count);
+
+    free(zdata);
 
-    thtk_io_close(zdata_stream);
-    
     return ret;
 }
 
@@ -234,6 +290,7 @@ th06_write(
         return -1;
     /* There is a chance that one of the games support uncompressed data. */
 
+    THDAT_PHASE(thdat, THDAT_PHASE_DECOMPRESS);
     if ((entry->zsize = th_lzss(input, entry->size, zdata_stream, error)) == -1)
         return -1;
 
@@ -247,14 +304,10 @@ th06_write(
             entry->extra += zdata[i];
     }
 
-    int ret;
+    THDAT_PHASE(thdat, THDAT_PHASE_WRITE);
+    entry->offset = thdat_reserve(thdat, entry->zsize);
 
-#pragma omp critical
-    {
-        ret = thtk_io_write(thdat->stream, zdata, entry->zsize, error);
-        entry->offset = thdat->offset;
-        thdat->offset += entry->zsize;
-    }
+    int ret = thtk_io_pwrite(thdat->stream, zdata, entry->zsize, entry->offset, error);
 
     thtk_io_unmap(zdata_stream, zdata);
     thtk_io_close(zdata_stream);
@@ -274,12 +327,12 @@ th06_close(
     unsigned int i;
     uint32_t header[3];
     const uint32_t zero = 0;
-    struct bitstream b;
+    struct bitwriter b;
     ssize_t buffer_size;
     thtk_io_t* buffer = NULL;
 
     if (thdat->version == 6) {
-        bitstream_init(&b, thdat->stream);
+        bitwriter_init(&b);
     } else {
         buffer = thtk_io_open_growing_memory(error);
     }
@@ -300,11 +353,13 @@ th06_close(
             th06_write_uint32(&b, entry->size);
             th06_write_string(&b, strlen(entry->name) + 1, entry->name);
         } else {
+            const uint32_t offset = entry->offset;
+            const uint32_t size = entry->size;
             if (thtk_io_write(buffer, entry->name, strlen(entry->name) + 1, error) == -1)
                 return 0;
-            if (thtk_io_write(buffer, &entry->offset, sizeof(uint32_t), error) != sizeof(uint32_t))
+            if (thtk_io_write(buffer, &offset, sizeof(uint32_t), error) != sizeof(uint32_t))
                 return 0;
-            if (thtk_io_write(buffer, &entry->size, sizeof(uint32_t), error) != sizeof(uint32_t))
+            if (thtk_io_write(buffer, &size, sizeof(uint32_t), error) != sizeof(uint32_t))
                 return 0;
             if (thtk_io_write(buffer, &zero, sizeof(uint32_t), error) != sizeof(uint32_t))
                 return 0;
@@ -312,7 +367,10 @@ th06_close(
     }
 
     if (thdat->version == 6) {
-        bitstream_finish(&b);
+        ssize_t ret = thtk_io_write(thdat->stream, b.data, bitwriter_size(&b), error);
+        free(b.data);
+        if (ret == -1)
+            return 0;
     } else {
         if (thtk_io_write(buffer, &zero, sizeof(uint32_t), error) != sizeof(uint32_t))
             return 0;
@@ -333,10 +391,13 @@ th06_close(
         return 0;
 
     if (thdat->version == 6) {
-        bitstream_init(&b, thdat->stream);
+        bitwriter_init(&b);
         th06_write_uint32(&b, thdat->entry_count);
         th06_write_uint32(&b, thdat->offset);
-        bitstream_finish(&b);
+        ssize_t ret = thtk_io_write(thdat->stream, b.data, bitwriter_size(&b), error);
+        free(b.data);
+        if (ret == -1)
+            return 0;
     } else {
         header[0] = thdat->entry_count;
         header[1] = thdat->offset;
@@ -350,10 +411,11 @@ th06_close(
 }
 
 const thdat_module_t archive_th06 = {
-    THDAT_BASENAME,
+    THDAT_BASENAME | THDAT_SHARED_DATA,
     th06_open,
     th06_create,
     th06_close,
     th06_read,
-    th06_write
+    th06_write,
+    th06_read_range
 };
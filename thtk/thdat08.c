@@ -78,7 +78,7 @@ th08_open(
     if (thtk_io_seek(thdat->stream, header.offset, SEEK_SET, error) == -1)
         return 0;
 
-    unsigned int zsize = filesize - header.offset;
+    size_t zsize = filesize - header.offset;
     zdata = malloc(zsize);
 
     if (thtk_io_read(thdat->stream, zdata, zsize, error) == -1)
@@ -113,7 +113,13 @@ th08_open(
         strcpy(entry->name, (char*)ptr);
         ptr = (uint32_t*)((char*)ptr + strlen(entry->name) + 1);
         entry->offset = *ptr++;
-        entry->size = *ptr++;
+        /* The stored size includes the four byte entry header. */
+        if (*ptr < 4) {
+            thtk_error_new(error, "entry size is smaller than its header");
+            free(data);
+            return 0;
+        }
+        entry->size = *ptr++ - 4;
         entry->extra = *ptr++;
     }
 
@@ -133,58 +139,43 @@ th08_open(
     return 1;
 }
 
+/* Decodes an entry using the keys of the specified version. */
 static ssize_t
-th08_read(
+th08_read_version(
     thdat_t* thdat,
     int entry_index,
-    thtk_io_t* output,
+    unsigned int version,
+    unsigned char* data,
     thtk_error_t** error)
 {
     thdat_entry_t* entry = &thdat->entries[entry_index];
-    const crypt_params* current_crypt_params = thdat->version == 8 ?
+    const crypt_params* current_crypt_params = version == 8 ?
         th08_crypt_params : th09_crypt_params;
     unsigned int i = 0;
     int type = -1;
 
-    thtk_io_t* raw_entry = thtk_io_open_growing_memory(error);
-    if (!raw_entry)
-        return -1;
     unsigned char* zdata = malloc(entry->zsize);
-
-    int failed = 0;
-#pragma omp critical
-    {
-        failed = (thtk_io_seek(thdat->stream, entry->offset, SEEK_SET, error) == -1) ||
-                 (thtk_io_read(thdat->stream, zdata, entry->zsize, error) != entry->zsize);
-    }
-
-    if (failed)
-        return -1;
-
-    thtk_io_t* zdata_stream = thtk_io_open_memory(zdata, entry->zsize, error);
-    if (!zdata_stream)
-        return -1;
-
-    if (th_unlzss(zdata_stream, raw_entry, entry->size, error) == -1)
-        return -1;
-    thtk_io_close(zdata_stream);
-    if (thtk_io_seek(raw_entry, 0, SEEK_SET, error) == -1)
+    if (thtk_io_pread(thdat->stream, zdata, entry->zsize, entry->offset, error) != entry->zsize) {
+        free(zdata);
         return -1;
+    }
 
-    char magic[3];
-    char entry_type;
-    if (thtk_io_read(raw_entry, magic, 3, error) != 3)
-        return -1;
-    if (thtk_io_read(raw_entry, &entry_type, 1, error) != 1)
-        return -1;
+    THDAT_PHASE(thdat, THDAT_PHASE_DECOMPRESS);
+    /* The compressed data starts with a four byte header, which is decoded on
+     * its own so that the rest can go straight into data. */
+    th_unlzss_state_t* state = malloc(sizeof(*state));
+    unsigned char raw_header[4];
+    th_unlzss_init(state);
+    const size_t header_size = th_unlzss_run(state, zdata, 0, entry->zsize, raw_header, sizeof(raw_header));
 
-    if (strncmp(magic, "edz", 3)) {
+    if (header_size < 4 || strncmp((char*)raw_header, "edz", 3)) {
         thtk_error_new(error, "incorrect entry magic");
+        free(state);
+        free(zdata);
         return -1;
     }
 
-    entry->size -= 4;
-
+    const char entry_type = raw_header[3];
     for (i = 0; i < 7; ++i) {
         if (current_crypt_params[i].type == entry_type) {
             type = i;
@@ -194,28 +185,53 @@ th08_read(
 
     if (type == -1) {
         thtk_error_new(error, "unsupported entry key");
+        free(state);
+        free(zdata);
         return -1;
     }
 
-    unsigned char* data = thtk_io_map(raw_entry, 4, entry->size, error);
-    if (!data)
-        return -1;
+    const size_t size = th_unlzss_run(state, zdata, 0, entry->zsize, data, entry->size);
+    free(state);
+    free(zdata);
 
+    THDAT_PHASE(thdat, THDAT_PHASE_DECRYPT);
     th_decrypt(data,
-               entry->size,
+               size,
                current_crypt_params[type].key,
                current_crypt_params[type].step,
                current_crypt_params[type].block,
                current_crypt_params[type].limit);
 
-    if (thtk_io_write(output, data, entry->size, error) == -1)
-        return -1;
+    return size;
+}
 
-    thtk_io_unmap(raw_entry, data);
+static ssize_t
+th08_read(
+    thdat_t* thdat,
+    int entry_index,
+    unsigned char* data,
+    thtk_error_t** error)
+{
+    return th08_read_version(thdat, entry_index, thdat->version, data, error);
+}
 
-    thtk_io_close(raw_entry);
+/* TH08 and TH09 use the same keys for some types of entries, and for the start
+ * of others, so only some entries can tell the two apart. */
+static int
+th08_probe(
+    thdat_t* thdat,
+    int entry_index,
+    unsigned int version)
+{
+    thdat_entry_t* entry = &thdat->entries[entry_index];
+    unsigned char* data = malloc(entry->size);
+    ssize_t size;
+    int plausible = 1;
 
-    return entry->size;
+    if ((size = th08_read_version(thdat, entry_index, version, data, NULL)) != -1)
+        plausible = thdat_plausible_magic(entry->name, data, size);
+    free(data);
+    return plausible;
 }
 
 static int
@@ -274,43 +290,36 @@ th08_write(
 {
     thdat_entry_t* entry = &thdat->entries[entry_index];
     const crypt_params* crypt_params = find_crypt_params(thdat->version, entry->name);
-    entry->size = input_length + 4;
-    unsigned char* data = malloc(entry->size);
+    entry->size = input_length;
+    /* The entry is prefixed with a four byte header, and compressed into the
+     * same allocation. */
+    unsigned char* data = malloc(input_length + 4 + TH_LZSS_BOUND(input_length + 4));
+    unsigned char* zdata = data + input_length + 4;
 
     data[0] = 'e';
     data[1] = 'd';
     data[2] = 'z';
     data[3] = crypt_params->type;
-    if (thtk_io_read(input, data + 4, input_length, error) != (ssize_t)input_length)
+    if (thtk_io_read(input, data + 4, input_length, error) != (ssize_t)input_length) {
+        free(data);
         return -1;
+    }
 
+    THDAT_PHASE(thdat, THDAT_PHASE_DECRYPT);
     th_encrypt(data + 4, input_length, crypt_params->key, crypt_params->step, crypt_params->block, crypt_params->limit);
 
-    thtk_io_t* data_stream = thtk_io_open_memory(data, entry->size, error);
-    if (!data_stream)
-        return -1;
+    THDAT_PHASE(thdat, THDAT_PHASE_DECOMPRESS);
+    entry->zsize = th_lzss_mem(data, input_length + 4, zdata);
 
-    thtk_io_t* zdata_stream = thtk_io_open_growing_memory(error);
-    if (!zdata_stream)
-        return -1;
-    entry->zsize = th_lzss(data_stream, entry->size, zdata_stream, error);
-    thtk_io_close(data_stream);
-    if (entry->zsize == -1)
-        return -1;
-    unsigned char* zdata = thtk_io_map(zdata_stream, 0, entry->zsize, error);
-    if (!zdata)
-        return -1;
+    THDAT_PHASE(thdat, THDAT_PHASE_WRITE);
+    entry->offset = thdat_reserve(thdat, entry->zsize);
 
-#pragma omp critical
-    {
-        /* TODO: Handle error. */
-        thtk_io_write(thdat->stream, zdata, entry->zsize, error);
-        entry->offset = thdat->offset;
-        thdat->offset += entry->zsize;
-    }
+    int failed = (thtk_io_pwrite(thdat->stream, zdata, entry->zsize, entry->offset, error) != entry->zsize);
 
-    thtk_io_unmap(zdata_stream, zdata);
-    thtk_io_close(zdata_stream);
+    free(data);
+
+    if (failed)
+        return -1;
 
     return entry->zsize;
 }
@@ -335,45 +344,34 @@ th08_close(
     /* XXX: I'm adding some padding here to satisfy pbgzmlt.
      * The games work fine without it. */
     list_size += 4;
-    buffer = malloc(list_size);
+    buffer = malloc(list_size + TH_LZSS_BOUND(list_size));
     memset(buffer, 0, list_size);
+    zbuffer = buffer + list_size;
 
     buffer_ptr = buffer;
     for (i = 0; i < thdat->entry_count; ++i) {
         thdat_entry_t* entry = &thdat->entries[i];
+        const uint32_t offset = entry->offset;
+        const uint32_t size = entry->size + 4;
         buffer_ptr = mempcpy(buffer_ptr, entry->name, strlen(entry->name) + 1);
-        buffer_ptr = mempcpy(buffer_ptr, &entry->offset, sizeof(uint32_t));
-        buffer_ptr = mempcpy(buffer_ptr, &entry->size, sizeof(uint32_t));
+        buffer_ptr = mempcpy(buffer_ptr, &offset, sizeof(uint32_t));
+        buffer_ptr = mempcpy(buffer_ptr, &size, sizeof(uint32_t));
         buffer_ptr = mempcpy(buffer_ptr, &zero, sizeof(uint32_t));
     }
 
     memcpy(buffer_ptr, &zero, sizeof(uint32_t));
 
-    thtk_io_t* buffer_stream = thtk_io_open_memory(buffer, list_size, error);
-    if (!buffer_stream)
-        return 0;
-
-    thtk_io_t* zbuffer_stream = thtk_io_open_growing_memory(error);
-    if (!zbuffer_stream)
-        return 0;
-    if ((list_zsize = th_lzss(buffer_stream, list_size, zbuffer_stream, error)) == -1)
-        return 0;
-    thtk_io_close(buffer_stream);
-    if (thtk_io_seek(zbuffer_stream, 0, SEEK_SET, error) == -1)
-        return 0;
-
-    zbuffer = malloc(list_zsize);
-    if (thtk_io_read(zbuffer_stream, zbuffer, list_zsize, error) == -1)
-        return 0;
-    thtk_io_close(zbuffer_stream);
+    list_zsize = th_lzss_mem_parallel(buffer, list_size, zbuffer);
 
+    THDAT_PHASE(thdat, THDAT_PHASE_DECRYPT);
     th_encrypt(zbuffer, list_zsize, 0x3e, 0x9b, 0x80, 0x400);
 
+    THDAT_PHASE(thdat, THDAT_PHASE_WRITE);
     if (thtk_io_write(thdat->stream, zbuffer, list_zsize, error) == -1) {
-        free(zbuffer);
+        free(buffer);
         return 0;
     }
-    free(zbuffer);
+    free(buffer);
 
     header[0] = 0x5a474250; /* ZGBP */
     header[1] = thdat->entry_count + 123456;
@@ -398,5 +396,7 @@ const thdat_module_t archive_th08 = {
     th08_create,
     th08_close,
     th08_read,
-    th08_write
+    th08_write,
+    NULL,
+    th08_probe
 };
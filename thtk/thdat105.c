@@ -100,29 +100,39 @@ static ssize_t
 th105_read(
     thdat_t* thdat,
     int entry_index,
-    thtk_io_t* output,
+    unsigned char* data,
     thtk_error_t** error)
 {
     thdat_entry_t* entry = thdat->entries + entry_index;
-    unsigned char* data = malloc(entry->size);
 
-    int failed = 0;
-#pragma omp critical
-    {
-        failed = (thtk_io_seek(thdat->stream, entry->offset, SEEK_SET, error) == -1) ||
-                 (thtk_io_read(thdat->stream, data, entry->size, error) != entry->size);
-    }
-
-    if (failed)
+    if (thtk_io_pread(thdat->stream, data, entry->size, entry->offset, error) != entry->size)
         return -1;
 
+    THDAT_PHASE(thdat, THDAT_PHASE_DECRYPT);
     th105_decrypt_data(thdat, entry, data);
 
-    if (thtk_io_write(output, data, entry->size, error) == -1)
+    return entry->size;
+}
+
+static ssize_t
+th105_read_range(
+    thdat_t* thdat,
+    int entry_index,
+    unsigned char* data,
+    size_t offset,
+    size_t count,
+    thtk_error_t** error)
+{
+    thdat_entry_t* entry = thdat->entries + entry_index;
+
+    if (thtk_io_pread(thdat->stream, data, count, entry->offset + offset, error) != (ssize_t)count)
         return -1;
 
-    free(data);
-    return 1;
+    /* Every byte of an entry uses the same key. */
+    THDAT_PHASE(thdat, THDAT_PHASE_DECRYPT);
+    th_crypt105_file(data, count, entry->offset);
+
+    return count;
 }
 
 static int
@@ -151,7 +161,7 @@ th105_encrypt_data(
     thdat_entry_t* entry,
     unsigned char* data)
 {
-    th_crypt105_file(data, entry->size, archive->offset);
+    th_crypt105_file(data, entry->size, entry->offset);
 }
 
 static ssize_t
@@ -173,17 +183,14 @@ th105_write(
     if (ret != entry->size)
         return -1;
 
+    /* The key depends on the offset, so it has to be known first. */
+    entry->offset = thdat_reserve(thdat, entry->size);
+
+    THDAT_PHASE(thdat, THDAT_PHASE_DECRYPT);
     th105_encrypt_data(thdat, entry, data);
 
-    int failed = 0;
-#pragma omp critical
-    {
-        failed = (thtk_io_write(thdat->stream, data, entry->size, error) != entry->size);
-        if (!failed) {
-            entry->offset = thdat->offset;
-            thdat->offset += entry->size;
-        }
-    }
+    THDAT_PHASE(thdat, THDAT_PHASE_WRITE);
+    int failed = (thtk_io_pwrite(thdat->stream, data, entry->size, entry->offset, error) != entry->size);
 
     free(data);
 
@@ -193,6 +200,20 @@ th105_write(
     return entry->size;
 }
 
+static void
+th105_rekey(
+    thdat_t* thdat,
+    int entry_index,
+    off_t old_offset,
+    unsigned char* data,
+    size_t count)
+{
+    /* The key only depends on the offset, so undoing the old one and applying
+     * the new one works on any part of the entry. */
+    th_crypt105_file(data, count, old_offset);
+    th_crypt105_file(data, count, thdat->entries[entry_index].offset);
+}
+
 static int
 th105_close(
     thdat_t* thdat,
@@ -227,8 +248,10 @@ th105_close(
         buffer_ptr = mempcpy(buffer_ptr, entry->name, namelen);
     }
 
+    THDAT_PHASE(thdat, THDAT_PHASE_DECRYPT);
     th_crypt105_list(buffer, header_size, 0xc5, 0x83, 0x53);
 
+    THDAT_PHASE(thdat, THDAT_PHASE_WRITE);
     if (thtk_io_seek(thdat->stream, 0, SEEK_SET, error) == -1)
         return 0;
 
@@ -245,10 +268,13 @@ th105_close(
 }
 
 const thdat_module_t archive_th105 = {
-    0,
+    THDAT_STORED,
     th105_open,
     th105_create,
     th105_close,
     th105_read,
-    th105_write
+    th105_write,
+    th105_read_range,
+    NULL,
+    th105_rekey
 };
@@ -125,78 +125,126 @@ th95_open(
     return 1;
 }
 
-static void
-th95_decrypt_data(
-    thdat_t* archive,
-    thdat_entry_t* entry,
-    unsigned char* data)
+static const crypt_params_t*
+th95_get_crypt_params(
+    unsigned int version,
+    const thdat_entry_t* entry)
 {
     const unsigned int i = th95_get_crypt_param_index(entry->name);
     const crypt_params_t* crypt_params;
-    if (archive->version == 95 || archive->version == 10 || archive->version == 103 || archive->version == 11) {
+    if (version == 95 || version == 10 || version == 103 || version == 11) {
         crypt_params = th95_crypt_params;
-    } else if (archive->version == 12 || archive->version == 125 || archive->version == 128) {
+    } else if (version == 12 || version == 125 || version == 128) {
         crypt_params = th12_crypt_params;
-    } else if (archive->version == 13) {
+    } else if (version == 13) {
         crypt_params = th13_crypt_params;
     } else {
         crypt_params = th14_crypt_params;
     }
+    return &crypt_params[i];
+}
 
-    th_decrypt(data, entry->zsize, crypt_params[i].key, crypt_params[i].step,
-        crypt_params[i].block, crypt_params[i].limit);
+static void
+th95_decrypt_data(
+    thdat_t* archive,
+    thdat_entry_t* entry,
+    unsigned char* data)
+{
+    const crypt_params_t* crypt_params = th95_get_crypt_params(archive->version, entry);
+
+    th_decrypt(data, entry->zsize, crypt_params->key, crypt_params->step,
+        crypt_params->block, crypt_params->limit);
 }
 
 static ssize_t
 th95_read(
     thdat_t* thdat,
     int entry_index,
-    thtk_io_t* output,
+    unsigned char* data,
     thtk_error_t** error)
 {
     thdat_entry_t* entry = &thdat->entries[entry_index];
-    unsigned char* data;
-    unsigned char* zdata = malloc(entry->zsize);
+    /* Stored entries are read straight into the output. */
+    unsigned char* zdata = entry->zsize == entry->size ? data : malloc(entry->zsize);
 
-    int failed = 0;
-#pragma omp critical
-    {
-        failed = (thtk_io_seek(thdat->stream, entry->offset, SEEK_SET, error) == -1) ||
-                 (thtk_io_read(thdat->stream, zdata, entry->zsize, error) != entry->zsize);
-    }
-
-    if (failed)
+    if (thtk_io_pread(thdat->stream, zdata, entry->zsize, entry->offset, error) != entry->zsize) {
+        if (zdata != data)
+            free(zdata);
         return -1;
+    }
 
+    THDAT_PHASE(thdat, THDAT_PHASE_DECRYPT);
     th95_decrypt_data(thdat, entry, zdata);
 
-    if (entry->zsize == entry->size) {
-        data = zdata;
-    } else {
-        thtk_io_t* zdata_stream = thtk_io_open_memory(zdata, entry->zsize, error);
-        if (!zdata_stream)
-            return -1;
-        thtk_io_t* data_stream = thtk_io_open_growing_memory(error);
-        if (!data_stream)
-            return -1;
-        if (th_unlzss(zdata_stream, data_stream, entry->size, error) == -1)
-            return -1;
-        thtk_io_close(zdata_stream);
+    if (zdata == data)
+        return entry->size;
 
-        if (thtk_io_seek(data_stream, 0, SEEK_SET, error) == -1)
-            return -1;
-        data = malloc(entry->size);
-        if (thtk_io_read(data_stream, data, entry->size, error) != entry->size)
-            return -1;
-        thtk_io_close(data_stream);
+    THDAT_PHASE(thdat, THDAT_PHASE_DECOMPRESS);
+    ssize_t ret = th_unlzss_mem(zdata, entry->zsize, data, entry->size);
+    free(zdata);
+
+    return ret;
+}
+
+static ssize_t
+th95_read_range(
+    thdat_t* thdat,
+    int entry_index,
+    unsigned char* data,
+    size_t offset,
+    size_t count,
+    thtk_error_t** error)
+{
+    thdat_entry_t* entry = &thdat->entries[entry_index];
+    const crypt_params_t* crypt_params = th95_get_crypt_params(thdat->version, entry);
+    /* Only the start of the data is encrypted. */
+    const size_t crypt_end = th_crypt_extent(entry->zsize, crypt_params->block, crypt_params->limit);
+    const int stored = entry->zsize == entry->size;
+    th_unlzss_index_t* index = NULL;
+    size_t input_start = offset;
+    size_t input_end = offset + count;
+
+    if (!stored) {
+        input_start = 0;
+        input_end = entry->zsize;
+        index = THTK_ATOMIC_LOAD_PTR(&entry->lzss_index);
+        if (index)
+            th_unlzss_index_input(index, entry->zsize, offset, count, &input_start, &input_end);
+    }
+
+    /* Decryption needs the whole encrypted part. */
+    if (input_start < crypt_end) {
+        input_start = 0;
+        if (input_end < crypt_end)
+            input_end = crypt_end;
     }
 
-    if (thtk_io_write(output, data, entry->size, error) == -1)
+    unsigned char* zdata = malloc(input_end - input_start + 1);
+    if (input_end > input_start &&
+        thtk_io_pread(thdat->stream, zdata, input_end - input_start,
+            entry->offset + input_start, error) != (ssize_t)(input_end - input_start)) {
+        free(zdata);
         return -1;
+    }
 
-    free(data);
+    THDAT_PHASE(thdat, THDAT_PHASE_DECRYPT);
+    if (input_start == 0)
+        th95_decrypt_data(thdat, entry, zdata);
 
-    return 1;
+    THDAT_PHASE(thdat, THDAT_PHASE_DECOMPRESS);
+    ssize_t ret;
+    if (stored) {
+        memcpy(data, zdata + (offset - input_start), count);
+        ret = count;
+    } else {
+        if (!index)
+            index = thdat_entry_lzss_index(entry, zdata);
+        ret = th_unlzss_index_read(index, zdata, input_start, input_end, data, offset, count);
+    }
+
+    free(zdata);
+
+    return ret;
 }
 
 static int
@@ -256,6 +304,7 @@ th95_write(
     thtk_io_t* data_stream = thtk_io_open_growing_memory(error);
     if (!data_stream)
         return -1;
+    THDAT_PHASE(thdat, THDAT_PHASE_DECOMPRESS);
     if ((entry->zsize = th_lzss(input, entry->size, data_stream, error)) == -1)
         return -1;
 
@@ -279,17 +328,13 @@ th95_write(
         thtk_io_close(data_stream);
     }
 
+    THDAT_PHASE(thdat, THDAT_PHASE_DECRYPT);
     th95_encrypt_data(thdat, entry, data);
 
-    int failed = 0;
-#pragma omp critical
-    {
-        failed = (thtk_io_write(thdat->stream, data, entry->zsize, error) != entry->zsize);
-        if (!failed) {
-            entry->offset = thdat->offset;
-            thdat->offset += entry->zsize;
-        }
-    }
+    THDAT_PHASE(thdat, THDAT_PHASE_WRITE);
+    entry->offset = thdat_reserve(thdat, entry->zsize);
+
+    int failed = (thtk_io_pwrite(thdat->stream, data, entry->zsize, entry->offset, error) != entry->zsize);
 
     free(data);
 
@@ -321,7 +366,8 @@ th95_close(
         return 0;
     }
 
-    buffer = malloc(list_size);
+    buffer = malloc(list_size + TH_LZSS_BOUND(list_size));
+    zbuffer = buffer + list_size;
 
     uint32_t* buffer_ptr = (uint32_t*)buffer;
     for (i = 0; i < thdat->entry_count; ++i) {
@@ -334,31 +380,17 @@ th95_close(
         *buffer_ptr++ = 0;
     }
 
-    thtk_io_t* buffer_stream = thtk_io_open_memory(buffer, list_size, error);
-    if (!buffer_stream)
-        return 0;
-    thtk_io_t* zbuffer_stream = thtk_io_open_growing_memory(error);
-    if (!zbuffer_stream)
-        return 0;
-
-    if ((list_zsize = th_lzss(buffer_stream, list_size, zbuffer_stream, error)) == -1)
-        return 0;
-
-    thtk_io_close(buffer_stream);
-    zbuffer = malloc(list_zsize);
-    if (thtk_io_seek(zbuffer_stream, 0, SEEK_SET, error) == -1)
-        return 0;
-    if (thtk_io_read(zbuffer_stream, zbuffer, list_zsize, error) == -1)
-        return 0;
-    thtk_io_close(zbuffer_stream);
+    list_zsize = th_lzss_mem_parallel(buffer, list_size, zbuffer);
 
+    THDAT_PHASE(thdat, THDAT_PHASE_DECRYPT);
     th_encrypt(zbuffer, list_zsize, 0x3e, 0x9b, 0x80, list_size);
 
+    THDAT_PHASE(thdat, THDAT_PHASE_WRITE);
     if (thtk_io_write(thdat->stream, zbuffer, list_zsize, error) == -1) {
-        free(zbuffer);
+        free(buffer);
         return 0;
     }
-    free(zbuffer);
+    free(buffer);
 
     if (thtk_io_seek(thdat->stream, 0, SEEK_SET, error) == -1)
         return 0;
@@ -377,11 +409,54 @@ th95_close(
     return 1;
 }
 
+/* Decrypting with the wrong keys leaves LZSS data that almost never decodes to
+ * exactly the entry's size while ending where the stored data does. */
+static int
+th95_probe(
+    thdat_t* thdat,
+    int entry_index,
+    unsigned int version)
+{
+    thdat_entry_t* entry = &thdat->entries[entry_index];
+    const crypt_params_t* crypt_params = th95_get_crypt_params(version, entry);
+    unsigned char* zdata = malloc(entry->zsize);
+    int plausible = 1;
+
+    if (thtk_io_pread(thdat->stream, zdata, entry->zsize, entry->offset, NULL) != entry->zsize) {
+        free(zdata);
+        return 1;
+    }
+
+    th_decrypt(zdata, entry->zsize, crypt_params->key, crypt_params->step,
+        crypt_params->block, crypt_params->limit);
+
+    if (entry->zsize == entry->size) {
+        plausible = thdat_plausible_magic(entry->name, zdata, entry->size);
+    } else {
+        /* One byte more than the entry's size to see whether it stops. */
+        unsigned char* data = malloc(entry->size + 1);
+        th_unlzss_state_t* state = malloc(sizeof(*state));
+        th_unlzss_init(state);
+        const size_t size = th_unlzss_run(state, zdata, 0, entry->zsize, data, entry->size + 1);
+        plausible = size == (size_t)entry->size &&
+            state->in_pos + 2 >= (size_t)entry->zsize &&
+            state->in_pos <= (size_t)entry->zsize + 2 &&
+            thdat_plausible_magic(entry->name, data, size);
+        free(state);
+        free(data);
+    }
+
+    free(zdata);
+    return plausible;
+}
+
 const thdat_module_t archive_th95 = {
     THDAT_BASENAME,
     th95_open,
     th95_create,
     th95_close,
     th95_read,
-    th95_write
+    th95_write,
+    th95_read_range,
+    th95_probe
 };
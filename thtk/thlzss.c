@@ -34,6 +34,7 @@
 #include <thtk/thtk.h>
 
 #include "bits.h"
+#include "thlzss.h"
 
 /* Compression specification:
  *
@@ -51,7 +52,7 @@
  * zero-size entry is used to terminate the data.  This information is only
  * verified for TH10 and TH11. */
 
-#define LZSS_DICTSIZE      0x2000
+#define LZSS_DICTSIZE      TH_LZSS_DICTSIZE
 #define LZSS_DICTSIZE_MASK 0x1fff
 #define LZSS_MIN_MATCH 3
 /* LZSS_MIN_MATCH + 4 bits. */
@@ -111,42 +112,53 @@ list_add(
     hash->hash[key] = offset;
 }
 
-ssize_t
-th_lzss(
-    thtk_io_t* input,
+/* Bits written MSB first to a buffer known to be large enough. */
+typedef struct {
+    unsigned char* data;
+    size_t pos;
+    uint32_t acc;
+    unsigned int bits;
+} lzss_writer_t;
+
+static inline void
+lzss_put(
+    lzss_writer_t* w,
+    unsigned int bits,
+    uint32_t data)
+{
+    w->acc = (w->acc << bits) | data;
+    w->bits += bits;
+    while (w->bits >= 8) {
+        w->bits -= 8;
+        w->data[w->pos++] = w->acc >> w->bits;
+    }
+}
+
+/* Compresses input as if it started position bytes into a larger input,
+ * without the end marker.  Matches only refer to input itself, so the output
+ * can follow that of the preceding bytes whether or not they were compressed
+ * in the same call. */
+static void
+th_lzss_part(
+    const unsigned char* input,
     size_t input_size,
-    thtk_io_t* output,
-    thtk_error_t** error)
+    size_t position,
+    lzss_writer_t* w)
 {
-    struct bitstream bs;
-    hash_t hash;
+    hash_t* hash = malloc(sizeof(*hash));
     unsigned char dict[LZSS_DICTSIZE];
-    unsigned int dict_head = 1;
+    unsigned int dict_head = (1 + position) & LZSS_DICTSIZE_MASK;
     unsigned int dict_head_key;
     unsigned int waiting_bytes = 0;
     size_t bytes_read = 0;
     unsigned int i;
-    unsigned char c;
-
-    if (!input || !output) {
-        thtk_error_new(error, "input or output is NULL");
-        return -1;
-    }
 
-    bitstream_init(&bs, output);
-    memset(&hash, 0, sizeof(hash));
+    memset(hash, 0, sizeof(*hash));
     memset(dict, 0, sizeof(dict));
 
     /* Fill the forward-looking buffer. */
     for (i = 0; i < LZSS_MAX_MATCH && i < input_size; ++i) {
-        int ret = thtk_io_read(input, &c, 1, error);
-        if (ret == -1) {
-            return -1;
-        } else if (ret != 1) {
-            break;
-        }
-        ++bytes_read;
-        dict[dict_head + i] = c;
+        dict[(dict_head + i) & LZSS_DICTSIZE_MASK] = input[bytes_read++];
         waiting_bytes++;
     }
 
@@ -158,9 +170,9 @@ th_lzss(
         unsigned int offset;
 
         /* Find a good match. */
-        for (offset = hash.hash[dict_head_key];
+        for (offset = hash->hash[dict_head_key];
              offset != HASH_NULL && waiting_bytes > match_len;
-             offset = hash.next[offset]) {
+             offset = hash->next[offset]) {
             /* First check a character further ahead to see if this match can
              * be any longer than the current match. */
             if (dict[(dict_head + match_len) & LZSS_DICTSIZE_MASK] ==
@@ -191,12 +203,10 @@ th_lzss(
         /* Write data to the output buffer. */
         if (match_len < LZSS_MIN_MATCH) {
             match_len = 1;
-            bitstream_write1(&bs, 1);
-            bitstream_write(&bs, 8, dict[dict_head]);
+            lzss_put(w, 9, 0x100 | dict[dict_head]);
         } else {
-            bitstream_write1(&bs, 0);
-            bitstream_write(&bs, 13, match_offset);
-            bitstream_write(&bs, 4, match_len - LZSS_MIN_MATCH);
+            lzss_put(w, 1 + 13, match_offset);
+            lzss_put(w, 4, match_len - LZSS_MIN_MATCH);
         }
 
         /* Add bytes to the dictionary. */
@@ -205,36 +215,142 @@ th_lzss(
                 (dict_head + LZSS_MAX_MATCH) & LZSS_DICTSIZE_MASK;
 
             if (offset != HASH_NULL)
-                list_remove(&hash, generate_key(dict, offset), offset);
+                list_remove(hash, generate_key(dict, offset), offset);
             if (dict_head != HASH_NULL)
-                list_add(&hash, dict_head_key, dict_head);
-
-            if (bytes_read < input_size) {
-                int ret = thtk_io_read(input, &c, 1, error);
-                if (ret == 1) {
-                    dict[offset] = c;
-                    ++bytes_read;
-                } else if (ret == 0) {
-                    --waiting_bytes;
-                } else {
-                    return -1;
-                }
-            } else {
+                list_add(hash, dict_head_key, dict_head);
+
+            if (bytes_read < input_size)
+                dict[offset] = input[bytes_read++];
+            else
                 --waiting_bytes;
-            }
 
             dict_head = (dict_head + 1) & LZSS_DICTSIZE_MASK;
             dict_head_key = generate_key(dict, dict_head);
         }
     }
 
-    bitstream_write1(&bs, 0);
-    bitstream_write(&bs, 13, HASH_NULL);
-    bitstream_write(&bs, 4, 0); /* TODO: this might be unnescessary */
+    free(hash);
+}
+
+static size_t
+th_lzss_end(
+    lzss_writer_t* w)
+{
+    lzss_put(w, 1 + 13, HASH_NULL);
+    lzss_put(w, 4, 0); /* TODO: this might be unnescessary */
+
+    if (w->bits)
+        lzss_put(w, 8 - w->bits, 0);
+
+    return w->pos;
+}
+
+size_t
+th_lzss_mem(
+    const unsigned char* input,
+    size_t input_size,
+    unsigned char* output)
+{
+    lzss_writer_t w = { output, 0, 0, 0 };
+
+    th_lzss_part(input, input_size, 0, &w);
+
+    return th_lzss_end(&w);
+}
+
+typedef struct {
+    const unsigned char* input;
+    size_t input_size;
+    unsigned char* scratch;
+    lzss_writer_t* parts;
+} lzss_parallel_t;
+
+static void
+th_lzss_part_task(
+    void* arg,
+    size_t index)
+{
+    lzss_parallel_t* run = arg;
+    const size_t position = index * TH_LZSS_PART_SIZE;
+    size_t size = run->input_size - position;
+    lzss_writer_t* w = &run->parts[index];
+
+    if (size > TH_LZSS_PART_SIZE)
+        size = TH_LZSS_PART_SIZE;
+
+    w->data = run->scratch + TH_LZSS_BOUND(TH_LZSS_PART_SIZE) * index;
+    th_lzss_part(run->input + position, size, position, w);
+}
+
+size_t
+th_lzss_mem_parallel(
+    const unsigned char* input,
+    size_t input_size,
+    unsigned char* output)
+{
+    const size_t count =
+        (input_size + TH_LZSS_PART_SIZE - 1) / TH_LZSS_PART_SIZE;
+    lzss_writer_t w = { output, 0, 0, 0 };
+    lzss_parallel_t run;
+    size_t i, j;
+
+    if (count <= 1)
+        return th_lzss_mem(input, input_size, output);
+
+    run.input = input;
+    run.input_size = input_size;
+    run.scratch = malloc(TH_LZSS_BOUND(TH_LZSS_PART_SIZE) * count);
+    run.parts = calloc(count, sizeof(*run.parts));
+
+    thtk_parallel_for(count, th_lzss_part_task, &run);
+
+    /* The parts rarely end on a byte boundary, so they are joined bit by
+     * bit rather than copied. */
+    for (i = 0; i < count; ++i) {
+        const lzss_writer_t* part = &run.parts[i];
+        for (j = 0; j < part->pos; ++j)
+            lzss_put(&w, 8, part->data[j]);
+        if (part->bits)
+            lzss_put(&w, part->bits, part->acc & ((1u << part->bits) - 1));
+    }
+
+    free(run.parts);
+    free(run.scratch);
+
+    return th_lzss_end(&w);
+}
+
+ssize_t
+th_lzss(
+    thtk_io_t* input,
+    size_t input_size,
+    thtk_io_t* output,
+    thtk_error_t** error)
+{
+    if (!input || !output) {
+        thtk_error_new(error, "input or output is NULL");
+        return -1;
+    }
+
+    unsigned char* data = malloc(input_size + TH_LZSS_BOUND(input_size));
+    unsigned char* zdata = data + input_size;
+
+    /* Input shorter than input_size is compressed as far as it goes. */
+    const ssize_t read = thtk_io_read(input, data, input_size, error);
+    if (read == -1) {
+        free(data);
+        return -1;
+    }
 
-    bitstream_finish(&bs);
+    const size_t zsize = th_lzss_mem(data, read, zdata);
+    if (thtk_io_write(output, zdata, zsize, error) != (ssize_t)zsize) {
+        free(data);
+        return -1;
+    }
 
-    return bs.byte_count;
+    free(data);
+
+    return zsize;
 }
 
 ssize_t
@@ -287,3 +403,195 @@ th_unlzss(
 
     return bytes_written;
 }
+
+void
+th_unlzss_init(
+    th_unlzss_state_t* state)
+{
+    memset(state->dict, 0, sizeof(state->dict));
+    state->dict_head = 1;
+    state->in_pos = 0;
+    state->byte = 0;
+    state->bits = 0;
+    state->match_offset = 0;
+    state->match_left = 0;
+    state->out_pos = 0;
+    state->done = 0;
+}
+
+size_t
+th_unlzss_run(
+    th_unlzss_state_t* state,
+    const unsigned char* input,
+    size_t input_start,
+    size_t input_end,
+    unsigned char* output,
+    size_t output_size)
+{
+    unsigned char* dict = state->dict;
+    unsigned int dict_head = state->dict_head;
+    size_t in_pos = state->in_pos;
+    unsigned int byte = state->byte;
+    unsigned int bits = state->bits;
+    size_t bytes_written = 0;
+    unsigned int i;
+
+/* Past the end of the input only zero bits are read, which decodes as the end
+ * marker. */
+#define READ_BITS(ret, count) \
+    do { \
+        (ret) = 0; \
+        for (i = 0; i < (count); ++i) { \
+            if (!bits) { \
+                byte = in_pos >= input_start && in_pos < input_end ? \
+                    input[in_pos - input_start] : 0; \
+                ++in_pos; \
+                bits = 8; \
+            } \
+            (ret) = ((ret) << 1) | ((byte >> 7) & 1); \
+            byte <<= 1; \
+            --bits; \
+        } \
+    } while (0)
+
+    while (bytes_written < output_size && !state->done) {
+        if (state->match_left) {
+            unsigned int match_len = state->match_left;
+            if (match_len > output_size - bytes_written)
+                match_len = output_size - bytes_written;
+            for (i = 0; i < match_len; ++i) {
+                const unsigned char c = dict[state->match_offset];
+                state->match_offset = (state->match_offset + 1) & LZSS_DICTSIZE_MASK;
+                if (output)
+                    output[bytes_written] = c;
+                ++bytes_written;
+                dict[dict_head] = c;
+                dict_head = (dict_head + 1) & LZSS_DICTSIZE_MASK;
+            }
+            state->match_left -= match_len;
+            continue;
+        }
+
+        unsigned int flag;
+        READ_BITS(flag, 1);
+        if (flag) {
+            unsigned int c;
+            READ_BITS(c, 8);
+            if (output)
+                output[bytes_written] = c;
+            ++bytes_written;
+            dict[dict_head] = c;
+            dict_head = (dict_head + 1) & LZSS_DICTSIZE_MASK;
+        } else {
+            unsigned int match_offset;
+            unsigned int match_len;
+            READ_BITS(match_offset, 13);
+            if (!match_offset) {
+                state->done = 1;
+                break;
+            }
+            READ_BITS(match_len, 4);
+            state->match_offset = match_offset;
+            state->match_left = match_len + LZSS_MIN_MATCH;
+        }
+    }
+
+#undef READ_BITS
+
+    state->dict_head = dict_head;
+    state->in_pos = in_pos;
+    state->byte = byte;
+    state->bits = bits;
+    state->out_pos += bytes_written;
+    return bytes_written;
+}
+
+size_t
+th_unlzss_mem(
+    const unsigned char* input,
+    size_t input_size,
+    unsigned char* output,
+    size_t output_size)
+{
+    th_unlzss_state_t state;
+    th_unlzss_init(&state);
+    return th_unlzss_run(&state, input, 0, input_size, output, output_size);
+}
+
+th_unlzss_index_t*
+th_unlzss_index_new(
+    const unsigned char* input,
+    size_t input_size,
+    size_t output_size,
+    size_t interval)
+{
+    th_unlzss_index_t* index = malloc(sizeof(*index));
+    th_unlzss_state_t state;
+
+    index->interval = interval;
+    index->count = output_size / interval + 1;
+    index->states = malloc(index->count * sizeof(*index->states));
+
+    th_unlzss_init(&state);
+    for (size_t i = 0; i < index->count; ++i) {
+        index->states[i] = state;
+        if (th_unlzss_run(&state, input, 0, input_size, NULL, interval) < interval) {
+            index->count = i + 1;
+            break;
+        }
+    }
+
+    return index;
+}
+
+void
+th_unlzss_index_free(
+    th_unlzss_index_t* index)
+{
+    if (index) {
+        free(index->states);
+        free(index);
+    }
+}
+
+void
+th_unlzss_index_input(
+    const th_unlzss_index_t* index,
+    size_t input_size,
+    size_t offset,
+    size_t count,
+    size_t* input_start,
+    size_t* input_end)
+{
+    size_t first = offset / index->interval;
+    size_t last = (offset + count + index->interval - 1) / index->interval;
+    if (first >= index->count)
+        first = index->count - 1;
+    *input_start = index->states[first].in_pos;
+    /* The state at a point has consumed exactly the input needed to get
+     * there. */
+    *input_end = last < index->count ? index->states[last].in_pos : input_size;
+    if (*input_end > input_size)
+        *input_end = input_size;
+}
+
+size_t
+th_unlzss_index_read(
+    const th_unlzss_index_t* index,
+    const unsigned char* input,
+    size_t input_start,
+    size_t input_end,
+    unsigned char* output,
+    size_t offset,
+    size_t count)
+{
+    size_t first = offset / index->interval;
+    if (first >= index->count)
+        first = index->count - 1;
+
+    th_unlzss_state_t state = index->states[first];
+    const size_t skip = offset - state.out_pos;
+    if (th_unlzss_run(&state, input, input_start, input_end, NULL, skip) < skip)
+        return 0;
+    return th_unlzss_run(&state, input, input_start, input_end, output, count);
+}
@@ -35,6 +35,28 @@
 #endif
 #include <thtk/thtk.h>
 
+/* The most bytes th_lzss_mem can produce for size input bytes: nine bits for
+ * every byte plus the end marker. */
+#define TH_LZSS_BOUND(size) ((size) + (size) / 8 + 4)
+
+/* Compresses a buffer into output, which must hold at least
+ * TH_LZSS_BOUND(input_size) bytes, and returns the compressed size. */
+size_t th_lzss_mem(
+    const unsigned char* input,
+    size_t input_size,
+    unsigned char* output);
+
+/* Inputs are split into parts of this many bytes for th_lzss_mem_parallel. */
+#define TH_LZSS_PART_SIZE 0x10000
+
+/* Like th_lzss_mem, but compresses each part of the input on the thread pool.
+ * Matches don't reach across parts, so the output is a little larger than
+ * th_lzss_mem's, and the same for inputs that fit in one part. */
+size_t th_lzss_mem_parallel(
+    const unsigned char* input,
+    size_t input_size,
+    unsigned char* output);
+
 ssize_t th_lzss(
     thtk_io_t* input,
     size_t input_size,
@@ -47,4 +69,85 @@ ssize_t th_unlzss(
     size_t output_size,
     thtk_error_t** error);
 
+/* Decompresses from one buffer into another.  Stops after output_size bytes,
+ * at the end marker, or when the input runs out, and returns the number of
+ * bytes written. */
+size_t th_unlzss_mem(
+    const unsigned char* input,
+    size_t input_size,
+    unsigned char* output,
+    size_t output_size);
+
+#define TH_LZSS_DICTSIZE 0x2000
+
+/* Everything needed to resume decompression at some point in the output. */
+typedef struct {
+    unsigned char dict[TH_LZSS_DICTSIZE];
+    unsigned int dict_head;
+    /* Input bytes consumed so far, and the bits left of the last one. */
+    size_t in_pos;
+    unsigned int byte;
+    unsigned int bits;
+    /* A match which has not been fully written yet. */
+    unsigned int match_offset;
+    unsigned int match_left;
+    /* Output bytes produced so far. */
+    size_t out_pos;
+    int done;
+} th_unlzss_state_t;
+
+void th_unlzss_init(
+    th_unlzss_state_t* state);
+
+/* Continues decompression, producing at most output_size bytes.  input points
+ * to the input byte at offset input_start, and input_end is the offset after
+ * the last available byte.  Output is discarded if output is NULL.  Returns
+ * the number of bytes produced, which is less than output_size only at the
+ * end of the data. */
+size_t th_unlzss_run(
+    th_unlzss_state_t* state,
+    const unsigned char* input,
+    size_t input_start,
+    size_t input_end,
+    unsigned char* output,
+    size_t output_size);
+
+/* Decoder states recorded at regular intervals of the output, so that reads
+ * of a range only have to decompress from the closest one. */
+typedef struct th_unlzss_index_t {
+    size_t interval;
+    size_t count;
+    th_unlzss_state_t* states;
+} th_unlzss_index_t;
+
+th_unlzss_index_t* th_unlzss_index_new(
+    const unsigned char* input,
+    size_t input_size,
+    size_t output_size,
+    size_t interval);
+
+void th_unlzss_index_free(
+    th_unlzss_index_t* index);
+
+/* Decompresses count bytes starting at offset in the output, using the index.
+ * input and input_start work as for th_unlzss_run, and th_unlzss_index_input
+ * gives the input range that is needed.  Returns the number of bytes
+ * written. */
+size_t th_unlzss_index_read(
+    const th_unlzss_index_t* index,
+    const unsigned char* input,
+    size_t input_start,
+    size_t input_end,
+    unsigned char* output,
+    size_t offset,
+    size_t count);
+
+void th_unlzss_index_input(
+    const th_unlzss_index_t* index,
+    size_t input_size,
+    size_t offset,
+    size_t count,
+    size_t* input_start,
+    size_t* input_end);
+
 #endif
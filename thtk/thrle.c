@@ -28,12 +28,190 @@
  */
 #include <config.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <thtk/thtk.h>
 #include "thrle.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define THRLE_SSE2
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+static unsigned int
+rle_ctz(
+    unsigned int x)
+{
+#ifdef _MSC_VER
+    unsigned long i;
+    _BitScanForward(&i, x);
+    return i;
+#else
+    return __builtin_ctz(x);
+#endif
+}
+#endif
+
+/* Format specification:
+ * Bytes are stored as they are, except that two equal bytes in a row are
+ * followed by a count of how many more times the byte is repeated, 0 to 255.
+ * A longer run continues with another copy of the byte, which pairs with the
+ * last one, and another count. */
+
+/* Returns the offset of the first byte in p that is equal to the next one, or
+ * size if there is none. */
+static size_t
+rle_find_pair(
+    const unsigned char* p,
+    size_t size)
+{
+    size_t i = 0;
+#ifdef THRLE_SSE2
+    for (; i + 17 <= size; i += 16) {
+        const __m128i a = _mm_loadu_si128((const __m128i*)(p + i));
+        const __m128i b = _mm_loadu_si128((const __m128i*)(p + i + 1));
+        const unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(a, b));
+        if (mask)
+            return i + rle_ctz(mask);
+    }
+#endif
+    for (; i + 1 < size; ++i) {
+        if (p[i] == p[i + 1])
+            return i;
+    }
+    return size;
+}
+
+/* Returns the number of bytes at the start of p that are equal to c. */
+static size_t
+rle_run_length(
+    const unsigned char* p,
+    size_t size,
+    unsigned char c)
+{
+    size_t i = 0;
+#ifdef THRLE_SSE2
+    const __m128i v = _mm_set1_epi8((char)c);
+    for (; i + 16 <= size; i += 16) {
+        const unsigned int mask = _mm_movemask_epi8(
+            _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + i)), v));
+        if (mask != 0xffff)
+            return i + rle_ctz(~mask);
+    }
+#endif
+    while (i < size && p[i] == c)
+        ++i;
+    return i;
+}
+
+/* An output buffer that counts what doesn't fit, or everything if it is
+ * NULL. */
+typedef struct {
+    unsigned char* data;
+    size_t size;
+    size_t written;
+} rle_output_t;
+
+static void
+rle_put(
+    rle_output_t* output,
+    const unsigned char* data,
+    size_t size)
+{
+    if (output->data && output->written < output->size) {
+        const size_t room = output->size - output->written;
+        memcpy(output->data + output->written, data, size < room ? size : room);
+    }
+    output->written += size;
+}
+
+static void
+rle_fill(
+    rle_output_t* output,
+    unsigned char c,
+    size_t count)
+{
+    if (output->data && output->written < output->size) {
+        const size_t room = output->size - output->written;
+        memset(output->data + output->written, c, count < room ? count : room);
+    }
+    output->written += count;
+}
+
+size_t
+thtk_rle_mem(
+    const unsigned char* input,
+    size_t input_size,
+    unsigned char* output,
+    size_t output_size)
+{
+    rle_output_t out = { output, output_size, 0 };
+    size_t r = 0;
+
+    while (r < input_size) {
+        const size_t literals = rle_find_pair(input + r, input_size - r);
+        rle_put(&out, input + r, literals);
+        r += literals;
+        if (r == input_size)
+            break;
+
+        const unsigned char c = input[r];
+        size_t rest = rle_run_length(input + r + 2, input_size - r - 2, c);
+        r += 2 + rest;
+
+        unsigned char run[3] = { c, c, rest < 0xff ? rest : 0xff };
+        rle_put(&out, run, 3);
+        rest -= run[2];
+        while (rest) {
+            --rest;
+            run[2] = rest < 0xff ? rest : 0xff;
+            rle_put(&out, run + 1, 2);
+            rest -= run[2];
+        }
+    }
+
+    return out.written;
+}
+
+size_t
+thtk_unrle_mem(
+    const unsigned char* input,
+    size_t input_size,
+    unsigned char* output,
+    size_t output_size)
+{
+    rle_output_t out = { output, output_size, 0 };
+    size_t r = 0;
+    /* Whether a run was just written.  The next byte pairs with the run's
+     * byte, which comes before its count, if it is equal to it. */
+    int after_run = 0;
+
+    while (r < input_size) {
+        size_t end;
+        if (after_run && input[r] == input[r - 2]) {
+            end = r + 1;
+        } else {
+            const size_t literals = rle_find_pair(input + r, input_size - r);
+            end = literals == input_size - r ? input_size : r + literals + 2;
+        }
+        rle_put(&out, input + r, end - r);
+        if (end >= input_size)
+            break;
+
+        rle_fill(&out, input[end - 1], input[end]);
+        r = end + 1;
+        after_run = 1;
+    }
+
+    if (output && out.written > output_size)
+        return output_size;
+    return out.written;
+}
+
 ssize_t
 thtk_rle(
     thtk_io_t* input,
@@ -41,52 +219,25 @@ thtk_rle(
     thtk_io_t* output,
     thtk_error_t** error)
 {
-    size_t bytes_read = 0;
-    size_t bytes_written = 0;
-    unsigned char prevc = 0;
-    unsigned char c = 0;
-    unsigned int rl = 0;
-
     if (!input || !output) {
         thtk_error_new(error, "input or output is NULL");
         return -1;
     }
 
-    while (bytes_read < input_size) {
-        if (thtk_io_read(input, &c, 1, error) != 1)
-            return -1;
-        if (bytes_read == 0) {
-            prevc = ~c;
-        }
-        ++bytes_read;
-        if (rl) {
-            if (c != prevc || rl == 0x100) {
-                unsigned char rle[2] = { rl - 1, c };
-                if (thtk_io_write(output, rle, 2, error) != 2)
-                    return -1;
-                bytes_written += 2;
-                rl = 0;
-            }
-        } else {
-            if (thtk_io_write(output, &c, 1, error) != 1)
-                return -1;
-            ++bytes_written;
-        }
-
-        if (c == prevc)
-            ++rl;
-
-        prevc = c;
+    unsigned char* data = malloc(input_size ? input_size : 1);
+    if (thtk_io_read(input, data, input_size, error) != (ssize_t)input_size) {
+        free(data);
+        return -1;
     }
 
-    if (rl) {
-        unsigned char len = rl - 1;
-        if (thtk_io_write(output, &len, 1, error) != 1)
-            return -1;
-        ++bytes_written;
-    }
+    const size_t size = thtk_rle_mem(data, input_size, NULL, 0);
+    unsigned char* rle = malloc(size ? size : 1);
+    thtk_rle_mem(data, input_size, rle, size);
+    free(data);
 
-    return bytes_written;
+    ssize_t ret = thtk_io_write(output, rle, size, error);
+    free(rle);
+    return ret == -1 ? -1 : (ssize_t)size;
 }
 
 ssize_t
@@ -96,65 +247,23 @@ thtk_unrle(
     thtk_io_t* output,
     thtk_error_t** error)
 {
-    size_t bytes_read = 0;
-    size_t bytes_written = 0;
-    unsigned int i;
-
     if (!input || !output) {
         thtk_error_new(error, "input or output is NULL");
         return -1;
     }
 
-    if (input_size < 3) {
-        for (i = 0; i < input_size; ++i) {
-            unsigned char c;
-            if (thtk_io_read(input, &c, 1, error) != 1)
-                return -1;
-            ++bytes_read;
-            if (thtk_io_write(output, &c, 1, error) != 1)
-                return -1;
-            ++bytes_written;
-        }
-        return bytes_written;
-    } else if (input_size >= 3) {
-        unsigned char prev, cur;
-        if (thtk_io_read(input, &prev, 1, error) != 1)
-            return -1;
-        ++bytes_read;
-        if (thtk_io_write(output, &prev, 1, error) != 1)
-            return -1;
-        ++bytes_written;
-        if (thtk_io_read(input, &cur, 1, error) != 1)
-            return -1;
-        ++bytes_read;
-        if (thtk_io_write(output, &cur, 1, error) != 1)
-            return -1;
-        ++bytes_written;
-        while (bytes_read < input_size) {
-            if (prev == cur) {
-                unsigned char count;
-                if (thtk_io_read(input, &count, 1, error) != 1)
-                    return -1;
-                ++bytes_read;
-                for (i = 0; i < count; ++i) {
-                    if (thtk_io_write(output, &cur, 1, error) != 1)
-                        return -1;
-                    ++bytes_written;
-                }
-
-                if (bytes_read == input_size)
-                    break;
-            }
-
-            prev = cur;
-            if (thtk_io_read(input, &cur, 1, error) != 1)
-                return -1;
-            ++bytes_read;
-            if (thtk_io_write(output, &cur, 1, error) != 1)
-                return -1;
-            ++bytes_written;
-        }
+    unsigned char* rle = malloc(input_size ? input_size : 1);
+    if (thtk_io_read(input, rle, input_size, error) != (ssize_t)input_size) {
+        free(rle);
+        return -1;
     }
 
-    return bytes_written;
+    const size_t size = thtk_unrle_mem(rle, input_size, NULL, 0);
+    unsigned char* data = malloc(size ? size : 1);
+    thtk_unrle_mem(rle, input_size, data, size);
+    free(rle);
+
+    ssize_t ret = thtk_io_write(output, data, size, error);
+    free(data);
+    return ret == -1 ? -1 : (ssize_t)size;
 }
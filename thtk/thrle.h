@@ -35,6 +35,9 @@
 #endif
 #include <thtk/thtk.h>
 
+/* Like the _mem functions, for streams.  input_size bytes are read from the
+ * input, and the number of bytes written to the output is returned.  -1
+ * indicates an error. */
 ssize_t thtk_rle(
     thtk_io_t* input,
     size_t input_size,
@@ -47,4 +50,22 @@ ssize_t thtk_unrle(
     thtk_io_t* output,
     thtk_error_t** error);
 
+/* Compresses from one buffer into another, writing at most output_size bytes.
+ * Returns the full compressed size, which is larger than output_size if the
+ * output didn't fit.  If output is NULL, nothing is written. */
+size_t thtk_rle_mem(
+    const unsigned char* input,
+    size_t input_size,
+    unsigned char* output,
+    size_t output_size);
+
+/* Decompresses from one buffer into another, writing at most output_size
+ * bytes.  Returns the number of bytes written.  If output is NULL, nothing is
+ * written and the full decompressed size is returned. */
+size_t thtk_unrle_mem(
+    const unsigned char* input,
+    size_t input_size,
+    unsigned char* output,
+    size_t output_size);
+
 #endif
@@ -36,4 +36,8 @@
 
 #include <thtk/detect.h>
 
+#include <thtk/pool.h>
+
+#include <thtk/vfs.h>
+
 #endif
@@ -28,6 +28,7 @@
  */
 #include <config.h>
 #include <string.h>
+#include <time.h>
 #include "util.h"
 
 #ifndef HAVE_MEMPCPY
@@ -41,3 +42,24 @@ mempcpy(
     return (void*)((size_t)dest + n);
 }
 #endif
+
+uint64_t
+thtk_clock_ns(
+    void)
+{
+#if defined(_WIN32)
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    if (!frequency.QuadPart)
+        QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (uint64_t)(counter.QuadPart / frequency.QuadPart) * 1000000000 +
+        (uint64_t)(counter.QuadPart % frequency.QuadPart) * 1000000000 / frequency.QuadPart;
+#elif defined(HAVE_CLOCK_GETTIME)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+    return (uint64_t)clock() * (1000000000 / CLOCKS_PER_SEC);
+#endif
+}
@@ -30,7 +30,13 @@
 #define UTIL_H_
 
 #include <config.h>
+#include <stdint.h>
 #include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
 
 #ifndef HAVE_MEMPCPY
 /* "Writes" a value to a buffer and returns a pointer to the memory location
@@ -41,4 +47,49 @@ void* mempcpy(
     size_t n);
 #endif
 
+/* Pointers which are filled in lazily by whichever thread gets there first.
+ * THTK_ATOMIC_CAS_PTR stores desired if *ptr is still expected and evaluates
+ * to nonzero if it did. */
+#ifdef _MSC_VER
+#define THTK_ATOMIC_LOAD_PTR(ptr) \
+    InterlockedCompareExchangePointer((PVOID volatile*)(ptr), NULL, NULL)
+#define THTK_ATOMIC_CAS_PTR(ptr, expected, desired) \
+    (InterlockedCompareExchangePointer((PVOID volatile*)(ptr), (desired), (expected)) == (expected))
+#else
+#define THTK_ATOMIC_LOAD_PTR(ptr) \
+    __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+#define THTK_ATOMIC_CAS_PTR(ptr, expected, desired) \
+    __sync_bool_compare_and_swap((ptr), (expected), (desired))
+#endif
+
+#ifdef _MSC_VER
+#define THTK_THREAD_LOCAL __declspec(thread)
+#else
+#define THTK_THREAD_LOCAL __thread
+#endif
+
+/* Returns a monotonic time in nanoseconds. */
+uint64_t thtk_clock_ns(
+    void);
+
+/* Mutual exclusion for short critical sections.  Mutexes defined with
+ * THTK_MUTEX_INIT need no other initialization or cleanup. */
+#ifdef _WIN32
+typedef SRWLOCK thtk_mutex_t;
+#define THTK_MUTEX_INIT SRWLOCK_INIT
+#define thtk_mutex_init(mutex) InitializeSRWLock(mutex)
+#define thtk_mutex_destroy(mutex) ((void)(mutex))
+#define thtk_mutex_lock(mutex) AcquireSRWLockExclusive(mutex)
+#define thtk_mutex_trylock(mutex) TryAcquireSRWLockExclusive(mutex)
+#define thtk_mutex_unlock(mutex) ReleaseSRWLockExclusive(mutex)
+#else
+typedef pthread_mutex_t thtk_mutex_t;
+#define THTK_MUTEX_INIT PTHREAD_MUTEX_INITIALIZER
+#define thtk_mutex_init(mutex) pthread_mutex_init((mutex), NULL)
+#define thtk_mutex_destroy(mutex) pthread_mutex_destroy(mutex)
+#define thtk_mutex_lock(mutex) pthread_mutex_lock(mutex)
+#define thtk_mutex_trylock(mutex) (pthread_mutex_trylock(mutex) == 0)
+#define thtk_mutex_unlock(mutex) pthread_mutex_unlock(mutex)
+#endif
+
 #endif
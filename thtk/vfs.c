@@ -0,0 +1,460 @@
+/*
+ * Redistribution and use in source and binary forms, with
+ * or without modification, are permitted provided that the
+ * following conditions are met:
+ *
+ * 1. Redistributions of source code must retain this list
+ *    of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce this
+ *    list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+#include <config.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+#include <thtk/thtk.h>
+#include <thtk/vfs.h>
+
+typedef struct {
+    char* name;
+    uint32_t hash;
+    /* Archive entries. */
+    thdat_t* archive;
+    int entry;
+    /* Files in directories. */
+    char* path;
+    ssize_t size;
+} thvfs_file_t;
+
+struct thvfs_t {
+    thvfs_file_t* files;
+    size_t file_count;
+    size_t file_capacity;
+    /* Open addressing table of file numbers plus one, zero marks a free
+     * slot.  The size is a power of two. */
+    size_t* table;
+    size_t table_size;
+};
+
+static inline unsigned char
+thvfs_fold(
+    unsigned char c)
+{
+    if (c == '\\')
+        return '/';
+    if (c >= 'A' && c <= 'Z')
+        return c - 'A' + 'a';
+    return c;
+}
+
+/* FNV-1a. */
+static uint32_t
+thvfs_hash(
+    const char* name)
+{
+    uint32_t hash = 2166136261u;
+    for (; *name; ++name) {
+        hash ^= thvfs_fold(*name);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static int
+thvfs_name_equal(
+    const char* a,
+    const char* b)
+{
+    for (; *a && *b; ++a, ++b) {
+        if (thvfs_fold(*a) != thvfs_fold(*b))
+            return 0;
+    }
+    return *a == *b;
+}
+
+/* Returns the slot holding name, or the free slot where it belongs. */
+static size_t
+thvfs_find_slot(
+    const thvfs_t* vfs,
+    const char* name,
+    uint32_t hash)
+{
+    const size_t mask = vfs->table_size - 1;
+    size_t slot = hash & mask;
+    while (vfs->table[slot]) {
+        const thvfs_file_t* file = &vfs->files[vfs->table[slot] - 1];
+        if (file->hash == hash && thvfs_name_equal(file->name, name))
+            break;
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+static void
+thvfs_grow_table(
+    thvfs_t* vfs)
+{
+    free(vfs->table);
+    vfs->table_size = vfs->table_size ? vfs->table_size * 2 : 256;
+    vfs->table = calloc(vfs->table_size, sizeof(*vfs->table));
+    for (size_t f = 0; f < vfs->file_count; ++f) {
+        const size_t slot = thvfs_find_slot(vfs, vfs->files[f].name, vfs->files[f].hash);
+        vfs->table[slot] = f + 1;
+    }
+}
+
+/* Adds a file, replacing any earlier file with the same name.  Takes
+ * ownership of path. */
+static void
+thvfs_add(
+    thvfs_t* vfs,
+    const char* name,
+    thdat_t* archive,
+    int entry,
+    char* path,
+    ssize_t size)
+{
+    /* Keep the table at most half full. */
+    if ((vfs->file_count + 1) * 2 > vfs->table_size)
+        thvfs_grow_table(vfs);
+
+    const uint32_t hash = thvfs_hash(name);
+    const size_t slot = thvfs_find_slot(vfs, name, hash);
+    thvfs_file_t* file;
+    if (vfs->table[slot]) {
+        file = &vfs->files[vfs->table[slot] - 1];
+        free(file->path);
+    } else {
+        if (vfs->file_count == vfs->file_capacity) {
+            vfs->file_capacity = vfs->file_capacity ? vfs->file_capacity * 2 : 256;
+            vfs->files = realloc(vfs->files, vfs->file_capacity * sizeof(*vfs->files));
+        }
+        file = &vfs->files[vfs->file_count++];
+        file->name = strdup(name);
+        file->hash = hash;
+        vfs->table[slot] = vfs->file_count;
+    }
+    file->archive = archive;
+    file->entry = entry;
+    file->path = path;
+    file->size = size;
+}
+
+thvfs_t*
+thvfs_new(
+    thtk_error_t** error)
+{
+    thvfs_t* vfs = malloc(sizeof(*vfs));
+    vfs->files = NULL;
+    vfs->file_count = 0;
+    vfs->file_capacity = 0;
+    vfs->table = NULL;
+    vfs->table_size = 0;
+    return vfs;
+}
+
+void
+thvfs_free(
+    thvfs_t* vfs)
+{
+    if (vfs) {
+        for (size_t f = 0; f < vfs->file_count; ++f) {
+            free(vfs->files[f].name);
+            free(vfs->files[f].path);
+        }
+        free(vfs->files);
+        free(vfs->table);
+        free(vfs);
+    }
+}
+
+int
+thvfs_mount_archive(
+    thvfs_t* vfs,
+    thdat_t* archive,
+    thtk_error_t** error)
+{
+    if (!vfs || !archive) {
+        thtk_error_new(error, "invalid parameter passed");
+        return 0;
+    }
+
+    ssize_t entry_count = thdat_entry_count(archive, error);
+    if (entry_count == -1)
+        return 0;
+    for (ssize_t e = 0; e < entry_count; ++e) {
+        const char* name = thdat_entry_get_name(archive, e, error);
+        if (!name)
+            return 0;
+        thvfs_add(vfs, name, archive, e, NULL, -1);
+    }
+    return 1;
+}
+
+static char*
+thvfs_join(
+    const char* a,
+    const char* b)
+{
+    const size_t a_len = strlen(a);
+    char* path = malloc(a_len + strlen(b) + 2);
+    strcpy(path, a);
+    if (a_len && a[a_len - 1] != '/' && a[a_len - 1] != '\\')
+        strcat(path, "/");
+    strcat(path, b);
+    return path;
+}
+
+/* Adds the files below root/prefix, named prefix/... */
+static int
+thvfs_scan_directory(
+    thvfs_t* vfs,
+    const char* root,
+    const char* prefix,
+    thtk_error_t** error)
+{
+    char* dir = *prefix ? thvfs_join(root, prefix) : strdup(root);
+#ifdef _WIN32
+    WIN32_FIND_DATAA wfd;
+    char* query = thvfs_join(dir, "*");
+    HANDLE h = FindFirstFileA(query, &wfd);
+    free(query);
+    if (h == INVALID_HANDLE_VALUE) {
+        thtk_error_new(error, "couldn't open directory `%s'", dir);
+        free(dir);
+        return 0;
+    }
+    do {
+        const char* name = wfd.cFileName;
+        if (name[0] == '.')
+            continue;
+        char* relative = *prefix ? thvfs_join(prefix, name) : strdup(name);
+        if (wfd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            int ret = thvfs_scan_directory(vfs, root, relative, error);
+            free(relative);
+            if (!ret) {
+                FindClose(h);
+                free(dir);
+                return 0;
+            }
+        } else {
+            const ssize_t size = ((uint64_t)wfd.nFileSizeHigh << 32) | wfd.nFileSizeLow;
+            thvfs_add(vfs, relative, NULL, -1, thvfs_join(dir, name), size);
+            free(relative);
+        }
+    } while (FindNextFileA(h, &wfd));
+    FindClose(h);
+#else
+    DIR* d = opendir(dir);
+    if (!d) {
+        thtk_error_new(error, "couldn't open directory `%s': %s", dir, strerror(errno));
+        free(dir);
+        return 0;
+    }
+    struct dirent* ent;
+    while ((ent = readdir(d))) {
+        const char* name = ent->d_name;
+        if (name[0] == '.')
+            continue;
+        char* path = thvfs_join(dir, name);
+        struct stat st;
+        if (stat(path, &st) == -1) {
+            free(path);
+            continue;
+        }
+        char* relative = *prefix ? thvfs_join(prefix, name) : strdup(name);
+        if (S_ISDIR(st.st_mode)) {
+            free(path);
+            int ret = thvfs_scan_directory(vfs, root, relative, error);
+            free(relative);
+            if (!ret) {
+                closedir(d);
+                free(dir);
+                return 0;
+            }
+        } else if (S_ISREG(st.st_mode)) {
+            thvfs_add(vfs, relative, NULL, -1, path, st.st_size);
+            free(relative);
+        } else {
+            free(path);
+            free(relative);
+        }
+    }
+    closedir(d);
+#endif
+    free(dir);
+    return 1;
+}
+
+int
+thvfs_mount_directory(
+    thvfs_t* vfs,
+    const char* path,
+    thtk_error_t** error)
+{
+    if (!vfs || !path) {
+        thtk_error_new(error, "invalid parameter passed");
+        return 0;
+    }
+    return thvfs_scan_directory(vfs, path, "", error);
+}
+
+ssize_t
+thvfs_file_count(
+    thvfs_t* vfs,
+    thtk_error_t** error)
+{
+    if (!vfs) {
+        thtk_error_new(error, "invalid parameter passed");
+        return -1;
+    }
+    return vfs->file_count;
+}
+
+ssize_t
+thvfs_lookup(
+    thvfs_t* vfs,
+    const char* name,
+    thtk_error_t** error)
+{
+    if (!vfs || !name) {
+        thtk_error_new(error, "invalid parameter passed");
+        return -1;
+    }
+    if (!vfs->file_count)
+        return -1;
+    const size_t slot = thvfs_find_slot(vfs, name, thvfs_hash(name));
+    return (ssize_t)vfs->table[slot] - 1;
+}
+
+static thvfs_file_t*
+thvfs_get_file(
+    thvfs_t* vfs,
+    ssize_t file,
+    thtk_error_t** error)
+{
+    if (!vfs || file < 0 || (size_t)file >= vfs->file_count) {
+        thtk_error_new(error, "invalid parameter passed");
+        return NULL;
+    }
+    return &vfs->files[file];
+}
+
+const char*
+thvfs_get_name(
+    thvfs_t* vfs,
+    ssize_t file,
+    thtk_error_t** error)
+{
+    thvfs_file_t* f = thvfs_get_file(vfs, file, error);
+    return f ? f->name : NULL;
+}
+
+ssize_t
+thvfs_get_size(
+    thvfs_t* vfs,
+    ssize_t file,
+    thtk_error_t** error)
+{
+    thvfs_file_t* f = thvfs_get_file(vfs, file, error);
+    if (!f)
+        return -1;
+    if (f->archive)
+        return thdat_entry_get_size(f->archive, f->entry, error);
+    return f->size;
+}
+
+static ssize_t
+thvfs_read_file(
+    const thvfs_file_t* f,
+    void* buf,
+    size_t offset,
+    size_t count,
+    thtk_error_t** error)
+{
+    if (offset >= (size_t)f->size || !count)
+        return 0;
+    if (count > f->size - offset)
+        count = f->size - offset;
+
+    thtk_io_t* stream = thtk_io_open_file(f->path, "rb", error);
+    if (!stream)
+        return -1;
+    ssize_t ret = thtk_io_pread(stream, buf, count, offset, error);
+    thtk_io_close(stream);
+    return ret;
+}
+
+ssize_t
+thvfs_read_into(
+    thvfs_t* vfs,
+    ssize_t file,
+    void* buf,
+    size_t capacity,
+    thtk_error_t** error)
+{
+    thvfs_file_t* f = thvfs_get_file(vfs, file, error);
+    if (!f)
+        return -1;
+    if (f->archive)
+        return thdat_entry_read_into(f->archive, f->entry, buf, capacity, error);
+
+    if (!buf) {
+        thtk_error_new(error, "invalid parameter passed");
+        return -1;
+    }
+    if ((size_t)f->size > capacity) {
+        thtk_error_new(error, "buffer too small");
+        return -1;
+    }
+    return thvfs_read_file(f, buf, 0, f->size, error);
+}
+
+ssize_t
+thvfs_read_range(
+    thvfs_t* vfs,
+    ssize_t file,
+    void* buf,
+    size_t offset,
+    size_t count,
+    thtk_error_t** error)
+{
+    thvfs_file_t* f = thvfs_get_file(vfs, file, error);
+    if (!f)
+        return -1;
+    if (f->archive)
+        return thdat_entry_read_range(f->archive, f->entry, buf, offset, count, error);
+
+    if (!buf) {
+        thtk_error_new(error, "invalid parameter passed");
+        return -1;
+    }
+    return thvfs_read_file(f, buf, offset, count, error);
+}
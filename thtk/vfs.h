@@ -0,0 +1,125 @@
+/*
+ * Redistribution and use in source and binary forms, with
+ * or without modification, are permitted provided that the
+ * following conditions are met:
+ *
+ * 1. Redistributions of source code must retain this list
+ *    of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce this
+ *    list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+#ifndef THTK_VFS_H_
+#define THTK_VFS_H_
+
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+#include <thtk/error.h>
+#include <thtk/dat.h>
+
+#ifndef API_SYMBOL
+#define API_SYMBOL /* */
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A stack of archives and directories seen as one set of files.  Files in
+ * later mounts hide files with the same name in earlier ones.  Names are
+ * matched without regard to ASCII case, and '\' matches '/'. */
+typedef struct thvfs_t thvfs_t;
+
+/* Creates an empty file system.  NULL indicates an error. */
+API_SYMBOL thvfs_t* thvfs_new(
+    thtk_error_t** error);
+
+/* Frees the file system.  Mounted archives are not closed. */
+API_SYMBOL void thvfs_free(
+    thvfs_t* vfs);
+
+/* Mounts an open archive on top of the stack.  The archive has to stay open
+ * until the file system is freed.  Returns 0 on error, otherwise 1. */
+API_SYMBOL int thvfs_mount_archive(
+    thvfs_t* vfs,
+    thdat_t* archive,
+    thtk_error_t** error);
+
+/* Mounts the files below a directory on top of the stack, named by their path
+ * relative to it.  Hidden files are skipped.  The directory is scanned once
+ * here; later changes to it are not picked up.  Returns 0 on error, otherwise
+ * 1. */
+API_SYMBOL int thvfs_mount_directory(
+    thvfs_t* vfs,
+    const char* path,
+    thtk_error_t** error);
+
+/* Returns the number of distinct files, or -1 on error.  Files are numbered
+ * from 0. */
+API_SYMBOL ssize_t thvfs_file_count(
+    thvfs_t* vfs,
+    thtk_error_t** error);
+
+/* Returns the number of the file with the given name, or -1 if there is no
+ * such file. */
+API_SYMBOL ssize_t thvfs_lookup(
+    thvfs_t* vfs,
+    const char* name,
+    thtk_error_t** error);
+
+/* Returns the name of a file, NULL indicates an error. */
+API_SYMBOL const char* thvfs_get_name(
+    thvfs_t* vfs,
+    ssize_t file,
+    thtk_error_t** error);
+
+/* Returns the uncompressed size of a file, or -1 on error. */
+API_SYMBOL ssize_t thvfs_get_size(
+    thvfs_t* vfs,
+    ssize_t file,
+    thtk_error_t** error);
+
+/* Reads a whole file into buf, which must be able to hold thvfs_get_size
+ * bytes.  Works like thdat_entry_read_into.  The number of bytes read is
+ * returned.  -1 indicates an error. */
+API_SYMBOL ssize_t thvfs_read_into(
+    thvfs_t* vfs,
+    ssize_t file,
+    void* buf,
+    size_t capacity,
+    thtk_error_t** error);
+
+/* Reads count bytes from offset in a file into buf.  Works like
+ * thdat_entry_read_range.  The number of bytes read is returned.  -1
+ * indicates an error. */
+API_SYMBOL ssize_t thvfs_read_range(
+    thvfs_t* vfs,
+    ssize_t file,
+    void* buf,
+    size_t offset,
+    size_t count,
+    thtk_error_t** error);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,262 @@
+/*
+ * Redistribution and use in source and binary forms, with
+ * or without modification, are permitted provided that the
+ * following conditions are met:
+ *
+ * 1. Redistributions of source code must retain this list
+ *    of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce this
+ *    list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+#include <config.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <thtk/thtk.h>
+#include "daemon.h"
+#include "extract.h"
+#include "program.h"
+#include "util.h"
+#include "mygetopt.h"
+
+/* Archives kept open between requests. */
+#define CACHE_SIZE 16
+
+typedef struct {
+    char* path;
+    unsigned int version;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    thtk_io_t* stream;
+    thdat_t* thdat;
+    unsigned long last_used;
+} cached_archive_t;
+
+static cached_archive_t cache[CACHE_SIZE];
+static unsigned long cache_clock;
+
+static void
+print_usage(
+    void)
+{
+    printf("Usage: %s [-V] SOCKET\n"
+           "Serves thdat -l and -x requests on the UNIX domain socket SOCKET,\n"
+           "keeping recently used archives open.  Clients use it when the\n"
+           "environment variable " UTIL_DAEMON_SOCKET_ENV " is set to SOCKET.\n"
+           "Options:\n"
+           "  -V  display version information and exit\n"
+           "Report bugs to <" PACKAGE_BUGREPORT ">.\n", argv0);
+}
+
+static void
+print_error(
+    thtk_error_t* error)
+{
+    fprintf(stderr, "%s:%s\n", argv0, thtk_error_message(error));
+}
+
+static void
+cache_drop(
+    cached_archive_t* archive)
+{
+    thdat_free(archive->thdat);
+    thtk_io_close(archive->stream);
+    free(archive->path);
+    memset(archive, 0, sizeof(*archive));
+}
+
+/* Returns the open archive, opening it if it isn't cached or has changed
+ * since. */
+static thdat_t*
+cache_get(
+    const char* path,
+    unsigned int version,
+    thtk_error_t** error)
+{
+    struct stat st;
+    if (stat(path, &st) == -1) {
+        thtk_error_new(error, "couldn't open `%s': %s", path, strerror(errno));
+        return NULL;
+    }
+
+    cached_archive_t* slot = &cache[0];
+    for (int i = 0; i < CACHE_SIZE; ++i) {
+        cached_archive_t* archive = &cache[i];
+        if (archive->path && archive->version == version &&
+            strcmp(archive->path, path) == 0) {
+            if (archive->dev == st.st_dev && archive->ino == st.st_ino &&
+                archive->size == st.st_size && archive->mtime == st.st_mtime) {
+                archive->last_used = ++cache_clock;
+                return archive->thdat;
+            }
+            cache_drop(archive);
+            slot = archive;
+            break;
+        }
+        if (!archive->path ||
+            (slot->path && archive->last_used < slot->last_used))
+            slot = archive;
+    }
+    if (slot->path)
+        cache_drop(slot);
+
+    thtk_io_t* stream = thtk_io_open_file_mapped(path, error);
+    if (!stream)
+        return NULL;
+    thdat_t* thdat = thdat_open(version, stream, error);
+    if (!thdat) {
+        thtk_io_close(stream);
+        return NULL;
+    }
+
+    slot->path = strdup(path);
+    slot->version = version;
+    slot->dev = st.st_dev;
+    slot->ino = st.st_ino;
+    slot->size = st.st_size;
+    slot->mtime = st.st_mtime;
+    slot->stream = stream;
+    slot->thdat = thdat;
+    slot->last_used = ++cache_clock;
+    return thdat;
+}
+
+/* Runs a request in a child process, which works in the client's directory
+ * and writes to the client's output.  The open archives are shared with it. */
+static void
+serve(
+    util_daemon_request_t* request)
+{
+    thtk_error_t* error = NULL;
+    char* end;
+
+    /* Only thdat -l and -x are handled here; the client does anything else
+     * itself. */
+    if (request->argc < 3 ||
+        strcmp(util_shortname(request->argv[0]), "thdat") != 0 ||
+        (request->argv[1][0] != '-') ||
+        (request->argv[1][1] != 'l' && request->argv[1][1] != 'x')) {
+        util_daemon_reply(request, -1);
+        return;
+    }
+    const int mode = request->argv[1][1];
+    const unsigned int version = strtoul(request->argv[1] + 2, &end, 10);
+    if (end == request->argv[1] + 2 || *end) {
+        util_daemon_reply(request, -1);
+        return;
+    }
+
+    const char* name = request->argv[2];
+    char* path = NULL;
+    if (name[0] != '/') {
+        path = malloc(strlen(request->cwd) + strlen(name) + 2);
+        sprintf(path, "%s/%s", request->cwd, name);
+        name = path;
+    }
+
+    thdat_t* thdat = cache_get(name, version, &error);
+    free(path);
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        thtk_error_free(&error);
+        util_daemon_reply(request, -1);
+        return;
+    }
+    if (pid)
+        return;
+
+    int status = 1;
+    dup2(request->out, STDOUT_FILENO);
+    dup2(request->err, STDERR_FILENO);
+    argv0 = "thdat";
+    if (!thdat) {
+        print_error(error);
+        thtk_error_free(&error);
+    } else if (chdir(request->cwd) == -1) {
+        fprintf(stderr, "%s: couldn't change directory to %s: %s\n",
+            argv0, request->cwd, strerror(errno));
+    } else if (mode == 'l') {
+        if (thdat_list_archive(thdat, version, &error))
+            status = 0;
+    } else if (request->argc > 3) {
+        thdat_extract_named(thdat, request->argc - 3, request->argv + 3);
+        status = 0;
+    } else if (thdat_extract_all(thdat, NULL, &error)) {
+        status = 0;
+    }
+    if (error) {
+        print_error(error);
+        thtk_error_free(&error);
+    }
+    fflush(stdout);
+    fflush(stderr);
+    util_daemon_reply(request, status);
+    _exit(status);
+}
+
+int
+main(
+    int argc,
+    char* argv[])
+{
+    argv0 = util_shortname(argv[0]);
+    int opt;
+    int ind = 0;
+    while (argv[util_optind]) {
+        switch (opt = util_getopt(argc, argv, ":V")) {
+        default:
+            util_getopt_default(&ind, argv, opt, print_usage);
+        }
+    }
+    argc = ind;
+    argv[argc] = NULL;
+
+    if (argc != 1) {
+        print_usage();
+        exit(1);
+    }
+
+    /* Children are reaped automatically, and a client going away doesn't
+     * stop the daemon. */
+    signal(SIGCHLD, SIG_IGN);
+    signal(SIGPIPE, SIG_IGN);
+
+    int listen_fd = util_daemon_listen(argv[0]);
+    if (listen_fd == -1) {
+        fprintf(stderr, "%s: couldn't listen on %s: %s\n", argv0, argv[0], strerror(errno));
+        exit(1);
+    }
+
+    for (;;) {
+        util_daemon_request_t request;
+        if (!util_daemon_accept(listen_fd, &request))
+            continue;
+        serve(&request);
+        util_daemon_request_free(&request);
+    }
+}
@@ -0,0 +1,357 @@
+/*
+ * Redistribution and use in source and binary forms, with
+ * or without modification, are permitted provided that the
+ * following conditions are met:
+ *
+ * 1. Redistributions of source code must retain this list
+ *    of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce this
+ *    list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+#include <config.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+#include "daemon.h"
+
+/* A request is a header of two uint32_t values, the size of the strings that
+ * follow and argc, sent along with the client's standard output and error.
+ * The strings are the working directory and then argv, each terminated by a
+ * zero byte.  The reply is the exit status as an int32_t. */
+
+#define UTIL_DAEMON_MAX_REQUEST (1024 * 1024)
+
+#ifndef _WIN32
+/* A peer that hangs up, or is refused, mustn't kill the other end. */
+#ifdef MSG_NOSIGNAL
+# define UTIL_DAEMON_SEND_FLAGS MSG_NOSIGNAL
+#else
+# define UTIL_DAEMON_SEND_FLAGS 0
+#endif
+
+static int
+util_daemon_write(
+    int fd,
+    const void* buf,
+    size_t count)
+{
+    size_t done = 0;
+    while (done < count) {
+        ssize_t ret = send(fd, (const char*)buf + done, count - done, UTIL_DAEMON_SEND_FLAGS);
+        if (ret == -1) {
+            if (errno == EINTR)
+                continue;
+            return 0;
+        }
+        done += ret;
+    }
+    return 1;
+}
+
+static int
+util_daemon_read(
+    int fd,
+    void* buf,
+    size_t count)
+{
+    size_t done = 0;
+    while (done < count) {
+        ssize_t ret = read(fd, (char*)buf + done, count - done);
+        if (ret == -1) {
+            if (errno == EINTR)
+                continue;
+            return 0;
+        }
+        if (ret == 0)
+            return 0;
+        done += ret;
+    }
+    return 1;
+}
+
+static int
+util_daemon_address(
+    const char* socket_path,
+    struct sockaddr_un* addr)
+{
+    if (strlen(socket_path) >= sizeof(addr->sun_path))
+        return 0;
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, socket_path);
+    return 1;
+}
+
+/* Requests run in the client's working directory with the daemon's rights,
+ * so only the user running the daemon may make them. */
+static int
+util_daemon_peer_allowed(
+    int fd)
+{
+#if defined(SO_PEERCRED)
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1)
+        return 0;
+    return cred.uid == getuid();
+#elif defined(HAVE_GETPEEREID)
+    uid_t uid;
+    gid_t gid;
+    if (getpeereid(fd, &uid, &gid) == -1)
+        return 0;
+    return uid == getuid();
+#else
+    /* The socket's mode is all there is. */
+    (void)fd;
+    return 1;
+#endif
+}
+#endif
+
+int
+util_daemon_request(
+    const char* socket_path,
+    int argc,
+    char** argv)
+{
+#ifdef _WIN32
+    return -1;
+#else
+    struct sockaddr_un addr;
+    if (!socket_path || !*socket_path || !util_daemon_address(socket_path, &addr))
+        return -1;
+
+    char cwd[4096];
+    if (!getcwd(cwd, sizeof(cwd)))
+        return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1)
+        return -1;
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    size_t size = strlen(cwd) + 1;
+    for (int a = 0; a < argc; ++a)
+        size += strlen(argv[a]) + 1;
+    char* buffer = malloc(size);
+    char* p = buffer;
+    strcpy(p, cwd);
+    p += strlen(p) + 1;
+    for (int a = 0; a < argc; ++a) {
+        strcpy(p, argv[a]);
+        p += strlen(p) + 1;
+    }
+
+    /* Anything already printed has to come before the daemon's output. */
+    fflush(stdout);
+    fflush(stderr);
+
+    uint32_t header[2] = { size, argc };
+    int fds[2] = { STDOUT_FILENO, STDERR_FILENO };
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(fds))];
+    } control;
+    struct iovec iov = { header, sizeof(header) };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    int32_t status = -1;
+    if (sendmsg(fd, &msg, UTIL_DAEMON_SEND_FLAGS) != sizeof(header) ||
+        !util_daemon_write(fd, buffer, size) ||
+        !util_daemon_read(fd, &status, sizeof(status)))
+        status = -1;
+
+    free(buffer);
+    close(fd);
+    return status;
+#endif
+}
+
+int
+util_daemon_listen(
+    const char* socket_path)
+{
+#ifdef _WIN32
+    return -1;
+#else
+    struct sockaddr_un addr;
+    if (!util_daemon_address(socket_path, &addr)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1)
+        return -1;
+    /* A socket left behind by an earlier daemon is replaced, but nothing
+     * else is. */
+    struct stat st;
+    if (lstat(socket_path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            close(fd);
+            errno = EEXIST;
+            return -1;
+        }
+        unlink(socket_path);
+    }
+    /* Only the owner may connect. */
+    const mode_t old_umask = umask(0077);
+    const int bound = bind(fd, (struct sockaddr*)&addr, sizeof(addr));
+    umask(old_umask);
+    if (bound == -1 || listen(fd, 16) == -1) {
+        const int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+    return fd;
+#endif
+}
+
+int
+util_daemon_accept(
+    int listen_fd,
+    util_daemon_request_t* request)
+{
+#ifdef _WIN32
+    return 0;
+#else
+    request->conn = request->out = request->err = -1;
+    request->cwd = NULL;
+    request->argc = 0;
+    request->argv = NULL;
+    request->buffer = NULL;
+
+    while ((request->conn = accept(listen_fd, NULL, NULL)) == -1) {
+        if (errno != EINTR)
+            return 0;
+    }
+    if (!util_daemon_peer_allowed(request->conn)) {
+        util_daemon_request_free(request);
+        return 0;
+    }
+
+    uint32_t header[2];
+    int fds[2];
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(fds))];
+    } control;
+    struct iovec iov = { header, sizeof(header) };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    ssize_t ret;
+    while ((ret = recvmsg(request->conn, &msg, 0)) == -1 && errno == EINTR)
+        ;
+    struct cmsghdr* cmsg = ret == sizeof(header) ? CMSG_FIRSTHDR(&msg) : NULL;
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) {
+        util_daemon_request_free(request);
+        return 0;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    request->out = fds[0];
+    request->err = fds[1];
+
+    if (!header[0] || header[0] > UTIL_DAEMON_MAX_REQUEST || header[1] > header[0]) {
+        util_daemon_request_free(request);
+        return 0;
+    }
+    request->buffer = malloc(header[0]);
+    if (!util_daemon_read(request->conn, request->buffer, header[0]) ||
+        request->buffer[header[0] - 1] != '\0') {
+        util_daemon_request_free(request);
+        return 0;
+    }
+
+    char* p = request->buffer;
+    char* end = request->buffer + header[0];
+    request->cwd = p;
+    p += strlen(p) + 1;
+    request->argv = calloc(header[1] + 1, sizeof(char*));
+    for (request->argc = 0; request->argc < (int)header[1]; ++request->argc) {
+        if (p >= end) {
+            util_daemon_request_free(request);
+            return 0;
+        }
+        request->argv[request->argc] = p;
+        p += strlen(p) + 1;
+    }
+
+    return 1;
+#endif
+}
+
+void
+util_daemon_reply(
+    util_daemon_request_t* request,
+    int status)
+{
+#ifndef _WIN32
+    const int32_t s = status;
+    util_daemon_write(request->conn, &s, sizeof(s));
+#endif
+}
+
+void
+util_daemon_request_free(
+    util_daemon_request_t* request)
+{
+#ifndef _WIN32
+    if (request->conn != -1)
+        close(request->conn);
+    if (request->out != -1)
+        close(request->out);
+    if (request->err != -1)
+        close(request->err);
+#endif
+    free(request->argv);
+    free(request->buffer);
+    request->conn = request->out = request->err = -1;
+    request->argv = NULL;
+    request->buffer = NULL;
+}
@@ -0,0 +1,79 @@
+/*
+ * Redistribution and use in source and binary forms, with
+ * or without modification, are permitted provided that the
+ * following conditions are met:
+ *
+ * 1. Redistributions of source code must retain this list
+ *    of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce this
+ *    list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+#ifndef DAEMON_H_
+#define DAEMON_H_
+
+#include <config.h>
+
+/* Environment variable naming the socket of a running thtkd. */
+#define UTIL_DAEMON_SOCKET_ENV "THTKD_SOCKET"
+
+/* Asks the thtkd listening on socket_path to run the command in argv for this
+ * process.  The daemon works in the current directory and writes to this
+ * process's standard output and error.  Returns the exit status of the
+ * command, or -1 if the daemon couldn't be reached, in which case nothing has
+ * been done. */
+int util_daemon_request(
+    const char* socket_path,
+    int argc,
+    char** argv);
+
+typedef struct {
+    int conn;
+    /* The client's standard output and error. */
+    int out;
+    int err;
+    const char* cwd;
+    int argc;
+    char** argv;
+    char* buffer;
+} util_daemon_request_t;
+
+/* Creates a socket at socket_path, which only its owner can use, and listens
+ * on it.  Anything other than a socket already at socket_path is left alone.
+ * Returns the socket, or -1 on error. */
+int util_daemon_listen(
+    const char* socket_path);
+
+/* Waits for the next request.  Requests from other users are refused.
+ * Returns 0 on error, otherwise 1. */
+int util_daemon_accept(
+    int listen_fd,
+    util_daemon_request_t* request);
+
+/* Sends the exit status of a request to the client. */
+void util_daemon_reply(
+    util_daemon_request_t* request,
+    int status);
+
+/* Closes the descriptors of a request and frees it. */
+void util_daemon_request_free(
+    util_daemon_request_t* request);
+
+#endif
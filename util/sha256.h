@@ -0,0 +1,68 @@
+/*
+ * Redistribution and use in source and binary forms, with
+ * or without modification, are permitted provided that the
+ * following conditions are met:
+ *
+ * 1. Redistributions of source code must retain this list
+ *    of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce this
+ *    list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+#ifndef SHA256_H_
+#define SHA256_H_
+
+#include <config.h>
+#include <inttypes.h>
+#include <stddef.h>
+
+#define UTIL_SHA256_SIZE 32
+
+typedef struct {
+    uint32_t state[8];
+    uint64_t length;
+    unsigned char block[64];
+    size_t block_used;
+} util_sha256_t;
+
+void util_sha256_init(
+    util_sha256_t* ctx);
+
+void util_sha256_update(
+    util_sha256_t* ctx,
+    const void* data,
+    size_t size);
+
+void util_sha256_final(
+    util_sha256_t* ctx,
+    unsigned char digest[UTIL_SHA256_SIZE]);
+
+/* Hashes data in one go. */
+void util_sha256(
+    const void* data,
+    size_t size,
+    unsigned char digest[UTIL_SHA256_SIZE]);
+
+/* Writes the digest as 64 lowercase hexadecimal digits and a zero byte. */
+void util_sha256_hex(
+    const unsigned char digest[UTIL_SHA256_SIZE],
+    char hex[UTIL_SHA256_SIZE * 2 + 1]);
+
+#endif
@@ -73,7 +73,8 @@ util_print_version(
 
 /* XXX: Win32 has MakeSureDirectoryPathExists in dbghelp.dll. */
 void
-util_makepath(
+util_makepath_in(
+    const char* dir,
     const char* path)
 {
     char* name;
@@ -85,8 +86,15 @@ util_makepath(
         abort();
     }
 
-    name = strdup(path);
-    filename = name;
+    if (dir) {
+        name = malloc(strlen(dir) + 1 + strlen(path) + 1);
+        sprintf(name, "%s/%s", dir, path);
+        /* The root of an absolute directory exists already. */
+        filename = name[0] == '/' ? name + 1 : name;
+    } else {
+        name = strdup(path);
+        filename = name;
+    }
 
     for (;;) {
         filename = strchr(filename, '/');
@@ -119,6 +127,13 @@ util_makepath(
     free(name);
 }
 
+void
+util_makepath(
+    const char* path)
+{
+    util_makepath_in(NULL, path);
+}
+
 #ifdef WIN32
 int
 util_scan_files(
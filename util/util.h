@@ -68,6 +68,12 @@ const char* util_printfloat(
 void util_makepath(
     const char* path);
 
+/* Creates the directory and all components of the path relative to it.  The
+ * directory may be absolute, the path may not. */
+void util_makepath_in(
+    const char* dir,
+    const char* path);
+
 /* Scan directories recursively.  After use, result should be freed manually. */
 int util_scan_files(
     const char* dir,